@@ -0,0 +1,281 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#include "AllocationCounter.h"
+
+#include <cstdlib>
+
+// Heap tracking needs the size of a block being freed; glibc provides it.
+#if defined(__GLIBC__)
+#  define CAIDE_TRACK_HEAP
+#  include <malloc.h>
+#endif
+
+#if defined(CAIDE_PROFILE_ALLOCATIONS) || defined(CAIDE_TRACK_HEAP)
+
+#include <atomic>
+#include <new>
+
+namespace caide { namespace internal {
+
+namespace {
+
+// Per thread, so that the stages and budgets of requests served in parallel (see inlineBatch)
+// are charged only for their own allocations. Constant-initialized, so that operator new may
+// use them at any point of the thread's life.
+#ifdef CAIDE_PROFILE_ALLOCATIONS
+thread_local std::uint64_t numAllocations = 0;
+thread_local std::uint64_t numAllocatedBytes = 0;
+
+// -1 means 'not initialized yet': operator new may be called before static initializers
+// of this file have run, so the environment is checked lazily.
+std::atomic<int> enabledState{-1};
+
+bool isEnabled() {
+    int state = enabledState.load(std::memory_order_relaxed);
+    if (state < 0) {
+        const char* env = std::getenv("CAIDE_PROFILE_ALLOCATIONS");
+        state = (env && *env == '1') ? 1 : 0;
+        enabledState.store(state, std::memory_order_relaxed);
+    }
+    return state == 1;
+}
+#endif
+
+#ifdef CAIDE_TRACK_HEAP
+// Signed: a block freed by another thread than the one that allocated it is subtracted
+// from the thread that frees it.
+thread_local std::int64_t numHeapBytes = 0;
+#endif
+
+void onAllocated(void* ptr, std::size_t size) {
+#ifdef CAIDE_PROFILE_ALLOCATIONS
+    if (isEnabled()) {
+        ++numAllocations;
+        numAllocatedBytes += size;
+    }
+#else
+    (void)size;
+#endif
+#ifdef CAIDE_TRACK_HEAP
+    numHeapBytes += static_cast<std::int64_t>(malloc_usable_size(ptr));
+#else
+    (void)ptr;
+#endif
+}
+
+void release(void* ptr) noexcept {
+#ifdef CAIDE_TRACK_HEAP
+    if (ptr)
+        numHeapBytes -= static_cast<std::int64_t>(malloc_usable_size(ptr));
+#endif
+    std::free(ptr);
+}
+
+void* allocate(std::size_t size) {
+    if (size == 0)
+        size = 1;
+
+    while (true) {
+        if (void* ptr = std::malloc(size)) {
+            onAllocated(ptr, size);
+            return ptr;
+        }
+        std::new_handler handler = std::get_new_handler();
+        if (!handler)
+            throw std::bad_alloc();
+        handler();
+    }
+}
+
+void* allocateNoThrow(std::size_t size) noexcept {
+    try {
+        return allocate(size);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+#if defined(CAIDE_TRACK_HEAP) && defined(__cpp_aligned_new)
+// LLVM built as C++17 allocates its bump allocators' slabs through aligned operator new.
+void* allocateAligned(std::size_t size, std::size_t alignment) {
+    if (size == 0)
+        size = 1;
+    if (alignment < sizeof(void*))
+        alignment = sizeof(void*);
+
+    while (true) {
+        void* ptr = nullptr;
+        if (posix_memalign(&ptr, alignment, size) == 0) {
+            onAllocated(ptr, size);
+            return ptr;
+        }
+        std::new_handler handler = std::get_new_handler();
+        if (!handler)
+            throw std::bad_alloc();
+        handler();
+    }
+}
+
+void* allocateAlignedNoThrow(std::size_t size, std::size_t alignment) noexcept {
+    try {
+        return allocateAligned(size, alignment);
+    } catch (...) {
+        return nullptr;
+    }
+}
+#endif
+
+} // anonymous namespace
+
+#ifdef CAIDE_PROFILE_ALLOCATIONS
+bool allocationProfilingEnabled() {
+    return isEnabled();
+}
+
+AllocationStats getAllocationStats() {
+    AllocationStats stats;
+    stats.allocations = numAllocations;
+    stats.bytes = numAllocatedBytes;
+    return stats;
+}
+#else
+bool allocationProfilingEnabled() {
+    return false;
+}
+
+AllocationStats getAllocationStats() {
+    return AllocationStats{};
+}
+#endif
+
+#ifdef CAIDE_TRACK_HEAP
+bool heapTrackingSupported() {
+    return true;
+}
+
+std::int64_t getThreadHeapBytes() {
+    return numHeapBytes;
+}
+#else
+bool heapTrackingSupported() {
+    return false;
+}
+
+std::int64_t getThreadHeapBytes() {
+    return 0;
+}
+#endif
+
+}}
+
+// Replacements of global allocation functions. Aligned versions are replaced only when heap
+// is tracked; otherwise the default ones use their own allocator.
+void* operator new(std::size_t size) {
+    return caide::internal::allocate(size);
+}
+
+void* operator new[](std::size_t size) {
+    return caide::internal::allocate(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    return caide::internal::allocateNoThrow(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    return caide::internal::allocateNoThrow(size);
+}
+
+void operator delete(void* ptr) noexcept {
+    caide::internal::release(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    caide::internal::release(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+    caide::internal::release(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept {
+    caide::internal::release(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+    caide::internal::release(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept {
+    caide::internal::release(ptr);
+}
+
+#if defined(CAIDE_TRACK_HEAP) && defined(__cpp_aligned_new)
+void* operator new(std::size_t size, std::align_val_t alignment) {
+    return caide::internal::allocateAligned(size, static_cast<std::size_t>(alignment));
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment) {
+    return caide::internal::allocateAligned(size, static_cast<std::size_t>(alignment));
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return caide::internal::allocateAlignedNoThrow(size, static_cast<std::size_t>(alignment));
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return caide::internal::allocateAlignedNoThrow(size, static_cast<std::size_t>(alignment));
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept {
+    caide::internal::release(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t) noexcept {
+    caide::internal::release(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept {
+    caide::internal::release(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept {
+    caide::internal::release(ptr);
+}
+
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept {
+    caide::internal::release(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t, std::align_val_t) noexcept {
+    caide::internal::release(ptr);
+}
+#endif
+
+#else
+
+namespace caide { namespace internal {
+
+bool allocationProfilingEnabled() {
+    return false;
+}
+
+AllocationStats getAllocationStats() {
+    return AllocationStats{};
+}
+
+bool heapTrackingSupported() {
+    return false;
+}
+
+std::int64_t getThreadHeapBytes() {
+    return 0;
+}
+
+}}
+
+#endif
@@ -0,0 +1,37 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#pragma once
+
+#include <cstdint>
+
+namespace caide { namespace internal {
+
+struct AllocationStats {
+    std::uint64_t allocations = 0;
+    std::uint64_t bytes = 0;
+};
+
+// Allocation profiling replaces global operator new. It is compiled in only when the library
+// is built with CAIDE_PROFILE_ALLOCATIONS, and counting is switched on at runtime by setting
+// the environment variable CAIDE_PROFILE_ALLOCATIONS=1. On glibc, operator new is replaced
+// in all builds to track heap memory per thread (see getThreadHeapBytes()).
+bool allocationProfilingEnabled();
+
+// Number and total size of heap allocations made by the calling thread so far.
+// Always zero if allocation profiling is disabled.
+AllocationStats getAllocationStats();
+
+// Returns true if getThreadHeapBytes() is available (glibc only).
+bool heapTrackingSupported();
+
+// Bytes allocated through operator new by the calling thread and not freed yet, including
+// allocator overhead. Memory that clang allocates with malloc directly (slabs of its bump
+// allocators before LLVM 11) is not counted. Always zero if heap tracking is not supported.
+std::int64_t getThreadHeapBytes();
+
+}}
+
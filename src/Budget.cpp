@@ -0,0 +1,157 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#include "AllocationCounter.h"
+#include "Budget.h"
+#include "clang_version.h"
+
+#include <clang/Basic/Diagnostic.h>
+#include <clang/Basic/SourceLocation.h>
+#include <clang/Frontend/CompilerInstance.h>
+#include <clang/Lex/PPCallbacks.h>
+#include <clang/Lex/Preprocessor.h>
+
+#include <ctime>
+#include <memory>
+#include <sstream>
+
+
+using namespace clang;
+using std::string;
+
+namespace caide { namespace internal {
+
+namespace {
+
+thread_local Budget* currentBudget = nullptr;
+
+double getThreadCpuMilliseconds() {
+#if defined(CLOCK_THREAD_CPUTIME_ID)
+    timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0)
+        return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+#endif
+    // Process CPU time; equals the thread CPU time when one request runs at a time.
+    return 1e3 * std::clock() / CLOCKS_PER_SEC;
+}
+
+// Heap memory held by the current thread, or 0 if unknown. Unlike resident memory of the
+// process, it doesn't depend on requests running in parallel and grows even when the
+// allocator reuses memory freed earlier.
+double getThreadHeapMegabytes() {
+    return static_cast<double>(getThreadHeapBytes()) / (1024 * 1024);
+}
+
+class BudgetCallbacks: public PPCallbacks {
+public:
+    explicit BudgetCallbacks(CompilerInstance& compiler_)
+        : compiler(compiler_)
+    {}
+
+    void FileChanged(SourceLocation /*Loc*/, FileChangeReason Reason,
+                     SrcMgr::CharacteristicKind /*FileType*/, FileID /*PrevFID*/) override
+    {
+        if (Reason == EnterFile)
+            checkBudget(compiler);
+    }
+
+    static void checkBudget(CompilerInstance& compiler) {
+        Budget* budget = Budget::current();
+        DiagnosticsEngine& diagnostics = compiler.getDiagnostics();
+        if (!budget || diagnostics.hasFatalErrorOccurred() || !budget->check())
+            return;
+        // After a fatal error, clang doesn't enter any more files and suppresses
+        // other diagnostics.
+        const unsigned diagId = diagnostics.getCustomDiagID(DiagnosticsEngine::Fatal, "%0");
+        diagnostics.Report(diagId) << budget->getMessage();
+    }
+
+private:
+    CompilerInstance& compiler;
+};
+
+}
+
+Budget::Budget(const BudgetLimits& limits_)
+    : limits(limits_)
+    , start(std::chrono::steady_clock::now())
+    , startCpuMilliseconds(getThreadCpuMilliseconds())
+    , startMegabytes(limits.megabytes > 0 ? getThreadHeapMegabytes() : 0)
+    , previous(currentBudget)
+{
+    currentBudget = this;
+}
+
+Budget::~Budget() {
+    currentBudget = previous;
+}
+
+Budget* Budget::current() {
+    return currentBudget;
+}
+
+void Budget::exceed(const char* limit, double value, double maxValue) {
+    exceededLimit = limit;
+    std::ostringstream os;
+    os << "Limit " << limit << " exceeded: " << static_cast<unsigned long long>(value)
+       << " > " << static_cast<unsigned long long>(maxValue);
+    message = os.str();
+}
+
+bool Budget::check() {
+    if (!exceededLimit.empty())
+        return true;
+
+    if (limits.wallMilliseconds > 0) {
+        const double wall = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - start).count();
+        if (wall > limits.wallMilliseconds)
+            exceed("wallMilliseconds", wall, limits.wallMilliseconds);
+    }
+    if (exceededLimit.empty() && limits.cpuMilliseconds > 0) {
+        const double cpu = getThreadCpuMilliseconds() - startCpuMilliseconds;
+        if (cpu > limits.cpuMilliseconds)
+            exceed("cpuMilliseconds", cpu, limits.cpuMilliseconds);
+    }
+    if (exceededLimit.empty() && limits.megabytes > 0) {
+        const double megabytes = getThreadHeapMegabytes() - startMegabytes;
+        if (megabytes > limits.megabytes)
+            exceed("megabytes", megabytes, limits.megabytes);
+    }
+    return !exceededLimit.empty();
+}
+
+bool Budget::checkOutputSize(std::uint64_t bytes) {
+    if (exceededLimit.empty() && limits.outputBytes > 0 && bytes > limits.outputBytes)
+        exceed("outputBytes", static_cast<double>(bytes), static_cast<double>(limits.outputBytes));
+    return check();
+}
+
+string Budget::getMessage() const {
+    return message;
+}
+
+bool Budget::exceeded() {
+    Budget* budget = currentBudget;
+    return budget && budget->check();
+}
+
+void Budget::watch(CompilerInstance& compiler) {
+    if (!currentBudget)
+        return;
+    Preprocessor& preprocessor = compiler.getPreprocessor();
+    preprocessor.addPPCallbacks(std::unique_ptr<PPCallbacks>(new BudgetCallbacks(compiler)));
+#if CAIDE_CLANG_VERSION_AT_LEAST(9,0)
+    // Parsing of a large main file enters no files; check every few thousand tokens.
+    unsigned tokens = 0;
+    preprocessor.setTokenWatcher([&compiler, tokens](const Token&) mutable {
+        if (++tokens % 4096 == 0)
+            BudgetCallbacks::checkBudget(compiler);
+    });
+#endif
+}
+
+}}
@@ -0,0 +1,70 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace clang {
+    class CompilerInstance;
+}
+
+namespace caide { namespace internal {
+
+// Resource limits of one request; zero means no limit. Memory is the growth of heap memory
+// held by the current thread since the request started (see getThreadHeapBytes()).
+struct BudgetLimits {
+    double wallMilliseconds = 0;
+    double cpuMilliseconds = 0;
+    double megabytes = 0;
+    std::uint64_t outputBytes = 0;
+};
+
+// Enforces the limits of the request running on the current thread. Limits are checked at
+// stage boundaries, and periodically while clang runs (see watch()). clang is built without
+// exceptions, so a check inside clang only stops the compilation; the inliner throws after
+// clang returns. Like StatisticsCollector, the innermost budget of the current thread is used.
+class Budget {
+public:
+    explicit Budget(const BudgetLimits& limits);
+    ~Budget();
+    Budget(const Budget&) = delete;
+    Budget& operator=(const Budget&) = delete;
+
+    // Innermost budget of the current thread, or nullptr.
+    static Budget* current();
+
+    // Returns true if a limit is exceeded now or has been exceeded before.
+    bool check();
+    bool checkOutputSize(std::uint64_t bytes);
+
+    // Name of the exceeded limit (a field of InlinerLimits), or empty.
+    const std::string& getExceededLimit() const { return exceededLimit; }
+    std::string getMessage() const;
+
+    // Checks the budget of the current thread, if any.
+    static bool exceeded();
+
+    // Checks the budget of the current thread every few thousand tokens and on entering
+    // each file while the compiler runs, and stops the compilation with a fatal error
+    // when a limit is exceeded. Does nothing if the thread has no budget.
+    static void watch(clang::CompilerInstance& compiler);
+
+private:
+    void exceed(const char* limit, double value, double maxValue);
+
+    BudgetLimits limits;
+    std::chrono::steady_clock::time_point start;
+    double startCpuMilliseconds = 0;
+    double startMegabytes = 0;
+    std::string exceededLimit;
+    std::string message;
+    Budget* previous;
+};
+
+}}
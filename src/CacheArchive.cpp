@@ -0,0 +1,165 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#include "CacheArchive.h"
+
+#include <clang/Basic/Version.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/Endian.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/xxhash.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+
+
+using std::string;
+using std::vector;
+
+namespace caide { namespace internal {
+
+namespace {
+
+const char MAGIC[] = "CAIDECA1";
+const std::size_t MAGIC_SIZE = 8;
+const std::size_t COPY_BUFFER_SIZE = 1 << 16;
+
+void write64(std::ostream& out, std::uint64_t value) {
+    char bytes[8];
+    llvm::support::endian::write64le(bytes, value);
+    out.write(bytes, 8);
+}
+
+std::uint64_t read64(std::istream& in) {
+    char bytes[8];
+    if (!in.read(bytes, 8))
+        throw std::runtime_error("Unexpected end of cache archive");
+    return llvm::support::endian::read64le(bytes);
+}
+
+string readString(std::istream& in, std::uint64_t maxLength) {
+    const std::uint64_t length = read64(in);
+    if (length > maxLength)
+        throw std::runtime_error("Invalid cache archive");
+    string s(length, '\0');
+    if (length > 0 && !in.read(&s[0], length))
+        throw std::runtime_error("Unexpected end of cache archive");
+    return s;
+}
+
+void copyBytes(std::istream& in, std::ostream& out, std::uint64_t size) {
+    vector<char> buffer(COPY_BUFFER_SIZE);
+    while (size > 0) {
+        const std::size_t chunk = static_cast<std::size_t>(std::min<std::uint64_t>(size, buffer.size()));
+        if (!in.read(buffer.data(), chunk))
+            throw std::runtime_error("Unexpected end of cache archive");
+        out.write(buffer.data(), chunk);
+        size -= chunk;
+    }
+}
+
+// Names come from the archive and must not escape the destination directory.
+bool isSafeName(const string& name) {
+    if (name.empty() || name[0] == '/' || name.find('\\') != string::npos || name.find(':') != string::npos)
+        return false;
+    std::size_t begin = 0;
+    while (begin <= name.size()) {
+        std::size_t end = name.find('/', begin);
+        if (end == string::npos)
+            end = name.size();
+        const string component = name.substr(begin, end - begin);
+        if (component.empty() || component == "." || component == "..")
+            return false;
+        begin = end + 1;
+    }
+    return true;
+}
+
+}
+
+void writeCacheArchive(const string& archivePath, const string& manifest,
+                       const vector<std::pair<string, string>>& files)
+{
+    // Write to a temporary file first, so that a partial archive is never left behind.
+    const string temporaryPath = archivePath + ".tmp";
+    {
+        std::ofstream out(temporaryPath.c_str(), std::ios::binary);
+        out.write(MAGIC, MAGIC_SIZE);
+        write64(out, manifest.size());
+        out << manifest;
+        write64(out, files.size());
+        for (const auto& file : files) {
+            std::ifstream in(file.second.c_str(), std::ios::binary | std::ios::ate);
+            if (!in)
+                throw std::runtime_error("Couldn't read " + file.second);
+            const std::uint64_t size = static_cast<std::uint64_t>(in.tellg());
+            in.seekg(0);
+            write64(out, file.first.size());
+            out << file.first;
+            write64(out, size);
+            copyBytes(in, out, size);
+        }
+        if (!out)
+            throw std::runtime_error("Couldn't write " + temporaryPath);
+    }
+    if (std::error_code ec = llvm::sys::fs::rename(temporaryPath, archivePath))
+        throw std::runtime_error("Couldn't write " + archivePath + ": " + ec.message());
+}
+
+CacheArchiveReader::CacheArchiveReader(const string& archivePath_)
+    : archivePath(archivePath_)
+    , in(archivePath_.c_str(), std::ios::binary)
+{
+    if (!in)
+        throw std::runtime_error("Couldn't read " + archivePath);
+    char magic[MAGIC_SIZE];
+    if (!in.read(magic, MAGIC_SIZE) || string(magic, MAGIC_SIZE) != string(MAGIC, MAGIC_SIZE))
+        throw std::runtime_error(archivePath + " is not a cache archive");
+    manifest = readString(in, 1 << 20);
+}
+
+vector<string> CacheArchiveReader::extractTo(const string& directory) {
+    vector<string> names;
+    const std::uint64_t numFiles = read64(in);
+    for (std::uint64_t i = 0; i < numFiles; ++i) {
+        const string name = readString(in, 4096);
+        if (!isSafeName(name))
+            throw std::runtime_error("Invalid file name in cache archive: " + name);
+
+        llvm::SmallString<256> path{directory};
+        llvm::sys::path::append(path, name);
+        if (std::error_code ec = llvm::sys::fs::create_directories(llvm::sys::path::parent_path(path)))
+            throw std::runtime_error("Couldn't create a directory for " + path.str().str() + ": " + ec.message());
+
+        const std::uint64_t size = read64(in);
+        std::ofstream out(path.c_str(), std::ios::binary);
+        copyBytes(in, out, size);
+        if (!out)
+            throw std::runtime_error("Couldn't write " + path.str().str());
+        names.push_back(name);
+    }
+    return names;
+}
+
+string getClangVersion() {
+    return clang::getClangFullVersion();
+}
+
+string getToolchainFingerprint(const vector<string>& clangOptions) {
+    string description = getClangVersion();
+    for (const string& option : clangOptions) {
+        description += '\n';
+        description += option;
+    }
+    char hex[17];
+    std::snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(llvm::xxHash64(description)));
+    return hex;
+}
+
+}}
@@ -0,0 +1,57 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#pragma once
+
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace caide { namespace internal {
+
+// A single-file archive of persistent caches (compilation options, header bundle, module
+// cache), to build caches once and copy them to other machines with the same toolchain.
+//
+// Format (all integers are 64-bit little-endian):
+//
+//   magic "CAIDECA1"
+//   length of manifest M, manifest (M bytes of text)
+//   number of files N
+//   N times: length of name, name, size of contents, contents
+//
+// Names are relative paths with '/' as separator.
+
+// Writes an archive. files contains pairs (name in archive, path of the file to store).
+// Throws std::runtime_error on error.
+void writeCacheArchive(const std::string& archivePath, const std::string& manifest,
+                       const std::vector<std::pair<std::string, std::string>>& files);
+
+class CacheArchiveReader {
+public:
+    // Reads the manifest. Throws std::runtime_error if the file is not a valid archive.
+    explicit CacheArchiveReader(const std::string& archivePath);
+
+    const std::string& getManifest() const { return manifest; }
+
+    // Writes all files into the directory, creating subdirectories as necessary, and
+    // returns their names. Throws std::runtime_error on error.
+    std::vector<std::string> extractTo(const std::string& directory);
+
+private:
+    std::string archivePath;
+    std::ifstream in;
+    std::string manifest;
+};
+
+// Full version of the clang the library is built with.
+std::string getClangVersion();
+
+// Identifies the toolchain and options caches are valid for: the version of clang the
+// library is built with, and the compilation options.
+std::string getToolchainFingerprint(const std::vector<std::string>& clangOptions);
+
+}}
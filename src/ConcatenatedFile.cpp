@@ -0,0 +1,182 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#include "ConcatenatedFile.h"
+#include "clang_version.h"
+#include "SharedMemoryBuffer.h"
+#include "Timer.h"
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+
+#if CAIDE_CLANG_VERSION_AT_LEAST(10, 0)
+#  include <llvm/Support/Chrono.h>
+#  include <llvm/Support/VirtualFileSystem.h>
+#endif
+
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+
+
+using std::string;
+
+namespace caide { namespace internal {
+
+ConcatenatedFile::ConcatenatedFile(string path_)
+    : path(std::move(path_))
+{
+}
+
+ConcatenatedFile::~ConcatenatedFile() = default;
+
+void ConcatenatedFile::append(const string& filePath) {
+    // Large files are mapped rather than read.
+    auto buffer = llvm::MemoryBuffer::getFile(filePath);
+    if (!buffer)
+        throw std::runtime_error(string("File not found: " + filePath));
+    regions.push_back((*buffer)->getBuffer());
+    size += regions.back().size();
+    inputs.push_back(std::move(*buffer));
+    StatisticsCollector::count("concat.mappedFiles",
+        inputs.back()->getBufferKind() == llvm::MemoryBuffer::MemoryBuffer_MMap ? 1 : 0);
+}
+
+void ConcatenatedFile::appendNewline() {
+    regions.push_back("\n");
+    size += 1;
+}
+
+void ConcatenatedFile::writeTo(const string& filePath) const {
+    std::ofstream out{filePath, std::ios::binary};
+    for (llvm::StringRef region : regions)
+        out.write(region.data(), region.size());
+    if (!out)
+        throw std::runtime_error("Couldn't write " + filePath);
+}
+
+#if CAIDE_CLANG_VERSION_AT_LEAST(10, 0)
+
+namespace {
+
+string toAbsolutePath(const string& path) {
+    llvm::SmallString<256> absolutePath(path);
+    if (llvm::sys::fs::make_absolute(absolutePath))
+        return path;
+    llvm::sys::path::remove_dots(absolutePath, /*remove_dot_dot=*/true);
+    return string(absolutePath.begin(), absolutePath.end());
+}
+
+// State shared by the file system and files opened from it.
+struct AssembledFile {
+    std::shared_ptr<const ConcatenatedFile> file;
+    llvm::vfs::Status status;
+    std::once_flag assembled;
+    std::shared_ptr<const llvm::MemoryBuffer> buffer;
+
+    const std::shared_ptr<const llvm::MemoryBuffer>& getBuffer() {
+        std::call_once(assembled, [this] {
+            ScopedTimer timer("ConcatenatedFile::assemble");
+            std::unique_ptr<llvm::WritableMemoryBuffer> contents =
+                llvm::WritableMemoryBuffer::getNewUninitMemBuffer(file->getSize(), file->getPath());
+            char* out = contents->getBufferStart();
+            for (llvm::StringRef region : file->getRegions()) {
+                std::memcpy(out, region.data(), region.size());
+                out += region.size();
+            }
+            buffer = std::move(contents);
+        });
+        return buffer;
+    }
+};
+
+class AssembledFileHandle: public llvm::vfs::File {
+public:
+    AssembledFileHandle(std::shared_ptr<AssembledFile> file_, const string& path)
+        : file(std::move(file_))
+        , fileStatus(llvm::vfs::Status::copyWithNewName(file->status, path))
+    {}
+
+    llvm::ErrorOr<llvm::vfs::Status> status() override {
+        return fileStatus;
+    }
+
+    llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> getBuffer(const llvm::Twine& name,
+        int64_t /*fileSize*/, bool /*requiresNullTerminator*/, bool /*isVolatile*/) override
+    {
+        const std::shared_ptr<const llvm::MemoryBuffer>& buffer = file->getBuffer();
+        return std::unique_ptr<llvm::MemoryBuffer>(
+            new SharedMemoryBuffer(buffer, buffer->getBuffer(), name.str()));
+    }
+
+    std::error_code close() override {
+        return std::error_code();
+    }
+
+private:
+    std::shared_ptr<AssembledFile> file;
+    llvm::vfs::Status fileStatus;
+};
+
+class ConcatenatedFileSystem: public llvm::vfs::ProxyFileSystem {
+public:
+    ConcatenatedFileSystem(std::shared_ptr<const ConcatenatedFile> file_,
+                           llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> base)
+        : ProxyFileSystem(std::move(base))
+        , file(std::make_shared<AssembledFile>())
+        , absolutePath(toAbsolutePath(file_->getPath()))
+    {
+        file->status = llvm::vfs::Status(absolutePath, llvm::vfs::getNextVirtualUniqueID(),
+            llvm::sys::toTimePoint(std::time(nullptr)), /*User=*/0, /*Group=*/0, file_->getSize(),
+            llvm::sys::fs::file_type::regular_file, llvm::sys::fs::all_read);
+        file->file = std::move(file_);
+    }
+
+    llvm::ErrorOr<llvm::vfs::Status> status(const llvm::Twine& pathTwine) override {
+        const string path = pathTwine.str();
+        if (isConcatenatedFile(path))
+            return llvm::vfs::Status::copyWithNewName(file->status, path);
+        return ProxyFileSystem::status(path);
+    }
+
+    llvm::ErrorOr<std::unique_ptr<llvm::vfs::File>> openFileForRead(const llvm::Twine& pathTwine) override {
+        const string path = pathTwine.str();
+        if (isConcatenatedFile(path))
+            return std::unique_ptr<llvm::vfs::File>(new AssembledFileHandle(file, path));
+        return ProxyFileSystem::openFileForRead(path);
+    }
+
+private:
+    // Called for every header lookup: paths are made absolute only if the file names match.
+    bool isConcatenatedFile(const string& path) const {
+        if (path == file->file->getPath())
+            return true;
+        return llvm::sys::path::filename(path) == llvm::sys::path::filename(absolutePath) &&
+            toAbsolutePath(path) == absolutePath;
+    }
+
+    std::shared_ptr<AssembledFile> file;
+    string absolutePath;
+};
+
+}
+
+llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> createConcatenatedFileSystem(
+        std::shared_ptr<const ConcatenatedFile> file,
+        llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> base)
+{
+    return llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem>(
+        new ConcatenatedFileSystem(std::move(file), std::move(base)));
+}
+
+#endif
+
+}}
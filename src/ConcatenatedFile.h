@@ -0,0 +1,60 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#pragma once
+
+#include <llvm/ADT/IntrusiveRefCntPtr.h>
+#include <llvm/ADT/StringRef.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace llvm {
+    class MemoryBuffer;
+    namespace vfs {
+        class FileSystem;
+    }
+}
+
+namespace caide { namespace internal {
+
+// Concatenation of input files, kept as a list of regions of the files (memory mapped
+// where the OS allows) and separators between them, so that the inputs are not copied
+// before clang reads the result.
+class ConcatenatedFile {
+public:
+    // path is the name under which clang sees the concatenation.
+    explicit ConcatenatedFile(std::string path);
+    ~ConcatenatedFile();
+
+    // Appends contents of the file. Throws std::runtime_error if the file can't be read.
+    void append(const std::string& filePath);
+    void appendNewline();
+
+    const std::string& getPath() const { return path; }
+    std::uint64_t getSize() const { return size; }
+    const std::vector<llvm::StringRef>& getRegions() const { return regions; }
+
+    // Writes the concatenation to a real file. Throws std::runtime_error on error.
+    void writeTo(const std::string& filePath) const;
+
+private:
+    std::string path;
+    std::vector<std::unique_ptr<llvm::MemoryBuffer>> inputs;
+    std::vector<llvm::StringRef> regions;
+    std::uint64_t size = 0;
+};
+
+// A file system serving the concatenation under its path, and falling back to base for
+// all other files. The regions are assembled into a single buffer once, when the file is
+// first read.
+llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> createConcatenatedFileSystem(
+        std::shared_ptr<const ConcatenatedFile> file,
+        llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> base);
+
+}}
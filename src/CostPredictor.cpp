@@ -0,0 +1,330 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#include "CostPredictor.h"
+
+#include <clang/Basic/LangOptions.h>
+#include <clang/Basic/SourceLocation.h>
+#include <clang/Lex/Lexer.h>
+#include <clang/Lex/Token.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+
+using namespace clang;
+using std::string;
+using std::vector;
+
+namespace caide { namespace internal {
+
+namespace {
+
+const char* const TOTAL = "total";
+const char* const MEGABYTES = "megabytes";
+
+// Relative cost of parsing a system header, compared to <vector>. Standard headers include
+// each other, so the sum over a program is capped by the cost of <bits/stdc++.h>.
+const double ALL_HEADERS_UNITS = 40;
+
+bool startsWith(const string& s, const string& prefix) {
+    return s.compare(0, prefix.size(), prefix) == 0;
+}
+
+bool endsWith(const string& s, const string& suffix) {
+    return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+double getSystemHeaderUnits(const string& header) {
+    static const std::map<string, double> knownHeaders = {
+        {"bits/stdc++.h", ALL_HEADERS_UNITS},
+        {"algorithm", 2}, {"bitset", 1.5}, {"chrono", 2}, {"complex", 1.5}, {"fstream", 2.5},
+        {"functional", 2}, {"future", 3}, {"iomanip", 2}, {"iostream", 3}, {"map", 1.2},
+        {"random", 3}, {"regex", 6}, {"set", 1.2}, {"sstream", 2.5}, {"string", 1.5},
+        {"thread", 2.5}, {"unordered_map", 1.5}, {"unordered_set", 1.5}, {"valarray", 2},
+        // C library
+        {"cassert", 0.3}, {"cctype", 0.3}, {"cfloat", 0.3}, {"climits", 0.3}, {"cmath", 0.3},
+        {"cstdint", 0.3}, {"cstdio", 0.3}, {"cstdlib", 0.3}, {"cstring", 0.3}, {"ctime", 0.3},
+    };
+    auto it = knownHeaders.find(header);
+    if (it != knownHeaders.end())
+        return it->second;
+    if (endsWith(header, ".h"))
+        return 0.3;
+    return 1;
+}
+
+class Scanner {
+public:
+    explicit Scanner(const vector<string>& clangOptions) {
+        langOptions.CPlusPlus = true;
+        langOptions.CPlusPlus11 = true;
+
+        for (std::size_t i = 0; i < clangOptions.size(); ++i) {
+            const string& option = clangOptions[i];
+            vector<string>* dirs = nullptr;
+            string prefix;
+            if (startsWith(option, "-iquote")) {
+                dirs = &quoteDirectories;
+                prefix = "-iquote";
+            } else if (startsWith(option, "-I")) {
+                dirs = &includeDirectories;
+                prefix = "-I";
+            } else {
+                continue;
+            }
+
+            if (option.size() > prefix.size())
+                dirs->push_back(option.substr(prefix.size()));
+            else if (i + 1 < clangOptions.size())
+                dirs->push_back(clangOptions[++i]);
+        }
+    }
+
+    void scanFile(const string& filePath) {
+        llvm::SmallString<256> normalizedPath{filePath};
+        llvm::sys::path::remove_dots(normalizedPath, /*remove_dot_dot=*/true);
+        if (!visited.insert(normalizedPath.str().str()).second)
+            return;
+
+        auto buffer = llvm::MemoryBuffer::getFile(filePath);
+        if (!buffer)
+            return;
+
+        ++features.userFiles;
+        files.push_back(filePath);
+        features.userBytes += (*buffer)->getBufferSize();
+
+        const char* start = (*buffer)->getBufferStart();
+        const char* end = (*buffer)->getBufferEnd();
+        Lexer lexer(SourceLocation(), langOptions, start, start, end);
+        Token token;
+        lexer.LexFromRawLexer(token);
+        while (token.isNot(tok::eof)) {
+            if (token.is(tok::hash) && token.isAtStartOfLine()) {
+                lexer.LexFromRawLexer(token);
+                if (token.is(tok::raw_identifier) && !token.isAtStartOfLine()) {
+                    llvm::StringRef directive = token.getRawIdentifier();
+                    if (directive == "define")
+                        ++features.macros;
+                    else if (directive == "include" || directive == "include_next" || directive == "import")
+                        scanInclude(filePath, lexer.getBufferLocation(), end);
+                }
+                // The rest of the directive is not code: e.g. the quoted name of an included
+                // file is not a string literal.
+                while (token.isNot(tok::eof) && !token.isAtStartOfLine())
+                    lexer.LexFromRawLexer(token);
+                continue;
+            }
+
+            if (token.is(tok::raw_identifier)) {
+                if (token.getRawIdentifier() == "template")
+                    ++features.templates;
+            } else if (token.isLiteral()) {
+                ++features.literals;
+            }
+            lexer.LexFromRawLexer(token);
+        }
+    }
+
+    vector<string> scanLeadingSystemIncludes(const string& filePath) const {
+        vector<string> headers;
+        auto buffer = llvm::MemoryBuffer::getFile(filePath);
+        if (!buffer)
+            return headers;
+
+        const char* start = (*buffer)->getBufferStart();
+        const char* end = (*buffer)->getBufferEnd();
+        Lexer lexer(SourceLocation(), langOptions, start, start, end);
+        Token token;
+        lexer.LexFromRawLexer(token);
+        while (token.is(tok::hash) && token.isAtStartOfLine()) {
+            lexer.LexFromRawLexer(token);
+            if (!token.is(tok::raw_identifier) || token.getRawIdentifier() != "include")
+                break;
+
+            const char* p = lexer.getBufferLocation();
+            llvm::StringRef rest = llvm::StringRef(p, std::find(p, end, '\n') - p).trim();
+            const std::size_t nameEnd = rest.find('>');
+            if (rest.empty() || rest[0] != '<' || nameEnd == llvm::StringRef::npos)
+                break;
+            const llvm::StringRef name = rest.substr(1, nameEnd - 1);
+            string resolved;
+            if (resolve(filePath, name, /*angled=*/true, resolved))
+                break; // User header
+            headers.push_back(name.str());
+
+            // Skip to the next line.
+            do {
+                lexer.LexFromRawLexer(token);
+            } while (token.isNot(tok::eof) && !token.isAtStartOfLine());
+        }
+        return headers;
+    }
+
+    const CostFeatures& getFeatures() const { return features; }
+    const vector<string>& getFiles() const { return files; }
+
+private:
+    void scanInclude(const string& includingFile, const char* p, const char* end) {
+        const char* lineEnd = std::find(p, end, '\n');
+        llvm::StringRef rest = llvm::StringRef(p, lineEnd - p).trim();
+        if (rest.empty())
+            return;
+        const bool angled = rest[0] == '<';
+        if (!angled && rest[0] != '"')
+            return; // Include with a macro
+        const std::size_t nameEnd = rest.find(angled ? '>' : '"', 1);
+        if (nameEnd == llvm::StringRef::npos)
+            return;
+        const llvm::StringRef name = rest.substr(1, nameEnd - 1);
+
+        string resolved;
+        if (resolve(includingFile, name, angled, resolved))
+            scanFile(resolved);
+        else
+            features.systemHeaders.insert(name.str());
+    }
+
+    bool resolve(const string& includingFile, llvm::StringRef name, bool angled, string& resolved) const {
+        vector<string> candidates;
+        if (!angled) {
+            llvm::SmallString<256> candidate{llvm::sys::path::parent_path(includingFile)};
+            llvm::sys::path::append(candidate, name);
+            candidates.push_back(candidate.str().str());
+            for (const string& dir : quoteDirectories)
+                candidates.push_back(dir + "/" + name.str());
+        }
+        for (const string& dir : includeDirectories)
+            candidates.push_back(dir + "/" + name.str());
+
+        for (const string& candidate : candidates) {
+            if (llvm::sys::fs::exists(candidate) && !llvm::sys::fs::is_directory(candidate)) {
+                resolved = candidate;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    LangOptions langOptions;
+    vector<string> includeDirectories;
+    vector<string> quoteDirectories;
+    std::set<string> visited;
+    vector<string> files;
+    CostFeatures features;
+};
+
+}
+
+double CostFeatures::systemHeaderUnits() const {
+    double units = 0;
+    for (const string& header : systemHeaders)
+        units += getSystemHeaderUnits(header);
+    return std::min(units, ALL_HEADERS_UNITS);
+}
+
+vector<std::pair<string, double>> CostFeatures::getValues() const {
+    return {
+        {"constant", 1},
+        {"systemHeaderUnits", systemHeaderUnits()},
+        {"userFiles", double(userFiles)},
+        {"userKB", userBytes / 1024.0},
+        {"templates", double(templates)},
+        {"macros", double(macros)},
+        {"literals", double(literals)},
+    };
+}
+
+CostFeatures scanCostFeatures(const vector<string>& cppFiles, const vector<string>& clangOptions) {
+    Scanner scanner{clangOptions};
+    for (const string& cppFile : cppFiles)
+        scanner.scanFile(cppFile);
+    return scanner.getFeatures();
+}
+
+vector<string> collectUserFiles(const vector<string>& cppFiles, const vector<string>& clangOptions) {
+    Scanner scanner{clangOptions};
+    for (const string& cppFile : cppFiles)
+        scanner.scanFile(cppFile);
+    return scanner.getFiles();
+}
+
+vector<string> scanLeadingSystemIncludes(const string& cppFile, const vector<string>& clangOptions) {
+    Scanner scanner{clangOptions};
+    return scanner.scanLeadingSystemIncludes(cppFile);
+}
+
+CostModel::CostModel() {
+    // Placeholders of a plausible order of magnitude, not measured on any machine.
+    coefficients["Inliner::doInline"] = {
+        {"constant", 5}, {"systemHeaderUnits", 2.5}, {"userFiles", 0.2}, {"userKB", 0.05}, {"macros", 0.01},
+    };
+    coefficients["Optimizer::doOptimize"] = {
+        {"constant", 10}, {"systemHeaderUnits", 14}, {"userKB", 0.8}, {"templates", 0.3},
+        {"macros", 0.02}, {"literals", 0.002},
+    };
+    coefficients[TOTAL] = {
+        {"constant", 20}, {"systemHeaderUnits", 17}, {"userFiles", 0.2}, {"userKB", 0.9},
+        {"templates", 0.3}, {"macros", 0.03}, {"literals", 0.002},
+    };
+    coefficients[MEGABYTES] = {
+        {"constant", 20}, {"systemHeaderUnits", 3}, {"userKB", 0.05}, {"templates", 0.02},
+        {"literals", 0.0002},
+    };
+}
+
+CostModel CostModel::load(const string& filePath) {
+    std::ifstream in{filePath};
+    if (!in)
+        throw std::runtime_error("Couldn't read cost model " + filePath);
+
+    CostModel model;
+    model.coefficients.clear();
+    string line;
+    while (std::getline(in, line)) {
+        if (line.find_first_not_of(" \t\r") == string::npos)
+            continue;
+        std::istringstream fields{line};
+        string target, feature;
+        double coefficient = 0;
+        if (!(fields >> target >> feature >> coefficient))
+            throw std::runtime_error("Invalid line in cost model " + filePath + ": " + line);
+        model.coefficients[target][feature] = coefficient;
+    }
+    return model;
+}
+
+vector<string> CostModel::getStages() const {
+    vector<string> stages;
+    for (const auto& kv : coefficients) {
+        if (kv.first != TOTAL && kv.first != MEGABYTES)
+            stages.push_back(kv.first);
+    }
+    return stages;
+}
+
+double CostModel::predict(const string& target, const CostFeatures& features) const {
+    auto it = coefficients.find(target);
+    if (it == coefficients.end())
+        return 0;
+    double result = 0;
+    for (const auto& value : features.getValues()) {
+        auto coefficient = it->second.find(value.first);
+        if (coefficient != it->second.end())
+            result += coefficient->second * value.second;
+    }
+    return std::max(result, 0.0);
+}
+
+}}
@@ -0,0 +1,75 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#pragma once
+
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace caide { namespace internal {
+
+// Properties of a request that can be computed by a raw lexer scan of the user files,
+// without preprocessing or parsing system headers.
+struct CostFeatures {
+    unsigned long long userFiles = 0;   // Input files and user headers reached from them
+    unsigned long long userBytes = 0;
+    unsigned long long templates = 0;   // Occurrences of the 'template' keyword
+    unsigned long long macros = 0;      // #define directives
+    unsigned long long literals = 0;    // Numeric, character and string literals
+    std::set<std::string> systemHeaders; // As written in include directives
+
+    // Estimated parsing cost of the system headers, in units of <vector>.
+    double systemHeaderUnits() const;
+
+    // Named values used by the cost model, including the constant 1.
+    std::vector<std::pair<std::string, double>> getValues() const;
+};
+
+// Scans the files and the user headers they include. Include directives are resolved
+// relative to the including file and the -I/-iquote directories in clangOptions; headers
+// that are not found are assumed to be system headers.
+CostFeatures scanCostFeatures(const std::vector<std::string>& cppFiles,
+                              const std::vector<std::string>& clangOptions);
+
+// Paths of the files and of the user headers they include (resolved as in scanCostFeatures),
+// in the order of the first inclusion.
+std::vector<std::string> collectUserFiles(const std::vector<std::string>& cppFiles,
+                                          const std::vector<std::string>& clangOptions);
+
+// System headers included by the include directives at the beginning of the file, before
+// any other token, as written in the directives. Stops at the first directive that is not an
+// include of a system header (resolved as in scanCostFeatures).
+std::vector<std::string> scanLeadingSystemIncludes(const std::string& cppFile,
+                                                   const std::vector<std::string>& clangOptions);
+
+// Linear model predicting the cost of a request from its features. Each target (a stage
+// name, "total" for the whole run, or "megabytes" for memory) has a coefficient per feature.
+//
+// File format: one '<target> <feature> <coefficient>' triple per line. Calibrate the model
+// on a corpus with 'corpus-bench ... --calibrate <model-file>'.
+class CostModel {
+public:
+    // The built-in model. Its coefficients are uncalibrated placeholders: predictions are
+    // only meaningful relative to each other until a calibrated model is loaded.
+    CostModel();
+
+    // Throws std::runtime_error if the file can't be read or parsed.
+    static CostModel load(const std::string& filePath);
+
+    // Stages, for which the model has coefficients.
+    std::vector<std::string> getStages() const;
+
+    double predict(const std::string& target, const CostFeatures& features) const;
+
+private:
+    // target -> feature -> coefficient
+    std::map<std::string, std::map<std::string, double>> coefficients;
+};
+
+}}
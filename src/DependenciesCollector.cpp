@@ -17,6 +17,7 @@
 #include <clang/AST/ASTContext.h>
 #include <clang/AST/RawCommentList.h>
 #include <clang/Basic/SourceManager.h>
+#include <clang/Sema/Sema.h>
 
 #include <ostream>
 #include <sstream>
@@ -35,6 +36,34 @@ bool DependenciesCollector::TraverseDecl(Decl* decl) {
     return ret;
 }
 
+bool DependenciesCollector::markTypeTraversed(QualType type) {
+    if (type.isNull() || traversedTypes.insert({getCurrentDecl(), type.getAsOpaquePtr()}).second)
+        return true;
+    ++numSkippedTypes;
+    return false;
+}
+
+bool DependenciesCollector::markTypeLocTraversed(TypeLoc typeLoc) {
+    // The type is part of the key: a qualified TypeLoc shares the data of its unqualified one.
+    if (typeLoc.isNull() || traversedTypeLocs.insert(
+            {getCurrentDecl(), {typeLoc.getType().getAsOpaquePtr(), typeLoc.getOpaqueData()}}).second)
+        return true;
+    ++numSkippedTypes;
+    return false;
+}
+
+bool DependenciesCollector::TraverseType(QualType type) {
+    if (!markTypeTraversed(type))
+        return true;
+    return RecursiveASTVisitor<DependenciesCollector>::TraverseType(type);
+}
+
+bool DependenciesCollector::TraverseTypeLoc(TypeLoc typeLoc) {
+    if (!markTypeLocTraversed(typeLoc))
+        return true;
+    return RecursiveASTVisitor<DependenciesCollector>::TraverseTypeLoc(typeLoc);
+}
+
 void DependenciesCollector::traverseSugaredSignature(const SugaredSignature& sig, bool traverseTypeLocs) {
     for (const TemplateArgumentLoc& argLoc : sig.templateArgLocs)
         TraverseTemplateArgumentLoc(argLoc);
@@ -168,6 +197,8 @@ void DependenciesCollector::insertReference(Decl* from, Decl* to) {
         return;
     from = from->getCanonicalDecl();
     to = to->getCanonicalDecl();
+    if (approximate)
+        insertReferencesToPatterns(to);
     if (from == to)
         return;
     srcInfo.uses[from].insert(to);
@@ -211,16 +242,18 @@ bool DependenciesCollector::VisitAutoType(AutoType* autoType) {
 DependenciesCollector::DependenciesCollector(SourceManager& srcMgr,
         Sema& sema_,
         const std::unordered_set<std::string>& identifiersToKeep_,
-        SourceInfo& srcInfo_)
+        SourceInfo& srcInfo_,
+        bool approximate_)
     : sourceManager(srcMgr)
     , sema(sema_)
     , identifiersToKeep(identifiersToKeep_)
     , srcInfo(srcInfo_)
+    , approximate(approximate_)
 {
 }
 
 bool DependenciesCollector::shouldVisitImplicitCode() const { return true; }
-bool DependenciesCollector::shouldVisitTemplateInstantiations() const { return true; }
+bool DependenciesCollector::shouldVisitTemplateInstantiations() const { return !approximate; }
 bool DependenciesCollector::shouldWalkTypesOfTypeLocs() const { return true; }
 
 bool DependenciesCollector::VisitDecl(Decl* decl) {
@@ -297,6 +330,9 @@ bool DependenciesCollector::VisitNamedDecl(clang::NamedDecl* decl) {
     if (identifiersToKeep.count(decl->getQualifiedNameAsString()))
         srcInfo.declsToKeep.insert(decl);
 
+    if (approximate)
+        mainFileDeclsByName[decl->getDeclName().getAsOpaquePtr()].push_back(decl);
+
     return true;
 }
 
@@ -390,6 +426,12 @@ bool DependenciesCollector::VisitCXXConstructorDecl(CXXConstructorDecl* ctorDecl
             insertReference(ctorDecl, ctorInit->getMember());
     }
 
+    if (approximate) {
+        // Constructors are often only called from instantiations of library templates
+        // (e.g. vector::emplace_back), which are not traversed.
+        insertReference(ctorDecl->getParent(), ctorDecl);
+    }
+
     return true;
 }
 
@@ -466,6 +508,8 @@ bool DependenciesCollector::VisitTypeAliasTemplateDecl(TypeAliasTemplateDecl* al
 
 bool DependenciesCollector::VisitClassTemplateDecl(ClassTemplateDecl* templateDecl) {
     insertReference(templateDecl, templateDecl->getTemplatedDecl());
+    if (approximate)
+        insertReferencesToExplicitSpecializations(templateDecl);
     return true;
 }
 
@@ -569,6 +613,8 @@ bool DependenciesCollector::VisitFunctionDecl(FunctionDecl* f) {
 bool DependenciesCollector::VisitFunctionTemplateDecl(FunctionTemplateDecl* functionTemplate) {
     insertReference(functionTemplate,
             functionTemplate->getInstantiatedFromMemberTemplate());
+    if (approximate)
+        insertReferencesToExplicitSpecializations(functionTemplate);
     return true;
 }
 
@@ -603,6 +649,163 @@ bool DependenciesCollector::VisitEnumDecl(EnumDecl* enumDecl) {
     return true;
 }
 
+// Approximate mode.
+//
+// Instead of the bodies of template instantiations, only the template patterns are traversed.
+// A reference to an instantiation (e.g. a call of f<int>) becomes a reference to the pattern
+// it was instantiated from. Code in a pattern that depends on template parameters can't be
+// resolved without instantiation, so a dependent name (a call found by argument-dependent
+// lookup, a member of a dependent type, an operator with dependent operands) is treated as
+// a reference to every declaration with that name in the main file. Explicit and partial
+// specializations are kept together with their template, as an instantiation might select
+// them.
+//
+// This over-approximates dependencies in most cases. It may still miss some (e.g. a constructor
+// called implicitly by an instantiation), so the result must be verified by compilation.
+
+void DependenciesCollector::insertReferencesToPatterns(Decl* decl) {
+    if (!declsWithPatternReferences.insert(decl).second)
+        return;
+
+    if (auto* f = dyn_cast<FunctionDecl>(decl)) {
+        if (FunctionTemplateDecl* ftemplate = f->getPrimaryTemplate())
+            insertReference(f, ftemplate->getTemplatedDecl());
+        insertReference(f, f->getInstantiatedFromMemberFunction());
+    } else if (auto* ftemplate = dyn_cast<FunctionTemplateDecl>(decl)) {
+        insertReference(ftemplate, ftemplate->getTemplatedDecl());
+    } else if (auto* specDecl = dyn_cast<ClassTemplateSpecializationDecl>(decl)) {
+        llvm::PointerUnion<ClassTemplateDecl*, ClassTemplatePartialSpecializationDecl*>
+            instantiatedFrom = specDecl->getSpecializedTemplateOrPartial();
+        if (auto* tempDecl = instantiatedFrom.dyn_cast<ClassTemplateDecl*>())
+            insertReference(specDecl, tempDecl);
+        else
+            insertReference(specDecl, instantiatedFrom.dyn_cast<ClassTemplatePartialSpecializationDecl*>());
+    } else if (auto* recordDecl = dyn_cast<CXXRecordDecl>(decl)) {
+        insertReference(recordDecl, recordDecl->getInstantiatedFromMemberClass());
+    } else if (auto* specDecl = dyn_cast<VarTemplateSpecializationDecl>(decl)) {
+        llvm::PointerUnion<VarTemplateDecl*, VarTemplatePartialSpecializationDecl*>
+            instantiatedFrom = specDecl->getSpecializedTemplateOrPartial();
+        if (auto* tempDecl = instantiatedFrom.dyn_cast<VarTemplateDecl*>())
+            insertReference(specDecl, tempDecl);
+        else
+            insertReference(specDecl, instantiatedFrom.dyn_cast<VarTemplatePartialSpecializationDecl*>());
+    } else if (auto* varDecl = dyn_cast<VarDecl>(decl)) {
+        insertReference(varDecl, varDecl->getInstantiatedFromStaticDataMember());
+    }
+
+    // Other members of class template instantiations.
+    if (sourceManager.isInMainFile(getBeginLoc(decl)))
+        insertReference(decl, getCorrespondingDeclInNonInstantiatedContext(decl));
+}
+
+void DependenciesCollector::insertReferencesToExplicitSpecializations(Decl* templateDecl) {
+    if (auto* classTemplate = dyn_cast<ClassTemplateDecl>(templateDecl)) {
+        for (ClassTemplateSpecializationDecl* specDecl : classTemplate->specializations()) {
+            if (specDecl->isExplicitSpecialization())
+                insertReference(classTemplate, specDecl);
+        }
+        llvm::SmallVector<ClassTemplatePartialSpecializationDecl*, 4> partials;
+        classTemplate->getPartialSpecializations(partials);
+        for (ClassTemplatePartialSpecializationDecl* partial : partials)
+            insertReference(classTemplate, partial);
+    } else if (auto* varTemplate = dyn_cast<VarTemplateDecl>(templateDecl)) {
+        for (VarTemplateSpecializationDecl* specDecl : varTemplate->specializations()) {
+            if (specDecl->isExplicitSpecialization())
+                insertReference(varTemplate, specDecl);
+        }
+        llvm::SmallVector<VarTemplatePartialSpecializationDecl*, 4> partials;
+        varTemplate->getPartialSpecializations(partials);
+        for (VarTemplatePartialSpecializationDecl* partial : partials)
+            insertReference(varTemplate, partial);
+    } else if (auto* functionTemplate = dyn_cast<FunctionTemplateDecl>(templateDecl)) {
+        for (FunctionDecl* specDecl : functionTemplate->specializations()) {
+            if (specDecl->getTemplateSpecializationKind() == TSK_ExplicitSpecialization)
+                insertReference(functionTemplate, specDecl);
+        }
+    }
+}
+
+void DependenciesCollector::insertReferenceByName(DeclarationName name) {
+    if (Decl* currentDecl = getCurrentDecl())
+        referencesByName.emplace_back(currentDecl, name.getAsOpaquePtr());
+}
+
+void DependenciesCollector::addReferencesByName() {
+    for (const auto& ref : referencesByName) {
+        auto it = mainFileDeclsByName.find(ref.second);
+        if (it == mainFileDeclsByName.end())
+            continue;
+        for (Decl* decl : it->second)
+            insertReference(ref.first, decl);
+    }
+    referencesByName.clear();
+}
+
+bool DependenciesCollector::VisitVarTemplateDecl(VarTemplateDecl* templateDecl) {
+    if (approximate)
+        insertReferencesToExplicitSpecializations(templateDecl);
+    return true;
+}
+
+bool DependenciesCollector::VisitUnresolvedLookupExpr(UnresolvedLookupExpr* lookupExpr) {
+    if (!approximate)
+        return true;
+    // Candidates found at the point of definition...
+    Decl* currentDecl = getCurrentDecl();
+    for (NamedDecl* decl : lookupExpr->decls())
+        insertReference(currentDecl, decl);
+    // ...and at the point of instantiation.
+    if (lookupExpr->requiresADL())
+        insertReferenceByName(lookupExpr->getName());
+    return true;
+}
+
+bool DependenciesCollector::VisitUnresolvedMemberExpr(UnresolvedMemberExpr* memberExpr) {
+    if (!approximate)
+        return true;
+    Decl* currentDecl = getCurrentDecl();
+    for (NamedDecl* decl : memberExpr->decls())
+        insertReference(currentDecl, decl);
+    insertReferenceByName(memberExpr->getMemberName());
+    return true;
+}
+
+bool DependenciesCollector::VisitCXXDependentScopeMemberExpr(CXXDependentScopeMemberExpr* memberExpr) {
+    if (approximate)
+        insertReferenceByName(memberExpr->getMember());
+    return true;
+}
+
+bool DependenciesCollector::VisitDependentScopeDeclRefExpr(DependentScopeDeclRefExpr* ref) {
+    if (approximate)
+        insertReferenceByName(ref->getDeclName());
+    return true;
+}
+
+bool DependenciesCollector::VisitDependentNameType(DependentNameType* type) {
+    if (approximate && type->getIdentifier())
+        insertReferenceByName(DeclarationName(type->getIdentifier()));
+    return true;
+}
+
+bool DependenciesCollector::VisitBinaryOperator(BinaryOperator* op) {
+    if (!approximate || !op->isTypeDependent())
+        return true;
+    OverloadedOperatorKind kind = BinaryOperator::getOverloadedOperator(op->getOpcode());
+    if (kind != OO_None)
+        insertReferenceByName(sema.getASTContext().DeclarationNames.getCXXOperatorName(kind));
+    return true;
+}
+
+bool DependenciesCollector::VisitUnaryOperator(UnaryOperator* op) {
+    if (!approximate || !op->isTypeDependent())
+        return true;
+    OverloadedOperatorKind kind = UnaryOperator::getOverloadedOperator(op->getOpcode());
+    if (kind != OO_None)
+        insertReferenceByName(sema.getASTContext().DeclarationNames.getCXXOperatorName(kind));
+    return true;
+}
+
 bool DependenciesCollector::VisitStmt(clang::Stmt* stmt) {
     (void)stmt;
     dbg(stmt->getStmtClassName() << std::endl);
@@ -11,12 +11,16 @@
 
 #include <clang/AST/RecursiveASTVisitor.h>
 #include <clang/Basic/SourceLocation.h>
+#include <llvm/ADT/DenseSet.h>
 
 #include <iosfwd>
 #include <set>
 #include <stack>
 #include <map>
+#include <unordered_map>
 #include <unordered_set>
+#include <utility>
+#include <vector>
 
 
 namespace clang {
@@ -38,13 +42,16 @@ public:
     DependenciesCollector(clang::SourceManager& srcMgr,
         clang::Sema& sema,
         const std::unordered_set<std::string>& identifiersToKeep,
-        SourceInfo& srcInfo_);
+        SourceInfo& srcInfo_,
+        bool approximate = false);
 
     bool shouldVisitImplicitCode() const;
     bool shouldVisitTemplateInstantiations() const;
     bool shouldWalkTypesOfTypeLocs() const;
 
     bool TraverseDecl(clang::Decl*);
+    bool TraverseType(clang::QualType);
+    bool TraverseTypeLoc(clang::TypeLoc);
     bool TraverseTemplateSpecializationType(clang::TemplateSpecializationType*);
     bool TraverseTemplateSpecializationTypeLoc(clang::TemplateSpecializationTypeLoc);
 
@@ -85,13 +92,31 @@ public:
     bool VisitCXXRecordDecl(clang::CXXRecordDecl* recordDecl);
     bool VisitUsingShadowDecl(clang::UsingShadowDecl* usingDecl);
     bool VisitEnumDecl(clang::EnumDecl* enumDecl);
+
+    // Only used in approximate mode.
+    bool VisitVarTemplateDecl(clang::VarTemplateDecl* templateDecl);
+    bool VisitUnresolvedLookupExpr(clang::UnresolvedLookupExpr* lookupExpr);
+    bool VisitUnresolvedMemberExpr(clang::UnresolvedMemberExpr* memberExpr);
+    bool VisitCXXDependentScopeMemberExpr(clang::CXXDependentScopeMemberExpr* memberExpr);
+    bool VisitDependentScopeDeclRefExpr(clang::DependentScopeDeclRefExpr* ref);
+    bool VisitDependentNameType(clang::DependentNameType* type);
+    bool VisitBinaryOperator(clang::BinaryOperator* op);
+    bool VisitUnaryOperator(clang::UnaryOperator* op);
 #if CAIDE_CLANG_VERSION_AT_LEAST(10,0)
     bool TraverseConceptSpecializationExpr(clang::ConceptSpecializationExpr* conceptExpr);
     bool VisitConceptSpecializationExpr(clang::ConceptSpecializationExpr* conceptExpr);
 #endif
 
+    // In approximate mode, adds references from dependent names in templates to all
+    // declarations in the main file with the same name. Must be called after traversal.
+    void addReferencesByName();
+
     void printGraph(std::ostream& out) const;
 
+    // Number of type traversals skipped because the type had already been traversed
+    // in the same declaration.
+    std::size_t getNumSkippedTypes() const { return numSkippedTypes; }
+
 private:
     clang::Decl* getCurrentDecl() const;
     clang::FunctionDecl* getCurrentFunction(clang::Decl* decl) const;
@@ -99,12 +124,22 @@ private:
 
     clang::Decl* getCorrespondingDeclInNonInstantiatedContext(clang::Decl* semanticDecl) const;
 
+    // Return false if the type (the TypeLoc) has already been traversed in the current
+    // declaration.
+    using TraversedTypes = llvm::DenseSet<std::pair<clang::Decl*, void*>>;
+    using TraversedTypeLocs = llvm::DenseSet<std::pair<clang::Decl*, std::pair<void*, void*>>>;
+    bool markTypeTraversed(clang::QualType type);
+    bool markTypeLocTraversed(clang::TypeLoc typeLoc);
+
     void traverseTemplateSpecializationTypeImpl(
             const clang::TemplateSpecializationType*,
             bool traverseTypeLocs);
     void traverseSugaredSignature(const SugaredSignature&, bool traverseTypeLocs = true);
 
     void insertReference(clang::Decl* from, clang::Decl* to);
+    void insertReferencesToPatterns(clang::Decl* decl);
+    void insertReferencesToExplicitSpecializations(clang::Decl* templateDecl);
+    void insertReferenceByName(clang::DeclarationName name);
 
 
     clang::SourceManager& sourceManager;
@@ -112,6 +147,28 @@ private:
     const std::unordered_set<std::string>& identifiersToKeep;
     SourceInfo& srcInfo;
 
+    // In approximate mode, template instantiations are not traversed. A reference to an
+    // instantiation is replaced with a reference to the template it was instantiated from,
+    // and names that depend on template parameters are matched against all declarations
+    // with that name.
+    const bool approximate;
+    std::unordered_set<clang::Decl*> declsWithPatternReferences;
+    std::unordered_map<void*, std::vector<clang::Decl*>> mainFileDeclsByName;
+    std::vector<std::pair<clang::Decl*, void*>> referencesByName;
+
+    // References found in a Type depend only on the type (including sugar) and on the
+    // declaration the reference comes from. A type is therefore traversed once per
+    // declaration, even if it is written many times. The key is (current declaration,
+    // opaque pointer of the QualType).
+    //
+    // A TypeLoc also contains declarations (parameters of function types) and expressions
+    // that the Type doesn't keep: char[sizeof(A)] and char[sizeof(B)] may be the same type.
+    // TypeLocs are therefore memoized by their location data too, so that only the same
+    // written type (e.g. a signature traversed again) is skipped.
+    TraversedTypes traversedTypes;
+    TraversedTypeLocs traversedTypeLocs;
+    std::size_t numSkippedTypes = 0;
+
     // There is no getParentDecl(stmt) function, so we maintain the stack of Decls,
     // with inner-most active Decl at the top of the stack.
     // \sa TraverseDecl().
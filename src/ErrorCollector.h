@@ -0,0 +1,73 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#pragma once
+
+#include "SourceMap.h"
+
+#include <clang/Basic/Diagnostic.h>
+#include <clang/Basic/SourceLocation.h>
+#include <clang/Basic/SourceManager.h>
+#include <llvm/ADT/SmallVector.h>
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace caide { namespace internal {
+
+// Like clang::TextDiagnosticBuffer, but resolves source locations eagerly and
+// adds them to error messages.
+class ErrorCollector: public clang::DiagnosticConsumer {
+public:
+    // Locations in the main file will be reported in the original files
+    // the main file was generated from.
+    void setSourceMap(const SourceMap* sourceMap) {
+        originalLocations.reset(sourceMap ? new OriginalLocations(*sourceMap) : nullptr);
+    }
+
+    void HandleDiagnostic(clang::DiagnosticsEngine::Level DiagLevel, const clang::Diagnostic& Info) override {
+        // Default implementation (Warnings/errors count).
+        DiagnosticConsumer::HandleDiagnostic(DiagLevel, Info);
+        if (DiagLevel >= clang::DiagnosticsEngine::Level::Error) {
+            std::string message;
+            if (Info.hasSourceManager()) {
+                message = describeLocation(Info.getLocation(), Info.getSourceManager());
+                message += ": ";
+            }
+            llvm::SmallVector<char, 256> buffer;
+            Info.FormatDiagnostic(buffer);
+            message += std::string(buffer.data(), buffer.size());
+            errors.push_back(std::move(message));
+        }
+    }
+
+    void clear() override {
+        DiagnosticConsumer::clear();
+        errors.clear();
+    }
+
+    const std::vector<std::string>& getErrors() const { return errors; }
+
+private:
+    std::string describeLocation(clang::SourceLocation loc, const clang::SourceManager& sourceManager) {
+        if (originalLocations && loc.isValid()) {
+            clang::SourceLocation fileLoc = sourceManager.getFileLoc(loc);
+            if (sourceManager.getFileID(fileLoc) == sourceManager.getMainFileID()) {
+                std::string location = originalLocations->describe(sourceManager.getFileOffset(fileLoc));
+                if (!location.empty())
+                    return location;
+            }
+        }
+        return loc.printToString(sourceManager);
+    }
+
+    std::unique_ptr<OriginalLocations> originalLocations;
+    std::vector<std::string> errors;
+};
+
+}}
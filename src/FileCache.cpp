@@ -0,0 +1,239 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#include "FileCache.h"
+#include "clang_version.h"
+#include "ConcatenatedFile.h"
+#include "HeaderBundle.h"
+#include "SharedMemoryBuffer.h"
+#include "Timer.h"
+
+#include <clang/Basic/FileManager.h>
+#include <clang/Basic/FileSystemOptions.h>
+
+#if CAIDE_CLANG_VERSION_AT_LEAST(10, 0)
+#  include <llvm/ADT/SmallString.h>
+#  include <llvm/Support/FileSystem.h>
+#  include <llvm/Support/MemoryBuffer.h>
+#  include <llvm/Support/Path.h>
+#  include <llvm/Support/VirtualFileSystem.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include <utility>
+
+
+using std::string;
+
+namespace caide { namespace internal {
+
+namespace {
+// A cached file unused by this many consecutive requests is dropped.
+const std::uint64_t MAX_IDLE_REQUESTS = 64;
+
+// Coarsest timestamp granularity of common file systems (FAT). A file modified within this
+// time before it was read may be modified again without a change of its modification time.
+const std::chrono::seconds TIMESTAMP_GRANULARITY{2};
+}
+
+#if CAIDE_CLANG_VERSION_AT_LEAST(10, 0)
+
+struct FileCache::Entry {
+    llvm::vfs::Status status;
+    std::shared_ptr<const llvm::MemoryBuffer> buffer;
+    // Generation of the request that has validated the entry most recently
+    std::uint64_t validatedGeneration;
+    // The file was read within the timestamp granularity of its modification time, so the
+    // entry can't be revalidated by status ('racily clean', as git calls it): later requests
+    // read the file again.
+    bool racilyClean;
+};
+
+namespace {
+
+class CachedFile: public llvm::vfs::File {
+public:
+    CachedFile(std::shared_ptr<FileCache::Entry> entry_, const string& path)
+        : entry(std::move(entry_))
+        , fileStatus(llvm::vfs::Status::copyWithNewName(entry->status, path))
+    {}
+
+    llvm::ErrorOr<llvm::vfs::Status> status() override {
+        return fileStatus;
+    }
+
+    llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> getBuffer(const llvm::Twine& name,
+        int64_t /*fileSize*/, bool /*requiresNullTerminator*/, bool /*isVolatile*/) override
+    {
+        // Keeps the entry alive if it is replaced by a newer version of the file.
+        return std::unique_ptr<llvm::MemoryBuffer>(
+            new SharedMemoryBuffer(entry->buffer, entry->buffer->getBuffer(), name.str()));
+    }
+
+    std::error_code close() override {
+        return std::error_code();
+    }
+
+private:
+    std::shared_ptr<FileCache::Entry> entry;
+    llvm::vfs::Status fileStatus;
+};
+
+// Absolute path without '.' and '..' components, so that a file is cached once however it
+// is spelled (e.g. through a relative include directory).
+string normalizePath(const string& path) {
+    llvm::SmallString<256> absolutePath(path);
+    if (llvm::sys::fs::make_absolute(absolutePath))
+        return path;
+    llvm::sys::path::remove_dots(absolutePath, /*remove_dot_dot=*/true);
+    return string(absolutePath.begin(), absolutePath.end());
+}
+
+bool isSameFile(const llvm::vfs::Status& a, const llvm::vfs::Status& b) {
+    return a.getUniqueID() == b.getUniqueID() && a.getSize() == b.getSize() &&
+        a.getLastModificationTime() == b.getLastModificationTime();
+}
+
+}
+
+class CachingFileSystem: public llvm::vfs::ProxyFileSystem {
+public:
+    CachingFileSystem(std::shared_ptr<FileCache> cache_, string uncachedDirectory_)
+        : ProxyFileSystem(llvm::vfs::getRealFileSystem())
+        , cache(std::move(cache_))
+        , uncachedDirectory(std::move(uncachedDirectory_))
+    {
+        std::lock_guard<std::mutex> lock(cache->mutex);
+        generation = cache->generation;
+    }
+
+    llvm::ErrorOr<std::unique_ptr<llvm::vfs::File>> openFileForRead(const llvm::Twine& pathTwine) override {
+        const string path = pathTwine.str();
+        const string key = normalizePath(path);
+        if (!isCacheable(key))
+            return ProxyFileSystem::openFileForRead(path);
+
+        std::shared_ptr<FileCache::Entry> entry;
+        {
+            std::lock_guard<std::mutex> lock(cache->mutex);
+            auto it = cache->entries.find(key);
+            if (it != cache->entries.end()) {
+                entry = it->second;
+                if (entry->validatedGeneration >= generation) {
+                    StatisticsCollector::count("fileCache.hits", 1);
+                    return std::unique_ptr<llvm::vfs::File>(new CachedFile(entry, path));
+                }
+            }
+        }
+
+        const auto readTime = std::chrono::system_clock::now();
+        auto file = ProxyFileSystem::openFileForRead(path);
+        if (!file)
+            return file;
+        auto status = (*file)->status();
+        if (!status)
+            return file;
+
+        if (entry && !entry->racilyClean && isSameFile(entry->status, *status)) {
+            std::lock_guard<std::mutex> lock(cache->mutex);
+            entry->validatedGeneration = std::max(entry->validatedGeneration, generation);
+            StatisticsCollector::count("fileCache.hits", 1);
+            return std::unique_ptr<llvm::vfs::File>(new CachedFile(entry, path));
+        }
+
+        // Volatile: read the contents instead of mapping the file, so that the cached copy
+        // doesn't change if the file is modified in place.
+        auto buffer = (*file)->getBuffer(path, status->getSize(),
+            /*RequiresNullTerminator=*/true, /*IsVolatile=*/true);
+        if (!buffer)
+            return ProxyFileSystem::openFileForRead(path);
+
+        entry = std::make_shared<FileCache::Entry>();
+        entry->status = *status;
+        entry->buffer = std::move(*buffer);
+        entry->validatedGeneration = generation;
+        entry->racilyClean = readTime - status->getLastModificationTime() < TIMESTAMP_GRANULARITY;
+        {
+            std::lock_guard<std::mutex> lock(cache->mutex);
+            cache->entries[key] = entry;
+        }
+        StatisticsCollector::count("fileCache.misses", 1);
+        return std::unique_ptr<llvm::vfs::File>(new CachedFile(entry, path));
+    }
+
+private:
+    // normalizedPath is the result of normalizePath().
+    bool isCacheable(const string& normalizedPath) const {
+        if (!llvm::sys::path::is_absolute(normalizedPath))
+            return false;
+        return uncachedDirectory.empty() ||
+            normalizedPath.compare(0, uncachedDirectory.size(), uncachedDirectory) != 0;
+    }
+
+    std::shared_ptr<FileCache> cache;
+    string uncachedDirectory;
+    std::uint64_t generation;
+};
+
+#else
+
+struct FileCache::Entry {
+    std::uint64_t validatedGeneration;
+};
+
+#endif
+
+std::shared_ptr<FileCache> FileCache::getProcessCache() {
+    static std::shared_ptr<FileCache> cache = std::make_shared<FileCache>();
+    return cache;
+}
+
+void FileCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.clear();
+}
+
+void FileCache::beginRequest() {
+    std::lock_guard<std::mutex> lock(mutex);
+    ++generation;
+    for (auto it = entries.begin(); it != entries.end();) {
+        if (it->second->validatedGeneration + MAX_IDLE_REQUESTS < generation)
+            it = entries.erase(it);
+        else
+            ++it;
+    }
+}
+
+llvm::IntrusiveRefCntPtr<clang::FileManager> FileCache::createFileManager(
+        const string& uncachedDirectory, std::shared_ptr<const HeaderBundle> headerBundle,
+        std::shared_ptr<const ConcatenatedFile> concatenatedFile)
+{
+#if CAIDE_CLANG_VERSION_AT_LEAST(10, 0)
+    string directory = uncachedDirectory;
+    if (!directory.empty()) {
+        directory = normalizePath(directory);
+        directory.push_back(llvm::sys::path::get_separator().front());
+    }
+    llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> fileSystem(
+        new CachingFileSystem(shared_from_this(), std::move(directory)));
+    if (headerBundle)
+        fileSystem = createHeaderBundleFileSystem(std::move(headerBundle), fileSystem);
+    if (concatenatedFile)
+        fileSystem = createConcatenatedFileSystem(std::move(concatenatedFile), fileSystem);
+    return llvm::IntrusiveRefCntPtr<clang::FileManager>(
+        new clang::FileManager(clang::FileSystemOptions(), fileSystem));
+#else
+    (void)uncachedDirectory;
+    (void)concatenatedFile;
+    if (headerBundle)
+        throw std::runtime_error("Header bundles require clang 10 or later");
+    return nullptr;
+#endif
+}
+
+}}
@@ -0,0 +1,66 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#pragma once
+
+#include <llvm/ADT/IntrusiveRefCntPtr.h>
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace clang {
+    class FileManager;
+}
+
+namespace caide { namespace internal {
+
+class ConcatenatedFile;
+class HeaderBundle;
+
+// Contents of files read by clang, shared by all requests in the process.
+//
+// Each request creates its own FileManager on top of the cache and uses it for both
+// stages, so that a system header is stat'ed and read at most once per request, and,
+// as long as it doesn't change, only stat'ed by later requests. A cached file is
+// revalidated (by size, modification time and unique ID) on its first use in a request,
+// unless it was read too soon after its modification for the check to be reliable.
+class FileCache: public std::enable_shared_from_this<FileCache> {
+public:
+    // The cache used by all instances of CppInliner.
+    static std::shared_ptr<FileCache> getProcessCache();
+
+    // Marks the beginning of a new request: files will be revalidated on their next use.
+    // Files that haven't been used for a while are dropped.
+    void beginRequest();
+
+    // Drops all cached files.
+    void clear();
+
+    // Returns a FileManager that reads files through the cache, except files under
+    // uncachedDirectory (intermediate files of the inliner, rewritten by every request).
+    // If headerBundle is not null, files contained in it are read from the bundle.
+    // If concatenatedFile is not null, it is served under its path without being written.
+    // Returns nullptr if clang tools can't use an external FileManager in this version of
+    // clang; each tool then creates its own.
+    llvm::IntrusiveRefCntPtr<clang::FileManager> createFileManager(
+        const std::string& uncachedDirectory,
+        std::shared_ptr<const HeaderBundle> headerBundle = nullptr,
+        std::shared_ptr<const ConcatenatedFile> concatenatedFile = nullptr);
+
+    struct Entry;
+
+private:
+    friend class CachingFileSystem;
+
+    std::mutex mutex;
+    std::map<std::string, std::shared_ptr<Entry>> entries;
+    std::uint64_t generation = 0;
+};
+
+}}
@@ -0,0 +1,457 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#include "HeaderBundle.h"
+#include "clang_version.h"
+#include "SharedMemoryBuffer.h"
+#include "util.h"
+
+#include <clang/Basic/SourceManager.h>
+#include <clang/Frontend/CompilerInstance.h>
+#include <clang/Frontend/FrontendActions.h>
+#include <clang/Lex/HeaderSearchOptions.h>
+#include <clang/Lex/PPCallbacks.h>
+#include <clang/Lex/Preprocessor.h>
+#include <clang/Tooling/CompilationDatabase.h>
+#include <clang/Tooling/Tooling.h>
+
+#include <llvm/Support/Endian.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#if CAIDE_CLANG_VERSION_AT_LEAST(10, 0)
+#  include <llvm/Support/VirtualFileSystem.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <utility>
+
+
+using std::string;
+using std::vector;
+
+namespace caide { namespace internal {
+
+namespace {
+
+const char MAGIC[] = "CAIDEHB1";
+const std::size_t MAGIC_SIZE = 8;
+const std::size_t HEADER_SIZE = MAGIC_SIZE + 2 * 8;
+const std::size_t ENTRY_SIZE = 7 * 8;
+
+void append64(string& out, std::uint64_t value) {
+    char bytes[8];
+    llvm::support::endian::write64le(bytes, value);
+    out.append(bytes, 8);
+}
+
+}
+
+std::uint64_t HeaderBundle::read(std::size_t offset) const {
+    return llvm::support::endian::read64le(buffer->getBufferStart() + offset);
+}
+
+std::shared_ptr<const HeaderBundle> HeaderBundle::load(const string& bundlePath) {
+    auto bufferOrError = llvm::MemoryBuffer::getFile(bundlePath);
+    if (!bufferOrError)
+        throw std::runtime_error("Couldn't read header bundle " + bundlePath + ": " +
+            bufferOrError.getError().message());
+
+    std::shared_ptr<HeaderBundle> bundle(new HeaderBundle());
+    bundle->buffer = std::move(*bufferOrError);
+    const std::uint64_t size = bundle->buffer->getBufferSize();
+
+    auto invalid = [&bundlePath]() {
+        return std::runtime_error("Invalid header bundle " + bundlePath);
+    };
+
+    if (size < HEADER_SIZE || std::memcmp(bundle->buffer->getBufferStart(), MAGIC, MAGIC_SIZE) != 0)
+        throw invalid();
+
+    const std::uint64_t numFiles = bundle->read(MAGIC_SIZE);
+    const std::uint64_t descriptionLength = bundle->read(MAGIC_SIZE + 8);
+    if (numFiles > (size - HEADER_SIZE) / ENTRY_SIZE ||
+            descriptionLength > size - HEADER_SIZE - numFiles * ENTRY_SIZE)
+        throw invalid();
+    bundle->numFiles = static_cast<std::size_t>(numFiles);
+
+    // Validate the index once, so that lookups don't need bounds checks.
+    const char* data = bundle->buffer->getBufferStart();
+    for (std::size_t i = 0; i < bundle->numFiles; ++i) {
+        const std::size_t entry = HEADER_SIZE + i * ENTRY_SIZE;
+        const std::uint64_t pathOffset = bundle->read(entry);
+        const std::uint64_t pathLength = bundle->read(entry + 8);
+        const std::uint64_t contentsOffset = bundle->read(entry + 16);
+        const std::uint64_t contentsSize = bundle->read(entry + 24);
+        if (pathOffset > size || pathLength > size - pathOffset ||
+                contentsOffset > size || contentsSize >= size - contentsOffset ||
+                data[contentsOffset + contentsSize] != '\0')
+            throw invalid();
+        if (i > 0 && !(bundle->getFile(i - 1).path < bundle->getFile(i).path))
+            throw invalid();
+    }
+
+    return bundle;
+}
+
+llvm::StringRef HeaderBundle::getDescription() const {
+    const std::size_t offset = HEADER_SIZE + numFiles * ENTRY_SIZE;
+    return llvm::StringRef(buffer->getBufferStart() + offset, read(MAGIC_SIZE + 8));
+}
+
+HeaderBundle::File HeaderBundle::getFile(std::size_t index) const {
+    const std::size_t entry = HEADER_SIZE + index * ENTRY_SIZE;
+    const char* data = buffer->getBufferStart();
+    File file;
+    file.index = index;
+    file.path = llvm::StringRef(data + read(entry), read(entry + 8));
+    file.contents = llvm::StringRef(data + read(entry + 16), read(entry + 24));
+    file.device = read(entry + 32);
+    file.inode = read(entry + 40);
+    file.modificationTime = read(entry + 48);
+    return file;
+}
+
+bool HeaderBundle::find(llvm::StringRef path, File& file) const {
+    std::size_t lo = 0, hi = numFiles;
+    while (lo < hi) {
+        const std::size_t mid = lo + (hi - lo) / 2;
+        const std::size_t entry = HEADER_SIZE + mid * ENTRY_SIZE;
+        llvm::StringRef midPath(buffer->getBufferStart() + read(entry), read(entry + 8));
+        if (midPath < path)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == numFiles)
+        return false;
+    file = getFile(lo);
+    return file.path == path;
+}
+
+void writeHeaderBundle(const vector<string>& filePaths, const string& description,
+                       const string& bundlePath)
+{
+    vector<string> paths(filePaths);
+    std::sort(paths.begin(), paths.end());
+    paths.erase(std::unique(paths.begin(), paths.end()), paths.end());
+
+    struct Input {
+        string contents;
+        llvm::sys::fs::UniqueID id;
+        std::uint64_t modificationTime;
+    };
+    vector<Input> inputs(paths.size());
+    for (std::size_t i = 0; i < paths.size(); ++i) {
+        llvm::sys::fs::file_status status;
+        if (llvm::sys::fs::status(paths[i], status))
+            throw std::runtime_error("Couldn't stat " + paths[i]);
+        std::ifstream in(paths[i].c_str(), std::ios::binary);
+        if (!in)
+            throw std::runtime_error("Couldn't read " + paths[i]);
+        inputs[i].contents.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        inputs[i].id = status.getUniqueID();
+        inputs[i].modificationTime = static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                status.getLastModificationTime().time_since_epoch()).count());
+    }
+
+    string header(MAGIC, MAGIC_SIZE);
+    append64(header, paths.size());
+    append64(header, description.size());
+
+    std::uint64_t offset = HEADER_SIZE + paths.size() * ENTRY_SIZE + description.size();
+    string index;
+    for (const string& path : paths) {
+        append64(index, offset);
+        append64(index, path.size());
+        offset += path.size();
+        // Contents offsets are filled in below
+        append64(index, 0);
+        append64(index, 0);
+        append64(index, 0);
+        append64(index, 0);
+        append64(index, 0);
+    }
+    for (std::size_t i = 0; i < paths.size(); ++i) {
+        char* entry = &index[i * ENTRY_SIZE];
+        llvm::support::endian::write64le(entry + 16, offset);
+        llvm::support::endian::write64le(entry + 24, inputs[i].contents.size());
+        llvm::support::endian::write64le(entry + 32, inputs[i].id.getDevice());
+        llvm::support::endian::write64le(entry + 40, inputs[i].id.getFile());
+        llvm::support::endian::write64le(entry + 48, inputs[i].modificationTime);
+        offset += inputs[i].contents.size() + 1;
+    }
+
+    // Write to a temporary file first, so that concurrent readers never see a partial bundle.
+    const string temporaryPath = bundlePath + ".tmp";
+    {
+        std::ofstream out(temporaryPath.c_str(), std::ios::binary);
+        out << header << index << description;
+        for (const string& path : paths)
+            out << path;
+        for (const Input& input : inputs) {
+            out << input.contents;
+            out.put('\0');
+        }
+        if (!out)
+            throw std::runtime_error("Couldn't write " + temporaryPath);
+    }
+    if (llvm::sys::fs::rename(temporaryPath, bundlePath))
+        throw std::runtime_error("Couldn't write " + bundlePath);
+}
+
+string getDefaultHeaderBundleProbe() {
+    static const char* const headers[] = {
+        "algorithm", "any", "array", "atomic", "bit", "bitset", "cassert", "cctype", "cerrno",
+        "cfloat", "charconv", "chrono", "cinttypes", "climits", "clocale", "cmath", "compare",
+        "complex", "concepts", "condition_variable", "csetjmp", "csignal", "cstdarg", "cstddef",
+        "cstdint", "cstdio", "cstdlib", "cstring", "ctime", "cwchar", "cwctype", "deque",
+        "exception", "forward_list", "fstream", "functional", "future", "initializer_list",
+        "iomanip", "ios", "iosfwd", "iostream", "istream", "iterator", "limits", "list",
+        "locale", "map", "memory", "mutex", "new", "numbers", "numeric", "optional", "ostream",
+        "queue", "random", "ranges", "ratio", "regex", "set", "span", "sstream", "stack",
+        "stdexcept", "streambuf", "string", "string_view", "system_error", "thread", "tuple",
+        "type_traits", "typeindex", "typeinfo", "unordered_map", "unordered_set", "utility",
+        "valarray", "variant", "vector", "bits/stdc++.h", "ext/pb_ds/assoc_container.hpp",
+        "ext/pb_ds/tree_policy.hpp",
+    };
+    string probe;
+    for (const char* header : headers) {
+        probe += "#if __has_include(<";
+        probe += header;
+        probe += ">)\n#include <";
+        probe += header;
+        probe += ">\n#endif\n";
+    }
+    probe += "int main() { return 0; }\n";
+    return probe;
+}
+
+#if CAIDE_CLANG_VERSION_AT_LEAST(10, 0)
+
+namespace {
+
+struct ProbeResult {
+    std::set<string> systemHeaders;
+    vector<string> builtinIncludeDirectories;
+};
+
+class RecordSystemHeaders: public clang::PPCallbacks {
+public:
+    RecordSystemHeaders(const clang::SourceManager& sourceManager_, ProbeResult& result_)
+        : sourceManager(sourceManager_)
+        , result(result_)
+    {}
+
+    void FileChanged(clang::SourceLocation loc, FileChangeReason reason,
+                     clang::SrcMgr::CharacteristicKind fileType, clang::FileID /*prevFID*/) override
+    {
+        if (reason != EnterFile || fileType == clang::SrcMgr::C_User)
+            return;
+        llvm::StringRef fileName = sourceManager.getFilename(loc);
+        if (!fileName.empty() && fileName.front() != '<')
+            result.systemHeaders.insert(fileName.str());
+    }
+
+private:
+    const clang::SourceManager& sourceManager;
+    ProbeResult& result;
+};
+
+class ProbeFrontendAction: public clang::PreprocessOnlyAction {
+public:
+    explicit ProbeFrontendAction(ProbeResult& result_)
+        : result(result_)
+    {}
+
+    bool BeginSourceFileAction(clang::CompilerInstance& compiler) override {
+        const clang::HeaderSearchOptions& options = compiler.getHeaderSearchOpts();
+        if (options.UseBuiltinIncludes && !options.ResourceDir.empty()) {
+            llvm::SmallString<256> directory(options.ResourceDir);
+            llvm::sys::path::append(directory, "include");
+            result.builtinIncludeDirectories.push_back(directory.str().str());
+        }
+        compiler.getPreprocessor().addPPCallbacks(std::unique_ptr<RecordSystemHeaders>(
+            new RecordSystemHeaders(compiler.getSourceManager(), result)));
+        return true;
+    }
+
+private:
+    ProbeResult& result;
+};
+
+class ProbeFrontendActionFactory: public clang::tooling::FrontendActionFactory {
+public:
+    explicit ProbeFrontendActionFactory(ProbeResult& result_)
+        : result(result_)
+    {}
+
+    std::unique_ptr<clang::FrontendAction> create() override {
+        return std::make_unique<ProbeFrontendAction>(result);
+    }
+
+private:
+    ProbeResult& result;
+};
+
+vector<string> listFilesRecursively(const string& directory) {
+    vector<string> files;
+    std::error_code ec;
+    for (llvm::sys::fs::recursive_directory_iterator it(directory, ec), end;
+            it != end && !ec; it.increment(ec))
+    {
+        if (llvm::sys::fs::is_regular_file(it->path()))
+            files.push_back(it->path());
+    }
+    return files;
+}
+
+class HeaderBundleFile: public llvm::vfs::File {
+public:
+    HeaderBundleFile(std::shared_ptr<const HeaderBundle> bundle_, llvm::StringRef contents_,
+                     llvm::vfs::Status fileStatus_)
+        : bundle(std::move(bundle_))
+        , contents(contents_)
+        , fileStatus(std::move(fileStatus_))
+    {}
+
+    llvm::ErrorOr<llvm::vfs::Status> status() override {
+        return fileStatus;
+    }
+
+    llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> getBuffer(const llvm::Twine& name,
+        int64_t /*fileSize*/, bool /*requiresNullTerminator*/, bool /*isVolatile*/) override
+    {
+        return std::unique_ptr<llvm::MemoryBuffer>(
+            new SharedMemoryBuffer(bundle->getBuffer(), contents, name.str()));
+    }
+
+    std::error_code close() override {
+        return std::error_code();
+    }
+
+private:
+    std::shared_ptr<const HeaderBundle> bundle;
+    llvm::StringRef contents;
+    llvm::vfs::Status fileStatus;
+};
+
+// Bundled files get unique IDs of their own: device and inode numbers recorded on the build
+// machine may belong to an unrelated file here, and FileManager identifies files by unique ID.
+// A bundled file reached through a path that is not in the bundle is recognized by its
+// recorded identity, size and modification time, so that it is still the same file for
+// clang (e.g. for '#pragma once').
+class HeaderBundleFileSystem: public llvm::vfs::ProxyFileSystem {
+public:
+    HeaderBundleFileSystem(std::shared_ptr<const HeaderBundle> bundle_,
+                           llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> base)
+        : ProxyFileSystem(std::move(base))
+        , bundle(std::move(bundle_))
+    {
+        uniqueIDs.reserve(bundle->getNumFiles());
+        for (std::size_t i = 0; i < bundle->getNumFiles(); ++i) {
+            const HeaderBundle::File file = bundle->getFile(i);
+            uniqueIDs.push_back(llvm::vfs::getNextVirtualUniqueID());
+            recordedIDs.emplace(std::make_pair(file.device, file.inode), i);
+        }
+    }
+
+    llvm::ErrorOr<llvm::vfs::Status> status(const llvm::Twine& pathTwine) override {
+        const string path = pathTwine.str();
+        HeaderBundle::File file;
+        if (bundle->find(path, file))
+            return makeStatus(path, file);
+        auto status = ProxyFileSystem::status(path);
+        if (status && findBundledCopy(*status, file))
+            return makeStatus(path, file);
+        return status;
+    }
+
+    llvm::ErrorOr<std::unique_ptr<llvm::vfs::File>> openFileForRead(const llvm::Twine& pathTwine) override {
+        const string path = pathTwine.str();
+        HeaderBundle::File file;
+        bool found = bundle->find(path, file);
+        if (!found) {
+            auto realFile = ProxyFileSystem::openFileForRead(path);
+            if (!realFile)
+                return realFile;
+            auto status = (*realFile)->status();
+            if (!status || !findBundledCopy(*status, file))
+                return realFile;
+        }
+        return std::unique_ptr<llvm::vfs::File>(
+            new HeaderBundleFile(bundle, file.contents, makeStatus(path, file)));
+    }
+
+private:
+    llvm::vfs::Status makeStatus(const string& path, const HeaderBundle::File& file) const {
+        return llvm::vfs::Status(path, uniqueIDs[file.index],
+            llvm::sys::TimePoint<>(std::chrono::nanoseconds(file.modificationTime)),
+            /*User=*/0, /*Group=*/0, file.contents.size(),
+            llvm::sys::fs::file_type::regular_file, llvm::sys::fs::all_read);
+    }
+
+    bool findBundledCopy(const llvm::vfs::Status& status, HeaderBundle::File& file) const {
+        const llvm::sys::fs::UniqueID id = status.getUniqueID();
+        auto it = recordedIDs.find(std::make_pair(id.getDevice(), id.getFile()));
+        if (it == recordedIDs.end())
+            return false;
+        file = bundle->getFile(it->second);
+        const auto modificationTime = static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                status.getLastModificationTime().time_since_epoch()).count());
+        return status.getSize() == file.contents.size() && modificationTime == file.modificationTime;
+    }
+
+    std::shared_ptr<const HeaderBundle> bundle;
+    std::vector<llvm::sys::fs::UniqueID> uniqueIDs;
+    std::map<std::pair<std::uint64_t, std::uint64_t>, std::size_t> recordedIDs;
+};
+
+}
+
+vector<string> collectSystemHeaders(const vector<string>& clangOptions, const vector<string>& probeFiles) {
+    std::unique_ptr<clang::tooling::FixedCompilationDatabase> compilationDatabase(
+        createCompilationDatabaseFromCommandLine(clangOptions));
+
+    ProbeResult result;
+    ProbeFrontendActionFactory factory(result);
+    clang::tooling::ClangTool tool(*compilationDatabase, probeFiles);
+    // Errors are not fatal: headers included before the error are still useful.
+    tool.run(&factory);
+
+    vector<string> headers(result.systemHeaders.begin(), result.systemHeaders.end());
+    for (const string& directory : result.builtinIncludeDirectories) {
+        vector<string> builtinHeaders = listFilesRecursively(directory);
+        headers.insert(headers.end(), builtinHeaders.begin(), builtinHeaders.end());
+    }
+    return headers;
+}
+
+llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> createHeaderBundleFileSystem(
+        std::shared_ptr<const HeaderBundle> bundle,
+        llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> base)
+{
+    return llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem>(
+        new HeaderBundleFileSystem(std::move(bundle), std::move(base)));
+}
+
+#else
+
+vector<string> collectSystemHeaders(const vector<string>&, const vector<string>&) {
+    throw std::runtime_error("Header bundles require clang 10 or later");
+}
+
+#endif
+
+}}
@@ -0,0 +1,93 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#pragma once
+
+#include <llvm/ADT/IntrusiveRefCntPtr.h>
+#include <llvm/ADT/StringRef.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace llvm {
+    class MemoryBuffer;
+    namespace vfs {
+        class FileSystem;
+    }
+}
+
+namespace caide { namespace internal {
+
+// A single-file archive of system headers. Reading headers from a memory-mapped bundle
+// replaces thousands of small file opens, which dominate cold-start latency.
+//
+// Format (all integers are 64-bit little-endian, offsets are from the start of the file):
+//
+//   magic "CAIDEHB1"
+//   number of files N
+//   length of description D
+//   N index entries, sorted by path:
+//       path offset, path length, contents offset, contents size,
+//       device, inode, modification time (nanoseconds since epoch)
+//   description (D bytes)
+//   paths and contents; contents of each file are followed by a null character
+//
+// Paths are stored exactly as clang spells them, so a bundle must be used with the same
+// compilation options as it was built with.
+class HeaderBundle {
+public:
+    struct File {
+        std::size_t index;
+        llvm::StringRef path;
+        llvm::StringRef contents;
+        // Identity of the file on the machine the bundle was built on
+        std::uint64_t device;
+        std::uint64_t inode;
+        std::uint64_t modificationTime;
+    };
+
+    // Maps the bundle into memory. Throws std::runtime_error if the file is not a valid bundle.
+    static std::shared_ptr<const HeaderBundle> load(const std::string& bundlePath);
+
+    llvm::StringRef getDescription() const;
+    std::size_t getNumFiles() const { return numFiles; }
+    File getFile(std::size_t index) const;
+
+    // Returns false if the bundle doesn't contain the path.
+    bool find(llvm::StringRef path, File& file) const;
+
+    const std::shared_ptr<const llvm::MemoryBuffer>& getBuffer() const { return buffer; }
+
+private:
+    HeaderBundle() = default;
+    std::uint64_t read(std::size_t offset) const;
+
+    std::shared_ptr<const llvm::MemoryBuffer> buffer;
+    std::size_t numFiles = 0;
+};
+
+// Writes a bundle containing the given files. Throws std::runtime_error on error.
+void writeHeaderBundle(const std::vector<std::string>& filePaths, const std::string& description,
+                       const std::string& bundlePath);
+
+// Returns paths of the system headers that are included when the probe files are
+// preprocessed with the given options, and of all clang builtin headers (unless
+// builtin includes are disabled).
+std::vector<std::string> collectSystemHeaders(const std::vector<std::string>& clangOptions,
+                                              const std::vector<std::string>& probeFiles);
+
+// Source of a probe file including all standard headers that exist.
+std::string getDefaultHeaderBundleProbe();
+
+// A file system serving the files contained in the bundle, and falling back to base
+// for all other files.
+llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> createHeaderBundleFileSystem(
+        std::shared_ptr<const HeaderBundle> bundle,
+        llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> base);
+
+}}
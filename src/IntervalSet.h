@@ -6,7 +6,9 @@
 
 #pragma once
 
+#include <cstdint>
 #include <functional>
+#include <iterator>
 #include <map>
 
 namespace caide {
@@ -16,16 +18,47 @@ namespace internal {
 template<typename Key, typename Compare = std::less<Key>>
 class IntervalSet {
 private:
-    using IntervalMap = std::map<Key, Key, Compare>;
+    // Counts calls of the comparison function, which may be expensive (e.g. for source locations).
+    struct CountingCompare {
+        Compare compare;
+        mutable std::uint64_t calls = 0;
+
+        explicit CountingCompare(const Compare& compare_)
+            : compare(compare_)
+        {}
+
+        bool operator()(const Key& lhs, const Key& rhs) const {
+            ++calls;
+            return compare(lhs, rhs);
+        }
+    };
+
+    using IntervalMap = std::map<Key, Key, CountingCompare>;
 
 public:
     using const_iterator = typename IntervalMap::const_iterator;
 
+    struct Statistics {
+        std::uint64_t additions = 0;       // Calls of add()
+        std::uint64_t insertions = 0;      // ... that inserted a new interval
+        std::uint64_t extensions = 0;      // ... that extended an existing interval
+        std::uint64_t mergedIntervals = 0; // Intervals erased because a new interval covered them
+        std::uint64_t queries = 0;         // Calls of intersects()
+        std::uint64_t comparisons = 0;     // Calls of the comparison function
+    };
+
     explicit IntervalSet(const Compare& comp = Compare())
         : isLess(comp)
         , intervals(isLess)
     {}
 
+    Statistics getStatistics() const {
+        Statistics result = statistics;
+        // The map compares with its own copy of the comparison function.
+        result.comparisons = isLess.calls + intervals.key_comp().calls;
+        return result;
+    }
+
     const_iterator begin() const {
         return intervals.begin();
     }
@@ -37,6 +70,7 @@ public:
     /// Add an interval [left, right], both ends inclusive.
     /// Assumes left <= right.
     void add(const Key& left, const Key& right) {
+        ++statistics.additions;
         auto it = intervals.upper_bound(left);
         auto prev = it;
         bool leftIsCovered = true;
@@ -53,13 +87,16 @@ public:
             it = prev;
             if (isLess(it->second, right)) {
                 // Extend the interval.
+                ++statistics.extensions;
                 it->second = std::move(right);
             } else {
                 // right is covered too - no changes.
                 return;
             }
-        } else
+        } else {
+            ++statistics.insertions;
             it = intervals.emplace_hint(it, left, right);
+        }
 
         // At this point, all intervals to the left of it don't intersect each other or
         // intervals to the right of (and including) it. Some intervals following it may intersect
@@ -71,12 +108,14 @@ public:
             it->second = std::move(lastIntersecting->second);
 
         // Intervals in (it, jt) (both non-inclusive) are now completely inside of it. Erase them.
+        statistics.mergedIntervals += std::distance(std::next(it), jt);
         intervals.erase(std::next(it), jt);
     }
 
     /// Does any interval of the set intersect [left, right] (both ends inclusive)?
     /// Assumes left <= right.
     bool intersects(const Key& left, const Key& right) const {
+        ++statistics.queries;
         auto it = intervals.upper_bound(right);
         // If [left, right] doesn't intersect the set, it must be completely between prev(it) and it.
 
@@ -90,11 +129,13 @@ public:
     }
 
 private:
-    Compare isLess;
+    CountingCompare isLess;
 
     /// Stores pairwise non-intersecting intervals, in increasing order. Keys are left ends
     /// of the intervals, values are corresponding right ends.
     IntervalMap intervals;
+
+    mutable Statistics statistics;
 };
 
 }
@@ -29,9 +29,11 @@ namespace caide {
 namespace internal {
 
 
-OptimizerVisitor::OptimizerVisitor(SourceManager& srcManager, const std::unordered_set<Decl*>& usedDecls,
+OptimizerVisitor::OptimizerVisitor(SourceManager& srcManager, const LangOptions& langOptions,
+            const std::unordered_set<Decl*>& usedDecls,
             std::unordered_set<Decl*>& removedDecls, SmartRewriter& rewriter_)
     : sourceManager(srcManager)
+    , locationFinder(srcManager, langOptions)
     , usedDeclarations(usedDecls)
     , rewriter(rewriter_)
     , removed(removedDecls)
@@ -355,7 +357,7 @@ bool OptimizerVisitor::VisitFriendDecl(clang::FriendDecl* friendDecl) {
 // Variables are a special case because there may be many comma separated variables in one definition.
 // We remove them separately in Finalize() method.
 bool OptimizerVisitor::VisitVarDecl(VarDecl* varDecl) {
-    SourceLocation start = getExpansionStart(sourceManager, varDecl);
+    SourceLocation start = locationFinder.getExpansionStart(varDecl);
     if (!sourceManager.isInMainFile(start))
         return true;
 
@@ -394,7 +396,7 @@ bool OptimizerVisitor::VisitVarDecl(VarDecl* varDecl) {
 }
 
 bool OptimizerVisitor::VisitFieldDecl(clang::FieldDecl* fieldDecl) {
-    SourceLocation start = getExpansionStart(sourceManager, fieldDecl);
+    SourceLocation start = locationFinder.getExpansionStart(fieldDecl);
     if (!sourceManager.isInMainFile(start))
         return true;
 
@@ -410,8 +412,8 @@ void OptimizerVisitor::removeDecl(Decl* decl) {
         return;
     removed.insert(decl);
 
-    SourceLocation start = getExpansionStart(sourceManager, decl);
-    SourceLocation end = getExpansionEnd(sourceManager, decl);
+    SourceLocation start = locationFinder.getExpansionStart(decl);
+    SourceLocation end = locationFinder.getExpansionEnd(decl);
 
     // HACK: End locations of some decls (FunctionDecl in particular) may be wrong.
     // Since most decls are terminated by a semicolon, we use it as end location.
@@ -426,7 +428,7 @@ void OptimizerVisitor::removeDecl(Decl* decl) {
 
     SourceLocation semicolonAfterDefinition;
     if (forwardToSemicolon) {
-        semicolonAfterDefinition = findSemiAfterLocation(end, decl->getASTContext(), true);
+        semicolonAfterDefinition = locationFinder.findSemiAfterLocation(end, true);
     }
 
     dbg("REMOVE " << decl->getDeclKindName() << " "
@@ -442,7 +444,7 @@ void OptimizerVisitor::removeDecl(Decl* decl) {
         rewriter.removeRange(comment->getSourceRange());
 }
 
-void OptimizerVisitor::Finalize(ASTContext& ctx) {
+void OptimizerVisitor::Finalize() {
     for (const auto& kv : variables) {
         SourceLocation startOfType = kv.first;
         const vector<DeclaratorDecl*>& vars = kv.second;
@@ -456,11 +458,11 @@ void OptimizerVisitor::Finalize(ASTContext& ctx) {
                 lastUsed = i;
         }
 
-        SourceLocation endOfLastVar = getExpansionEnd(sourceManager, vars.back());
+        SourceLocation endOfLastVar = locationFinder.getExpansionEnd(vars.back());
 
         if (lastUsed == n) {
             // all variables are unused
-            SourceLocation semiColon = findSemiAfterLocation(endOfLastVar, ctx, true);
+            SourceLocation semiColon = locationFinder.findSemiAfterLocation(endOfLastVar, true);
             rewriter.removeRange(startOfType, semiColon);
         } else {
             for (size_t i = 0; i < lastUsed; ++i) if (!isUsed[i]) {
@@ -468,11 +470,11 @@ void OptimizerVisitor::Finalize(ASTContext& ctx) {
                 SourceLocation beg = vars[i]->getLocation();
 
                 // end of initializer
-                SourceLocation end = getExpansionEnd(sourceManager, vars[i]);
+                SourceLocation end = locationFinder.getExpansionEnd(vars[i]);
 
                 if (i+1 < n) {
                     // comma
-                    end = findTokenAfterLocation(end, ctx, tok::comma);
+                    end = locationFinder.findTokenAfterLocation(end, tok::comma);
                 }
 
                 if (beg.isValid() && end.isValid())
@@ -480,8 +482,8 @@ void OptimizerVisitor::Finalize(ASTContext& ctx) {
             }
             if (lastUsed + 1 != n) {
                 // clear all remaining variables, starting with comma
-                SourceLocation end = getExpansionEnd(sourceManager, vars[lastUsed]);
-                SourceLocation comma = findTokenAfterLocation(end, ctx, tok::comma);
+                SourceLocation end = locationFinder.getExpansionEnd(vars[lastUsed]);
+                SourceLocation comma = locationFinder.findTokenAfterLocation(end, tok::comma);
                 rewriter.removeRange(comma, endOfLastVar);
             }
         }
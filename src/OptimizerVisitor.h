@@ -7,6 +7,7 @@
 #pragma once
 
 #include "clang_version.h"
+#include "util.h"
 
 #include <clang/AST/RecursiveASTVisitor.h>
 #include <clang/Basic/SourceLocation.h>
@@ -19,8 +20,8 @@
 
 
 namespace clang {
+    class LangOptions;
     class SourceManager;
-    class ASTContext;
 }
 
 namespace caide {
@@ -32,7 +33,8 @@ class SmartRewriter;
 
 class OptimizerVisitor: public clang::RecursiveASTVisitor<OptimizerVisitor> {
 public:
-    OptimizerVisitor(clang::SourceManager& srcManager, const std::unordered_set<clang::Decl*>& usedDecls,
+    OptimizerVisitor(clang::SourceManager& srcManager, const clang::LangOptions& langOptions,
+            const std::unordered_set<clang::Decl*>& usedDecls,
             std::unordered_set<clang::Decl*>& removedDecls, SmartRewriter& rewriter_);
 
     bool shouldVisitImplicitCode() const;
@@ -62,7 +64,9 @@ public:
 
     // Apply changes that require some 'global' knowledge.
     // Called after traversal of the whole AST.
-    void Finalize(clang::ASTContext& ctx);
+    void Finalize();
+
+    std::size_t getNumLexerRestarts() const { return locationFinder.getNumRestarts(); }
 
 private:
     bool needToRemoveFunction(clang::FunctionDecl* functionDecl) const;
@@ -76,6 +80,7 @@ private:
 
 
     clang::SourceManager& sourceManager;
+    LocationFinder locationFinder;
     const std::unordered_set<clang::Decl*>& usedDeclarations;
     SmartRewriter& rewriter;
 
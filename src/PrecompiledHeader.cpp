@@ -0,0 +1,90 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#include "PrecompiledHeader.h"
+#include "ErrorCollector.h"
+#include "Timer.h"
+#include "util.h"
+
+#include <clang/Basic/FileManager.h>
+#include <clang/Frontend/CompilerInstance.h>
+#include <clang/Frontend/FrontendActions.h>
+#include <clang/Tooling/CompilationDatabase.h>
+#include <clang/Tooling/Tooling.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+
+using namespace clang;
+using std::string;
+using std::vector;
+
+
+namespace caide { namespace internal {
+
+namespace {
+
+// The tooling driver strips -o from the command line; set the output file directly.
+class PrecompiledHeaderAction: public GeneratePCHAction {
+public:
+    explicit PrecompiledHeaderAction(const string& pchPath_)
+        : pchPath(pchPath_)
+    {}
+
+protected:
+    bool BeginInvocation(CompilerInstance& compiler) override {
+        compiler.getFrontendOpts().OutputFile = pchPath;
+        return GeneratePCHAction::BeginInvocation(compiler);
+    }
+
+private:
+    const string& pchPath;
+};
+
+class PrecompiledHeaderActionFactory: public tooling::FrontendActionFactory {
+public:
+    explicit PrecompiledHeaderActionFactory(const string& pchPath_)
+        : pchPath(pchPath_)
+    {}
+
+    std::unique_ptr<FrontendAction> create() override {
+        return std::make_unique<PrecompiledHeaderAction>(pchPath);
+    }
+
+private:
+    const string& pchPath;
+};
+
+}
+
+vector<string> buildPrecompiledHeader(const vector<string>& cmdLineOptions,
+                                      const string& headerPath, const string& pchPath,
+                                      llvm::IntrusiveRefCntPtr<FileManager> fileManager)
+{
+    ScopedTimer t("buildPrecompiledHeader");
+    std::unique_ptr<tooling::FixedCompilationDatabase> compilationDatabase(
+        createCompilationDatabaseFromCommandLine(cmdLineOptions));
+
+    vector<string> sources;
+    sources.push_back(headerPath);
+
+    ErrorCollector errors;
+    std::unique_ptr<tooling::ClangTool> tool =
+        createClangTool(*compilationDatabase, sources, fileManager);
+    tool->setDiagnosticConsumer(&errors);
+
+    PrecompiledHeaderActionFactory factory(pchPath);
+    if (tool->run(&factory) == 0)
+        return {};
+
+    if (errors.getErrors().empty())
+        return {"Compilation of " + headerPath + " failed"};
+    return errors.getErrors();
+}
+
+}}
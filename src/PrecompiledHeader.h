@@ -0,0 +1,27 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#pragma once
+
+#include <llvm/ADT/IntrusiveRefCntPtr.h>
+
+#include <string>
+#include <vector>
+
+namespace clang {
+    class FileManager;
+}
+
+namespace caide { namespace internal {
+
+// Builds a precompiled header, to be used with '-include-pch pchPath' and the same
+// command line options. If fileManager is not null, it is used for all file system access.
+// Returns compilation errors; an empty list means that the header was built.
+std::vector<std::string> buildPrecompiledHeader(const std::vector<std::string>& cmdLineOptions,
+                                                const std::string& headerPath, const std::string& pchPath,
+                                                llvm::IntrusiveRefCntPtr<clang::FileManager> fileManager);
+
+}}
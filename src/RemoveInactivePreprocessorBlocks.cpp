@@ -6,11 +6,13 @@
 
 #include "RemoveInactivePreprocessorBlocks.h"
 #include "SmartRewriter.h"
+#include "Timer.h"
 #include "util.h"
 
 #include <clang/Basic/SourceManager.h>
 #include <clang/Lex/Preprocessor.h>
 
+#include <cstdint>
 #include <map>
 #include <set>
 #include <string>
@@ -46,6 +48,7 @@ struct IfDefClause {
 
 struct Macro {
     SourceRange definition;
+    // Distinct sites (expansion ranges in the file) where the macro is used
     vector<SourceRange> usages;
     SourceLocation undefinition;
     bool isWhitelisted = false;
@@ -65,6 +68,8 @@ private:
 
     // Macros that were #defined, and then #undefined.
     vector<Macro> undefinedMacros;
+
+    std::uint64_t numExpansions = 0;
 private:
     bool isWhitelistedMacro(const string& macroName) const {
         return macrosToKeep.find(macroName) != macrosToKeep.end();
@@ -122,7 +127,17 @@ public:
         if (!MD || !isInMainFile(MD->getLocation()))
             return;
 
-        definedMacros[MD].usages.push_back(Range);
+        ++numExpansions;
+
+        // A macro used in the definition of another macro expands each time the outer macro
+        // does, at locations inside the expansion; only the site of the outer expansion in the
+        // file matters for removal. All expansions of the same site are reported one after
+        // another, so comparing with the last usage is enough to deduplicate them.
+        SourceRange site(sourceManager.getExpansionLoc(Range.getBegin()),
+                         sourceManager.getExpansionLoc(Range.getEnd()));
+        vector<SourceRange>& usages = definedMacros[MD].usages;
+        if (usages.empty() || usages.back() != site)
+            usages.push_back(site);
     }
 
     // This is where we remove unused macros.
@@ -131,6 +146,14 @@ public:
     // There is PPCallbacks::EndOfMainFile(), however it seems to be called only after
     // some required resources have been deallocated. So we call this method manually instead.
     void Finalize() {
+        std::uint64_t numSites = 0;
+        for (const auto& kv : definedMacros)
+            numSites += kv.second.usages.size();
+        for (const Macro& macro : undefinedMacros)
+            numSites += macro.usages.size();
+        StatisticsCollector::count("macros.expansions", numExpansions);
+        StatisticsCollector::count("macros.usageSites", numSites);
+
         auto removeMacroIfUnused = [this](const Macro& macro) {
             if (macro.isWhitelisted)
                 return;
@@ -251,7 +274,6 @@ public:
             return;
 
         rewriter.appendToPreamble(string(s, e));
-        rewriter.appendToPreamble("\n");
         rewriter.removeRange(HashLoc, end);
     }
 
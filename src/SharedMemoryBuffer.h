@@ -0,0 +1,38 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#pragma once
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+#include <memory>
+#include <string>
+#include <utility>
+
+namespace caide { namespace internal {
+
+// A view of (a part of) a buffer that keeps the underlying buffer alive. The data must
+// be followed by a null character.
+class SharedMemoryBuffer: public llvm::MemoryBuffer {
+public:
+    SharedMemoryBuffer(std::shared_ptr<const llvm::MemoryBuffer> owner_, llvm::StringRef data,
+                       std::string name_)
+        : owner(std::move(owner_))
+        , name(std::move(name_))
+    {
+        init(data.begin(), data.end(), /*RequiresNullTerminator=*/true);
+    }
+
+    llvm::StringRef getBufferIdentifier() const override { return name; }
+    BufferKind getBufferKind() const override { return MemoryBuffer_Malloc; }
+
+private:
+    std::shared_ptr<const llvm::MemoryBuffer> owner;
+    std::string name;
+};
+
+}}
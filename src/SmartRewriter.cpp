@@ -6,26 +6,94 @@
 
 #include "SmartRewriter.h"
 #include "SourceLocationComparers.h"
+#include "Timer.h"
 
 #include <clang/Basic/SourceManager.h>
 
+#include <algorithm>
+#include <cctype>
+#include <set>
 #include <stdexcept>
+#include <utility>
+#include <vector>
 
 using namespace clang;
 
 namespace caide {
 namespace internal {
 
-SmartRewriter::SmartRewriter(SourceManager& srcManager, const LangOptions& langOptions)
+namespace {
+
+bool isBlank(char c) {
+    return c == ' ' || c == '\t';
+}
+
+// '#  include<vector>' -> '#include <vector>'
+std::string normalizeDirective(const std::string& directive) {
+    std::size_t i = directive.find('#');
+    if (i == std::string::npos)
+        return directive;
+    ++i;
+    while (i < directive.size() && isBlank(directive[i]))
+        ++i;
+    const std::size_t nameBegin = i;
+    while (i < directive.size() && (std::isalnum((unsigned char)directive[i]) || directive[i] == '_'))
+        ++i;
+    const std::size_t nameEnd = i;
+    while (i < directive.size() && isBlank(directive[i]))
+        ++i;
+    std::size_t end = directive.size();
+    while (end > i && isBlank(directive[end - 1]))
+        --end;
+    return "#" + directive.substr(nameBegin, nameEnd - nameBegin) + " " + directive.substr(i, end - i);
+}
+
+}
+
+SmartRewriter::SmartRewriter(SourceManager& srcManager, const LangOptions& langOptions,
+                             PreambleOptions preambleOptions_)
     : rewriter(srcManager, langOptions)
+    , preambleOptions(std::move(preambleOptions_))
     , comparer(srcManager)
     , removed(comparer)
     , changesApplied(false)
 {
 }
 
-void SmartRewriter::appendToPreamble(std::string s) {
-    preamble += std::move(s);
+void SmartRewriter::appendToPreamble(std::string directive) {
+    preamble.push_back(std::move(directive));
+}
+
+std::string SmartRewriter::getPreamble() const {
+    std::string result = preambleOptions.prelude;
+    if (!result.empty() && result.back() != '\n')
+        result.push_back('\n');
+
+    std::set<std::string> inPrelude;
+    std::size_t lineBegin = 0;
+    while (lineBegin < result.size()) {
+        const std::size_t lineEnd = result.find('\n', lineBegin);
+        inPrelude.insert(normalizeDirective(result.substr(lineBegin, lineEnd - lineBegin)));
+        lineBegin = lineEnd + 1;
+    }
+
+    std::vector<std::string> directives;
+    for (const std::string& directive : preamble) {
+        if (!inPrelude.empty() && inPrelude.count(normalizeDirective(directive)))
+            continue;
+        directives.push_back(preambleOptions.canonical ? normalizeDirective(directive) : directive);
+    }
+
+    if (preambleOptions.canonical) {
+        std::sort(directives.begin(), directives.end());
+        directives.erase(std::unique(directives.begin(), directives.end()), directives.end());
+    }
+
+    for (const std::string& directive : directives) {
+        result += directive;
+        result.push_back('\n');
+    }
+    return result;
 }
 
 void SmartRewriter::removeRange(SourceLocation begin, SourceLocation end) {
@@ -49,13 +117,49 @@ void SmartRewriter::applyChanges() {
         throw std::logic_error("Rewriter changes have already been applied");
     changesApplied = true;
 
+    SourceManager& srcManager = rewriter.getSourceMgr();
+    const FileID mainFileID = srcManager.getMainFileID();
+
+    // Removed parts of the main file, as [begin, end) offsets in source order. Sizes are
+    // computed before any text is removed: later they would refer to the rewritten text.
+    std::vector<std::pair<unsigned, unsigned>> removedOffsets;
     Rewriter::RewriteOptions opts;
+    for (const auto& range : removed) {
+        const int size = rewriter.getRangeSize(SourceRange(range.first, range.second), opts);
+        if (size >= 0 && range.first.isFileID() && srcManager.getFileID(range.first) == mainFileID) {
+            const unsigned begin = srcManager.getFileOffset(range.first);
+            removedOffsets.emplace_back(begin, begin + static_cast<unsigned>(size));
+        }
+    }
+
     for (const auto& range : removed)
         rewriter.RemoveText(SourceRange(range.first, range.second), opts);
 
-    SourceManager& srcManager = rewriter.getSourceMgr();
-    SourceLocation Loc = srcManager.getLocForStartOfFile(srcManager.getMainFileID());
+    SourceLocation Loc = srcManager.getLocForStartOfFile(mainFileID);
+    const std::string preamble = getPreamble();
     rewriter.InsertText(Loc, preamble);
+
+    // The result is the preamble followed by the parts of the main file that are kept.
+    const std::uint32_t mainFile = sourceMap.addFile(srcManager.getBufferName(Loc).str());
+    std::uint64_t outputOffset = preamble.size();
+    std::uint64_t keptBegin = 0;
+    for (const auto& removedRange : removedOffsets) {
+        if (removedRange.first > keptBegin) {
+            sourceMap.addSegment(outputOffset, mainFile, keptBegin);
+            outputOffset += removedRange.first - keptBegin;
+        }
+        keptBegin = std::max<std::uint64_t>(keptBegin, removedRange.second);
+    }
+    sourceMap.addSegment(outputOffset, mainFile, keptBegin);
+
+    // All removals and queries are done by now.
+    const auto statistics = removed.getStatistics();
+    StatisticsCollector::count("rewriter.removeRange", statistics.additions);
+    StatisticsCollector::count("rewriter.rangesInserted", statistics.insertions);
+    StatisticsCollector::count("rewriter.rangesExtended", statistics.extensions);
+    StatisticsCollector::count("rewriter.rangesMerged", statistics.mergedIntervals);
+    StatisticsCollector::count("rewriter.isPartOfRangeRemoved", statistics.queries);
+    StatisticsCollector::count("rewriter.comparisons", statistics.comparisons);
 }
 
 }
@@ -8,10 +8,12 @@
 
 #include "IntervalSet.h"
 #include "SourceLocationComparers.h"
+#include "SourceMap.h"
 
 #include <clang/Rewrite/Core/Rewriter.h>
 
 #include <string>
+#include <vector>
 
 namespace clang {
     class LangOptions;
@@ -21,26 +23,45 @@ namespace clang {
 namespace caide {
 namespace internal {
 
+// How include directives hoisted to the beginning of the output are written.
+struct PreambleOptions {
+    // Normalize whitespace in the directives, sort them and remove duplicates, so that
+    // programs using the same headers start with the same text.
+    bool canonical = false;
+
+    // Written before the directives. Directives that the prelude contains are not repeated.
+    std::string prelude;
+};
+
 class SmartRewriter {
 public:
-    SmartRewriter(clang::SourceManager& sourceManager, const clang::LangOptions& langOptions);
+    SmartRewriter(clang::SourceManager& sourceManager, const clang::LangOptions& langOptions,
+                  PreambleOptions preambleOptions = {});
     SmartRewriter(const SmartRewriter&) = delete;
     SmartRewriter& operator=(const SmartRewriter&) = delete;
     SmartRewriter(SmartRewriter&&) = delete;
     SmartRewriter& operator=(SmartRewriter&&) = delete;
 
     bool isPartOfRangeRemoved(const clang::SourceRange& range) const;
-    void appendToPreamble(std::string s);
+    // Adds an include directive (without the line break) to the preamble.
+    void appendToPreamble(std::string directive);
     void removeRange(clang::SourceLocation begin, clang::SourceLocation end);
     void removeRange(const clang::SourceRange& range);
     const clang::RewriteBuffer* getRewriteBufferFor(clang::FileID fileID) const;
     void applyChanges();
 
+    // Maps the rewritten main file to the original main file. Valid after applyChanges().
+    const SourceMap& getSourceMap() const { return sourceMap; }
+
 private:
+    std::string getPreamble() const;
+
     clang::Rewriter rewriter;
-    std::string preamble;
+    PreambleOptions preambleOptions;
+    std::vector<std::string> preamble;
     SourceLocationComparer comparer;
     IntervalSet<clang::SourceLocation, SourceLocationComparer> removed;
+    SourceMap sourceMap;
     bool changesApplied;
 };
 
@@ -0,0 +1,253 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#include "SourceMap.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+
+using std::string;
+using std::uint32_t;
+using std::uint64_t;
+
+namespace caide { namespace internal {
+
+namespace {
+
+const char MAGIC[] = "CSM1";
+const uint64_t END = std::numeric_limits<uint64_t>::max();
+
+void writeVarint(string& out, uint64_t value) {
+    do {
+        unsigned char byte = value & 0x7F;
+        value >>= 7;
+        if (value)
+            byte |= 0x80;
+        out.push_back(static_cast<char>(byte));
+    } while (value);
+}
+
+uint64_t readVarint(const string& data, std::size_t& pos) {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (pos >= data.size())
+            break;
+        const unsigned char byte = static_cast<unsigned char>(data[pos++]);
+        value |= uint64_t(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return value;
+    }
+    throw std::runtime_error("Invalid source map");
+}
+
+uint64_t zigzag(uint64_t from, uint64_t to) {
+    return to >= from ? (to - from) << 1 : ((from - to) << 1) - 1;
+}
+
+uint64_t unzigzag(uint64_t from, uint64_t encoded) {
+    return encoded & 1 ? from - ((encoded + 1) >> 1) : from + (encoded >> 1);
+}
+
+}
+
+uint32_t SourceMap::addFile(const string& path) {
+    auto it = fileIndices.find(path);
+    if (it != fileIndices.end())
+        return it->second;
+    const uint32_t index = static_cast<uint32_t>(files.size());
+    files.push_back(path);
+    fileIndices.emplace(path, index);
+    return index;
+}
+
+void SourceMap::addSegment(uint64_t outputOffset, uint32_t file, uint64_t fileOffset) {
+    if (file == noFile)
+        fileOffset = 0;
+
+    // The previous segment is empty.
+    while (!segments.empty() && segments.back().outputOffset == outputOffset)
+        segments.pop_back();
+
+    if (segments.empty()) {
+        if (file == noFile)
+            return;
+    } else {
+        const Segment& last = segments.back();
+        if (last.file == file &&
+                (file == noFile || last.fileOffset + (outputOffset - last.outputOffset) == fileOffset))
+            return;
+    }
+
+    segments.push_back(Segment{outputOffset, file, fileOffset});
+}
+
+void SourceMap::append(const SourceMap& other, uint64_t outputOffset) {
+    std::vector<uint32_t> fileRemap;
+    for (const string& path : other.files)
+        fileRemap.push_back(addFile(path));
+
+    if (other.segments.empty() || other.segments.front().outputOffset > 0)
+        addSegment(outputOffset, noFile, 0);
+    for (const Segment& segment : other.segments) {
+        addSegment(outputOffset + segment.outputOffset,
+            segment.file == noFile ? noFile : fileRemap[segment.file], segment.fileOffset);
+    }
+}
+
+void SourceMap::resolveThrough(uint32_t file, const SourceMap& fileMap) {
+    std::vector<uint32_t> fileRemap;
+    for (const string& path : fileMap.files)
+        fileRemap.push_back(addFile(path));
+
+    const std::vector<Segment>& inner = fileMap.segments;
+    std::vector<Segment> oldSegments;
+    oldSegments.swap(segments);
+
+    for (std::size_t i = 0; i < oldSegments.size(); ++i) {
+        const Segment& segment = oldSegments[i];
+        if (segment.file != file) {
+            addSegment(segment.outputOffset, segment.file, segment.fileOffset);
+            continue;
+        }
+
+        const uint64_t length = i + 1 < oldSegments.size()
+            ? oldSegments[i + 1].outputOffset - segment.outputOffset : END;
+        const uint64_t begin = segment.fileOffset;
+        const uint64_t end = length == END ? END : begin + length;
+
+        // Index of the inner segment containing begin, plus one (zero if begin is unmapped).
+        std::size_t j = std::upper_bound(inner.begin(), inner.end(), begin,
+            [](uint64_t offset, const Segment& s) { return offset < s.outputOffset; }) - inner.begin();
+
+        for (uint64_t pos = begin; pos < end; ++j) {
+            const uint64_t outputOffset = segment.outputOffset + (pos - begin);
+            if (j == 0 || inner[j - 1].file == noFile) {
+                addSegment(outputOffset, noFile, 0);
+            } else {
+                const Segment& s = inner[j - 1];
+                addSegment(outputOffset, fileRemap[s.file], s.fileOffset + (pos - s.outputOffset));
+            }
+            if (j >= inner.size())
+                break;
+            pos = inner[j].outputOffset;
+        }
+    }
+}
+
+bool SourceMap::lookup(uint64_t outputOffset, string& path, uint64_t& fileOffset) const {
+    auto it = std::upper_bound(segments.begin(), segments.end(), outputOffset,
+        [](uint64_t offset, const Segment& s) { return offset < s.outputOffset; });
+    if (it == segments.begin())
+        return false;
+    --it;
+    if (it->file == noFile)
+        return false;
+    path = files[it->file];
+    fileOffset = it->fileOffset + (outputOffset - it->outputOffset);
+    return true;
+}
+
+string SourceMap::serialize() const {
+    string out{MAGIC};
+    writeVarint(out, files.size());
+    for (const string& path : files) {
+        writeVarint(out, path.size());
+        out += path;
+    }
+
+    writeVarint(out, segments.size());
+    uint64_t prevOutputOffset = 0;
+    uint64_t prevFileOffset = 0;
+    for (const Segment& segment : segments) {
+        writeVarint(out, segment.outputOffset - prevOutputOffset);
+        writeVarint(out, segment.file == noFile ? 0 : uint64_t(segment.file) + 1);
+        if (segment.file != noFile) {
+            writeVarint(out, zigzag(prevFileOffset, segment.fileOffset));
+            prevFileOffset = segment.fileOffset;
+        }
+        prevOutputOffset = segment.outputOffset;
+    }
+    return out;
+}
+
+SourceMap SourceMap::deserialize(const string& data) {
+    const std::size_t magicLength = sizeof(MAGIC) - 1;
+    if (data.compare(0, magicLength, MAGIC) != 0)
+        throw std::runtime_error("Invalid source map");
+
+    SourceMap result;
+    std::size_t pos = magicLength;
+    const uint64_t numFiles = readVarint(data, pos);
+    if (numFiles > data.size())
+        throw std::runtime_error("Invalid source map");
+    for (uint64_t i = 0; i < numFiles; ++i) {
+        const uint64_t length = readVarint(data, pos);
+        if (length > data.size() - pos)
+            throw std::runtime_error("Invalid source map");
+        result.addFile(data.substr(pos, length));
+        pos += length;
+    }
+    if (result.files.size() != numFiles)
+        throw std::runtime_error("Invalid source map: duplicate files");
+
+    const uint64_t numSegments = readVarint(data, pos);
+    if (numSegments > data.size())
+        throw std::runtime_error("Invalid source map");
+    uint64_t outputOffset = 0;
+    uint64_t fileOffset = 0;
+    for (uint64_t i = 0; i < numSegments; ++i) {
+        outputOffset += readVarint(data, pos);
+        const uint64_t file = readVarint(data, pos);
+        if (file > numFiles)
+            throw std::runtime_error("Invalid source map");
+        if (file == 0) {
+            result.segments.push_back(Segment{outputOffset, noFile, 0});
+        } else {
+            fileOffset = unzigzag(fileOffset, readVarint(data, pos));
+            result.segments.push_back(Segment{outputOffset, static_cast<uint32_t>(file - 1), fileOffset});
+        }
+    }
+    if (pos != data.size())
+        throw std::runtime_error("Invalid source map");
+    return result;
+}
+
+OriginalLocations::OriginalLocations(const SourceMap& sourceMap_)
+    : sourceMap(sourceMap_)
+{
+}
+
+string OriginalLocations::describe(uint64_t outputOffset) {
+    string path;
+    uint64_t fileOffset = 0;
+    if (!sourceMap.lookup(outputOffset, path, fileOffset))
+        return "";
+
+    auto inserted = lineOffsets.emplace(path, std::vector<uint64_t>());
+    std::vector<uint64_t>& lines = inserted.first->second;
+    if (inserted.second) {
+        lines.push_back(0);
+        std::ifstream file{path, std::ios::binary};
+        std::istreambuf_iterator<char> it{file}, end;
+        for (uint64_t offset = 1; it != end; ++offset, ++it) {
+            if (*it == '\n')
+                lines.push_back(offset);
+        }
+    }
+
+    // The last line starting at or before the offset
+    const std::size_t line = std::upper_bound(lines.begin(), lines.end(), fileOffset) - lines.begin();
+    std::ostringstream location;
+    location << path << ":" << line << ":" << fileOffset - lines[line - 1] + 1;
+    return location.str();
+}
+
+}}
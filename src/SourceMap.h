@@ -0,0 +1,78 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace caide { namespace internal {
+
+// Maps offsets in a generated file to offsets in the files it was generated from.
+//
+// The map is a sequence of segments sorted by output offset. A segment maps the output
+// up to the start of the next segment to a contiguous range of one file. Text that doesn't
+// come from any file is covered by segments with file == noFile.
+class SourceMap {
+public:
+    static const std::uint32_t noFile = 0xFFFFFFFF;
+
+    struct Segment {
+        std::uint64_t outputOffset;
+        std::uint32_t file;
+        std::uint64_t fileOffset;
+    };
+
+    // Returns the index of the file, adding it if necessary.
+    std::uint32_t addFile(const std::string& path);
+    const std::vector<std::string>& getFiles() const { return files; }
+    const std::vector<Segment>& getSegments() const { return segments; }
+
+    // Output starting at outputOffset comes from fileOffset in file. Offsets must not decrease.
+    // A segment continuing the previous one is merged with it.
+    void addSegment(std::uint64_t outputOffset, std::uint32_t file, std::uint64_t fileOffset);
+
+    // Appends the segments of a map of text inserted at outputOffset.
+    void append(const SourceMap& other, std::uint64_t outputOffset);
+
+    // Replaces references to a file that was itself generated, with references to the files
+    // it was generated from.
+    void resolveThrough(std::uint32_t file, const SourceMap& fileMap);
+
+    // Returns false if the offset doesn't come from any file.
+    bool lookup(std::uint64_t outputOffset, std::string& path, std::uint64_t& fileOffset) const;
+
+    // Compact binary encoding: the file table followed by delta-encoded segments, with all
+    // numbers stored as LEB128 varints. A typical segment takes 3-5 bytes.
+    std::string serialize() const;
+
+    // Throws std::runtime_error if the data is not a valid encoding.
+    static SourceMap deserialize(const std::string& data);
+
+private:
+    std::vector<std::string> files;
+    std::unordered_map<std::string, std::uint32_t> fileIndices;
+    std::vector<Segment> segments;
+};
+
+// Describes original locations of output offsets as 'path:line:column'. Each original file
+// is read once, on first use, to find the offsets of its lines.
+class OriginalLocations {
+public:
+    explicit OriginalLocations(const SourceMap& sourceMap);
+
+    // Returns an empty string if the offset is unmapped.
+    std::string describe(std::uint64_t outputOffset);
+
+private:
+    const SourceMap& sourceMap;
+    // Offsets of the beginnings of lines, by file
+    std::unordered_map<std::string, std::vector<std::uint64_t>> lineOffsets;
+};
+
+}}
@@ -8,99 +8,208 @@
 
 // #define CAIDE_TIMER
 
-#ifdef CAIDE_TIMER
+// Allocation counts are reported next to timings.
+#if defined(CAIDE_PROFILE_ALLOCATIONS) && !defined(CAIDE_TIMER)
+#  define CAIDE_TIMER
+#endif
 
-#include <iostream>
-#include <map>
-#include <stack>
+#ifdef CAIDE_TIMER
+#  include <iostream>
+#  include <map>
+#  include <mutex>
+#  include <stack>
+#endif
 
 
 namespace caide { namespace internal {
 
+namespace {
+thread_local StatisticsCollector* currentCollector = nullptr;
+}
+
+StatisticsCollector::StatisticsCollector()
+    : previous(currentCollector)
+{
+    currentCollector = this;
+}
+
+StatisticsCollector::~StatisticsCollector() {
+    currentCollector = previous;
+}
+
+StatisticsCollector* StatisticsCollector::current() {
+    return currentCollector;
+}
+
+void StatisticsCollector::count(const std::string& counterName, std::uint64_t value) {
+    StatisticsCollector* collector = currentCollector;
+    if (!collector)
+        return;
+    for (auto& counter : collector->counters) {
+        if (counter.first == counterName) {
+            counter.second += value;
+            return;
+        }
+    }
+    collector->counters.emplace_back(counterName, value);
+}
+
+std::size_t StatisticsCollector::beginStage(const std::string& name) {
+    stages.emplace_back();
+    stages.back().name = name;
+    stages.back().depth = depth++;
+    return stages.size() - 1;
+}
+
+void StatisticsCollector::endStage() {
+    --depth;
+}
+
+#ifdef CAIDE_TIMER
+
 namespace {
 
 struct TimeReport {
     using Duration = std::chrono::steady_clock::duration;
     Duration duration;
+    AllocationStats allocations;
 
     std::map<std::string, TimeReport> children;
+
+    void merge(const TimeReport& other) {
+        duration += other.duration;
+        allocations.allocations += other.allocations.allocations;
+        allocations.bytes += other.allocations.bytes;
+        for (const auto& kv : other.children)
+            children[kv.first].merge(kv.second);
+    }
 };
 
-struct ReportPrinter {
-    TimeReport root;
+// Timers of a thread (e.g. a worker of inlineBatch) are nested in the thread's own tree,
+// which is merged into the report when the outermost timer of the thread ends.
+struct ThreadReport {
+    TimeReport root{};
     std::stack<TimeReport*> cur;
+
+    ThreadReport() { cur.push(&root); }
+};
+
+thread_local ThreadReport threadReport;
+
+struct ReportPrinter {
+    std::mutex mutex;
+    TimeReport root{};
     static const int INDENT = 2;
 
-    ReportPrinter() { cur.push(&root); }
     ~ReportPrinter() { print(root, "", -INDENT); }
 
+    void merge(TimeReport& threadRoot) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            root.merge(threadRoot);
+        }
+        threadRoot = TimeReport{};
+    }
+
     std::chrono::milliseconds print(const TimeReport& node, const std::string& name, int indent) {
         auto durationMs = std::chrono::duration_cast<std::chrono::milliseconds>(node.duration);
         auto other = durationMs;
         if (indent >= 0)
-            print(durationMs, name, indent);
+            print(durationMs, &node.allocations, name, indent);
 
         for (const auto& kv : node.children)
             other -= print(kv.second, kv.first, indent + INDENT);
 
         if (indent >= 0 && !node.children.empty() && other > std::chrono::milliseconds{0})
-            print(other, "Other", indent + INDENT);
+            print(other, nullptr, "Other", indent + INDENT);
 
         return durationMs;
     }
 
-    void print(std::chrono::milliseconds duration, const std::string& name, int indent) {
-        std::string durationStr = std::to_string(duration.count());
-        std::cerr << durationStr << " ms ";
-        for (size_t i = durationStr.size(); i < (size_t)6; ++i)
-            std::cerr << ' ';
+    void print(std::chrono::milliseconds duration, const AllocationStats* allocations,
+               const std::string& name, int indent)
+    {
+        printColumn(std::to_string(duration.count()), " ms ", 6);
+        if (allocationProfilingEnabled()) {
+            if (allocations) {
+                printColumn(std::to_string(allocations->allocations), " allocs ", 9);
+                printColumn(std::to_string(allocations->bytes / 1024), " KiB ", 8);
+            } else {
+                printColumn("", "        ", 9);
+                printColumn("", "     ", 8);
+            }
+        }
         for (int i = 0; i < indent; ++i)
             std::cerr << ' ';
         std::cerr << name << '\n';
     }
+
+    void printColumn(const std::string& value, const char* suffix, size_t width) {
+        std::cerr << value << suffix;
+        for (size_t i = value.size(); i < width; ++i)
+            std::cerr << ' ';
+    }
 } printer;
 
 }
 
+#endif
+
 ScopedTimer::ScopedTimer(const std::string& name) {
-    TimeReport* prev = printer.cur.top();
+#ifdef CAIDE_TIMER
+    TimeReport* prev = threadReport.cur.top();
     TimeReport& cur = prev->children[name];
-    printer.cur.push(&cur);
+    threadReport.cur.push(&cur);
     duration = &cur.duration;
+    allocations = &cur.allocations;
+#endif
+    collector = StatisticsCollector::current();
+    if (collector)
+        stageIndex = collector->beginStage(name);
     resume();
 }
 
 ScopedTimer::~ScopedTimer() {
     pause();
-    printer.cur.pop();
+    if (collector)
+        collector->endStage();
+#ifdef CAIDE_TIMER
+    threadReport.cur.pop();
+    if (threadReport.cur.size() == 1)
+        printer.merge(threadReport.root);
+#endif
 }
 
 void ScopedTimer::pause() {
-    if (start != Clock::time_point::min()) {
-        *duration += Clock::now() - start;
-        start = Clock::time_point::min();
+    if (start == Clock::time_point::min())
+        return;
+
+    Clock::duration elapsed = Clock::now() - start;
+    start = Clock::time_point::min();
+
+    AllocationStats now = getAllocationStats();
+    AllocationStats delta;
+    delta.allocations = now.allocations - startAllocations.allocations;
+    delta.bytes = now.bytes - startAllocations.bytes;
+
+    if (duration) {
+        *duration += elapsed;
+        allocations->allocations += delta.allocations;
+        allocations->bytes += delta.bytes;
+    }
+    if (collector) {
+        StatisticsCollector::Stage& stage = collector->stages[stageIndex];
+        stage.duration += elapsed;
+        stage.allocations.allocations += delta.allocations;
+        stage.allocations.bytes += delta.bytes;
     }
 }
 
 void ScopedTimer::resume() {
+    if (!duration && !collector)
+        return;
+    startAllocations = getAllocationStats();
     start = Clock::now();
 }
 
 }}
-
-#else
-
-namespace caide { namespace internal {
-
-ScopedTimer::ScopedTimer(const std::string&) {
-    (void)start;
-    (void)duration;
-}
-ScopedTimer::~ScopedTimer() = default;
-void ScopedTimer::pause() { }
-void ScopedTimer::resume() { }
-
-}}
-
-#endif
-
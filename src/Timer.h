@@ -4,11 +4,56 @@
 // the Free Software Foundation, either version 3 of the License, or (at your
 // option) any later version. See LICENSE.TXT for details.
 
+#pragma once
+
+#include "AllocationCounter.h"
+
 #include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <string>
+#include <utility>
+#include <vector>
 
 namespace caide { namespace internal {
 
+// Collects measurements of all ScopedTimers created on the current thread while
+// the collector is alive. Unlike the report enabled with CAIDE_TIMER, this is
+// available at runtime and is used to fill InlinerStatistics.
+class StatisticsCollector {
+public:
+    struct Stage {
+        std::string name;
+        int depth = 0;
+        std::chrono::steady_clock::duration duration{};
+        AllocationStats allocations;
+    };
+
+    StatisticsCollector();
+    ~StatisticsCollector();
+    StatisticsCollector(const StatisticsCollector&) = delete;
+    StatisticsCollector& operator=(const StatisticsCollector&) = delete;
+
+    // Innermost collector of the current thread, or nullptr.
+    static StatisticsCollector* current();
+
+    // Adds value to a named counter of the innermost collector, if any.
+    static void count(const std::string& counterName, std::uint64_t value);
+
+    const std::vector<Stage>& getStages() const { return stages; }
+    const std::vector<std::pair<std::string, std::uint64_t>>& getCounters() const { return counters; }
+
+private:
+    friend class ScopedTimer;
+    std::size_t beginStage(const std::string& name);
+    void endStage();
+
+    std::vector<Stage> stages;
+    std::vector<std::pair<std::string, std::uint64_t>> counters;
+    int depth = 0;
+    StatisticsCollector* previous;
+};
+
 class ScopedTimer {
 public:
     ScopedTimer(const std::string& name);
@@ -19,8 +64,13 @@ public:
 
 private:
     using Clock = std::chrono::steady_clock;
-    Clock::time_point start;
+    Clock::time_point start = Clock::time_point::min();
     Clock::duration* duration = nullptr;
+    AllocationStats startAllocations;
+    AllocationStats* allocations = nullptr;
+
+    StatisticsCollector* collector = nullptr;
+    std::size_t stageIndex = 0;
 };
 
 } }
@@ -0,0 +1,542 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+// Benchmark on a local corpus of real programs, grouped by workload category.
+//
+// Usage:
+//   corpus-bench <temp-directory> <compilation-options-file> <corpus-directory>
+//       [--repetitions <N>] [--filter <substring>] [--calibrate <model-file>]
+//
+// <compilation-options-file> has the same format as for test-tool; generate it with
+// 'test-tool <temp-directory> --prepare <file>'.
+//
+// Corpus layout:
+//
+//   <corpus-directory>/
+//     weights.txt                 one '<category> <weight>' pair per line
+//     <category>/
+//       <program>/                same format as a directory in tests/cases:
+//         1.cpp ... 9.cpp         source files
+//         clangOptions.txt        optional; TEST_ROOT is replaced with the program directory
+//         macrosToKeep.txt        optional
+//         identifiersToKeep.txt   optional
+//
+// Recommended categories are stl (single-file programs using STL), header-library (programs
+// including a large header-only library), template-metaprogramming, generated-tables and
+// macros (heavy macro usage). Weights should reflect the share of each category in
+// production traffic; categories missing from weights.txt get weight 0 and are reported
+// but excluded from the aggregate. If weights.txt doesn't exist, all categories have
+// equal weights.
+//
+// For every category, the runner reports the median (over programs) of the median (over
+// repetitions) time of each top-level stage and of the whole run. Every repetition starts
+// with an empty in-process file cache (CppInliner::clearFileCache()), so that it measures
+// what a one-shot run of cmd does; only the OS file cache is warm. The aggregate is the
+// weighted mean of category medians.
+//
+// With --calibrate, the runner also measures peak memory of every program and fits the
+// cost model used by CppInliner::estimateCost() (see CostPredictor.h): every stage, the
+// total time and the memory are predicted by a nonnegative linear combination of the
+// features reported by estimateCost(). The model is written to <model-file> and the mean
+// absolute percentage error of each target on the corpus is reported. Peak memory is
+// measured through /proc/self/status (Linux only).
+
+#include "../caideInliner.hpp"
+
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+
+using caide::InlinerStatistics;
+using std::string;
+using std::vector;
+
+namespace {
+
+struct Settings {
+    string tempDirectory;
+    vector<string> clangOptions;
+    string corpusDirectory;
+    int repetitions = 5;
+    string filter;
+    string calibrationFile;
+};
+
+// Milliseconds per top-level stage, plus the total under the key TOTAL.
+using Timings = std::map<string, double>;
+const char* const TOTAL = "total";
+const char* const MEGABYTES = "megabytes";
+
+struct ProgramResult {
+    string name;
+    Timings medians;
+
+    // For calibration of the cost model
+    vector<std::pair<string, double>> features;
+    double peakMegabytes = 0;
+};
+
+struct CategoryResult {
+    string name;
+    double weight = 0;
+    vector<ProgramResult> programs;
+    Timings medians;
+};
+
+vector<string> readNonEmptyLines(const string& filePath) {
+    vector<string> lines;
+    std::ifstream file{filePath.c_str()};
+    string line;
+    while (std::getline(file, line)) {
+        if (line.find_first_not_of(" \t\r\n") != string::npos)
+            lines.push_back(line);
+    }
+    return lines;
+}
+
+string pathConcat(const string& directory, const string& fileName) {
+    return directory + "/" + fileName;
+}
+
+bool fileExists(const string& filePath) {
+    std::ifstream file{filePath.c_str()};
+    return static_cast<bool>(file);
+}
+
+// Sorted names of subdirectories
+vector<string> listSubdirectories(const string& directory) {
+    vector<string> names;
+    std::error_code ec;
+    for (llvm::sys::fs::directory_iterator it(directory, ec), end; it != end && !ec; it.increment(ec)) {
+        if (llvm::sys::fs::is_directory(it->path()))
+            names.push_back(llvm::sys::path::filename(it->path()).str());
+    }
+    if (ec)
+        throw std::runtime_error("Couldn't list " + directory + ": " + ec.message());
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+double median(vector<double> values) {
+    if (values.empty())
+        return 0;
+    std::sort(values.begin(), values.end());
+    const std::size_t n = values.size();
+    return n % 2 == 1 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+}
+
+Timings medianTimings(const vector<Timings>& runs) {
+    std::map<string, vector<double>> byStage;
+    for (const Timings& run : runs) {
+        for (const auto& kv : run)
+            byStage[kv.first].push_back(kv.second);
+    }
+    Timings result;
+    for (auto& kv : byStage) {
+        // A stage missing in some runs counts as zero time
+        kv.second.resize(runs.size(), 0);
+        result[kv.first] = median(kv.second);
+    }
+    return result;
+}
+
+// Resets the peak resident set size of the process (Linux 4.0+).
+void resetPeakMemory() {
+    std::ofstream clearRefs{"/proc/self/clear_refs"};
+    clearRefs << "5";
+}
+
+// Peak resident set size since the last resetPeakMemory(), in megabytes; 0 if unknown.
+double getPeakMegabytes() {
+    std::ifstream status{"/proc/self/status"};
+    string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 6, "VmHWM:") == 0)
+            return std::atof(line.c_str() + 6) / 1024;
+    }
+    return 0;
+}
+
+void runProgram(const Settings& settings, const string& programDirectory, ProgramResult& result) {
+    caide::CppInliner inliner{settings.tempDirectory};
+    inliner.clangCompilationOptions = settings.clangOptions;
+    for (string opt : readNonEmptyLines(pathConcat(programDirectory, "clangOptions.txt"))) {
+        const static string TEST_ROOT_MARKER = "TEST_ROOT";
+        auto p = opt.find(TEST_ROOT_MARKER);
+        if (p != string::npos)
+            opt.replace(p, TEST_ROOT_MARKER.length(), programDirectory);
+        inliner.clangCompilationOptions.push_back(std::move(opt));
+    }
+    inliner.macrosToKeep = readNonEmptyLines(pathConcat(programDirectory, "macrosToKeep.txt"));
+    inliner.identifiersToKeep = readNonEmptyLines(pathConcat(programDirectory, "identifiersToKeep.txt"));
+
+    vector<string> cppFiles;
+    for (int i = 1; i <= 9; ++i) {
+        std::ostringstream fileName;
+        fileName << i << ".cpp";
+        const string filePath = pathConcat(programDirectory, fileName.str());
+        if (fileExists(filePath))
+            cppFiles.push_back(filePath);
+    }
+    if (cppFiles.empty())
+        throw std::runtime_error("No source files found in " + programDirectory);
+
+    const string outputFilePath = pathConcat(settings.tempDirectory, "corpus-result.cpp");
+
+    // Warmup run: fills the OS file cache for system headers.
+    caide::CppInliner::clearFileCache();
+    InlinerStatistics statistics;
+    inliner.inlineCode(cppFiles, outputFilePath, statistics);
+
+    if (!settings.calibrationFile.empty())
+        result.features = inliner.estimateCost(cppFiles).features;
+
+    vector<Timings> runs;
+    vector<double> peakMegabytes;
+    for (int rep = 0; rep < settings.repetitions; ++rep) {
+        if (!settings.calibrationFile.empty())
+            resetPeakMemory();
+        caide::CppInliner::clearFileCache();
+        inliner.inlineCode(cppFiles, outputFilePath, statistics);
+        if (!settings.calibrationFile.empty())
+            peakMegabytes.push_back(getPeakMegabytes());
+        Timings timings;
+        double total = 0;
+        for (const auto& stage : statistics.stages) {
+            if (stage.depth == 0) {
+                timings[stage.name] += stage.milliseconds;
+                total += stage.milliseconds;
+            }
+        }
+        timings[TOTAL] = total;
+        runs.push_back(std::move(timings));
+    }
+
+    result.medians = medianTimings(runs);
+    result.peakMegabytes = median(peakMegabytes);
+}
+
+// Solves a*x = b by Gaussian elimination with partial pivoting; a is square and
+// nonsingular (guaranteed by the ridge term below).
+vector<double> solveLinearSystem(vector<vector<double>> a, vector<double> b) {
+    const std::size_t n = b.size();
+    for (std::size_t col = 0; col < n; ++col) {
+        std::size_t pivot = col;
+        for (std::size_t row = col + 1; row < n; ++row) {
+            if (std::fabs(a[row][col]) > std::fabs(a[pivot][col]))
+                pivot = row;
+        }
+        std::swap(a[col], a[pivot]);
+        std::swap(b[col], b[pivot]);
+        for (std::size_t row = col + 1; row < n; ++row) {
+            const double factor = a[row][col] / a[col][col];
+            for (std::size_t k = col; k < n; ++k)
+                a[row][k] -= factor * a[col][k];
+            b[row] -= factor * b[col];
+        }
+    }
+    vector<double> x(n);
+    for (std::size_t row = n; row-- > 0;) {
+        double sum = b[row];
+        for (std::size_t k = row + 1; k < n; ++k)
+            sum -= a[row][k] * x[k];
+        x[row] = sum / a[row][row];
+    }
+    return x;
+}
+
+// Least squares fit of y by nonnegative coefficients of the columns of x. A small ridge
+// term keeps the fit stable when features are correlated or the corpus is small. Negative
+// coefficients are removed one at a time (the most negative first), refitting the rest.
+vector<double> fitNonnegative(const vector<vector<double>>& x, const vector<double>& y) {
+    const std::size_t numFeatures = x.empty() ? 0 : x[0].size();
+    vector<bool> active(numFeatures, true);
+    while (true) {
+        vector<std::size_t> columns;
+        for (std::size_t j = 0; j < numFeatures; ++j) {
+            if (active[j])
+                columns.push_back(j);
+        }
+        vector<double> coefficients(numFeatures, 0);
+        if (columns.empty())
+            return coefficients;
+
+        const std::size_t n = columns.size();
+        vector<vector<double>> xtx(n, vector<double>(n, 0));
+        vector<double> xty(n, 0);
+        for (std::size_t i = 0; i < x.size(); ++i) {
+            for (std::size_t p = 0; p < n; ++p) {
+                xty[p] += x[i][columns[p]] * y[i];
+                for (std::size_t q = 0; q < n; ++q)
+                    xtx[p][q] += x[i][columns[p]] * x[i][columns[q]];
+            }
+        }
+        for (std::size_t p = 0; p < n; ++p)
+            xtx[p][p] += 1e-6 * (1 + xtx[p][p]);
+
+        const vector<double> solution = solveLinearSystem(xtx, xty);
+        std::size_t mostNegative = n;
+        for (std::size_t p = 0; p < n; ++p) {
+            coefficients[columns[p]] = solution[p];
+            if (solution[p] < 0 && (mostNegative == n || solution[p] < solution[mostNegative]))
+                mostNegative = p;
+        }
+        if (mostNegative == n)
+            return coefficients;
+        active[columns[mostNegative]] = false;
+    }
+}
+
+int calibrate(const Settings& settings, const vector<CategoryResult>& categories) {
+    vector<const ProgramResult*> programs;
+    for (const CategoryResult& c : categories) {
+        for (const ProgramResult& p : c.programs)
+            programs.push_back(&p);
+    }
+
+    vector<string> featureNames;
+    for (const auto& feature : programs[0]->features)
+        featureNames.push_back(feature.first);
+    vector<vector<double>> x;
+    for (const ProgramResult* p : programs) {
+        vector<double> row;
+        for (const auto& feature : p->features)
+            row.push_back(feature.second);
+        x.push_back(std::move(row));
+    }
+
+    vector<string> targets{TOTAL, MEGABYTES};
+    for (const ProgramResult* p : programs) {
+        for (const auto& kv : p->medians) {
+            if (std::find(targets.begin(), targets.end(), kv.first) == targets.end())
+                targets.push_back(kv.first);
+        }
+    }
+
+    std::ofstream model{settings.calibrationFile.c_str()};
+    model << std::setprecision(6);
+    std::cout << "\nCost model fitted on " << programs.size() << " programs\n\n";
+    std::cout << std::left << std::setw(40) << "target" << std::right << std::setw(12) << "error, %" << '\n';
+    for (const string& target : targets) {
+        vector<double> y;
+        for (const ProgramResult* p : programs) {
+            if (target == MEGABYTES) {
+                y.push_back(p->peakMegabytes);
+            } else {
+                auto it = p->medians.find(target);
+                y.push_back(it == p->medians.end() ? 0 : it->second);
+            }
+        }
+
+        const vector<double> coefficients = fitNonnegative(x, y);
+        for (std::size_t j = 0; j < featureNames.size(); ++j) {
+            if (coefficients[j] > 0)
+                model << target << ' ' << featureNames[j] << ' ' << coefficients[j] << '\n';
+        }
+
+        double errorSum = 0;
+        int numErrors = 0;
+        for (std::size_t i = 0; i < programs.size(); ++i) {
+            if (y[i] <= 0)
+                continue;
+            double predicted = 0;
+            for (std::size_t j = 0; j < featureNames.size(); ++j)
+                predicted += coefficients[j] * x[i][j];
+            errorSum += std::fabs(predicted - y[i]) / y[i];
+            ++numErrors;
+        }
+        std::cout << std::left << std::setw(40) << target << std::right << std::setw(12);
+        if (numErrors > 0)
+            std::cout << 100 * errorSum / numErrors;
+        else
+            std::cout << "-";
+        std::cout << '\n';
+    }
+
+    if (!model) {
+        std::cerr << "Couldn't write " << settings.calibrationFile << "\n";
+        return 1;
+    }
+    return 0;
+}
+
+std::map<string, double> readWeights(const string& corpusDirectory, bool& found) {
+    std::map<string, double> weights;
+    const string weightsPath = pathConcat(corpusDirectory, "weights.txt");
+    found = fileExists(weightsPath);
+    for (const string& line : readNonEmptyLines(weightsPath)) {
+        std::istringstream in(line);
+        string category;
+        double weight = 0;
+        if (!(in >> category >> weight) || weight < 0)
+            throw std::runtime_error("Invalid line in " + weightsPath + ": " + line);
+        weights[category] = weight;
+    }
+    return weights;
+}
+
+void printRow(const string& name, const Timings& timings, const vector<string>& columns) {
+    std::cout << std::left << std::setw(40) << name << std::right;
+    for (const string& column : columns) {
+        auto it = timings.find(column);
+        std::cout << std::setw(std::max<int>(12, (int)column.size() + 2));
+        if (it == timings.end())
+            std::cout << "-";
+        else
+            std::cout << it->second;
+    }
+    std::cout << '\n';
+}
+
+int run(const Settings& settings) {
+    bool haveWeights = false;
+    const std::map<string, double> weights = readWeights(settings.corpusDirectory, haveWeights);
+
+    vector<CategoryResult> categories;
+    int numFailed = 0;
+    for (const string& category : listSubdirectories(settings.corpusDirectory)) {
+        CategoryResult result;
+        result.name = category;
+        auto it = weights.find(category);
+        result.weight = haveWeights ? (it == weights.end() ? 0 : it->second) : 1;
+        if (haveWeights && it == weights.end())
+            std::cerr << "Warning: no weight for category " << category << "\n";
+
+        const string categoryDirectory = pathConcat(settings.corpusDirectory, category);
+        for (const string& program : listSubdirectories(categoryDirectory)) {
+            const string name = category + "/" + program;
+            if (name.find(settings.filter) == string::npos)
+                continue;
+            try {
+                ProgramResult programResult;
+                programResult.name = name;
+                runProgram(settings, pathConcat(categoryDirectory, program), programResult);
+                result.programs.push_back(std::move(programResult));
+            } catch (const std::exception& e) {
+                std::cerr << name << ": " << e.what() << "\n";
+                ++numFailed;
+            }
+        }
+
+        if (result.programs.empty())
+            continue;
+
+        vector<Timings> programMedians;
+        for (const ProgramResult& p : result.programs)
+            programMedians.push_back(p.medians);
+        result.medians = medianTimings(programMedians);
+        categories.push_back(std::move(result));
+    }
+
+    for (const auto& kv : weights) {
+        bool present = std::any_of(categories.begin(), categories.end(),
+            [&](const CategoryResult& c) { return c.name == kv.first; });
+        if (!present && kv.second > 0)
+            std::cerr << "Warning: category " << kv.first << " has a weight but no programs\n";
+    }
+
+    if (categories.empty()) {
+        std::cerr << "No programs found in " << settings.corpusDirectory << "\n";
+        return 1;
+    }
+
+    // Columns: total first, then stages in the order of their first appearance.
+    vector<string> columns{TOTAL};
+    for (const CategoryResult& c : categories) {
+        for (const auto& kv : c.medians) {
+            if (std::find(columns.begin(), columns.end(), kv.first) == columns.end())
+                columns.push_back(kv.first);
+        }
+    }
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "Median time, ms (" << settings.repetitions << " repetitions)\n\n";
+    std::cout << std::left << std::setw(40) << "program" << std::right;
+    for (const string& column : columns)
+        std::cout << std::setw(std::max<int>(12, (int)column.size() + 2)) << column;
+    std::cout << '\n';
+
+    for (const CategoryResult& c : categories) {
+        for (const ProgramResult& p : c.programs)
+            printRow(p.name, p.medians, columns);
+    }
+
+    std::cout << '\n' << std::left << std::setw(40) << "category (weight)" << '\n';
+    Timings aggregate;
+    double totalWeight = 0;
+    for (const CategoryResult& c : categories) {
+        std::ostringstream name;
+        name << c.name << " (" << c.weight << ")";
+        printRow(name.str(), c.medians, columns);
+        totalWeight += c.weight;
+        for (const string& column : columns) {
+            auto it = c.medians.find(column);
+            aggregate[column] += c.weight * (it == c.medians.end() ? 0 : it->second);
+        }
+    }
+
+    if (totalWeight > 0) {
+        for (auto& kv : aggregate)
+            kv.second /= totalWeight;
+        std::cout << '\n';
+        printRow("weighted aggregate", aggregate, columns);
+    }
+
+    if (!settings.calibrationFile.empty() && calibrate(settings, categories) != 0)
+        return 1;
+
+    return numFailed;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 4) {
+        std::cerr << "Usage: corpus-bench <temp-directory> <compilation-options-file> <corpus-directory>"
+                     " [--repetitions <N>] [--filter <substring>] [--calibrate <model-file>]\n";
+        return 1;
+    }
+
+    Settings settings;
+    settings.tempDirectory = argv[1];
+    settings.clangOptions = readNonEmptyLines(argv[2]);
+    settings.corpusDirectory = argv[3];
+
+    for (int i = 4; i < argc; ++i) {
+        const string arg = argv[i];
+        if (i + 1 < argc && arg == "--repetitions")
+            settings.repetitions = std::max(1, std::atoi(argv[++i]));
+        else if (i + 1 < argc && arg == "--filter")
+            settings.filter = argv[++i];
+        else if (i + 1 < argc && arg == "--calibrate")
+            settings.calibrationFile = argv[++i];
+        else {
+            std::cerr << "Unknown argument: " << arg << "\n";
+            return 1;
+        }
+    }
+
+    try {
+        return run(settings);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+}
@@ -0,0 +1,147 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#include "generator.h"
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+
+using std::string;
+
+namespace caide { namespace bench {
+
+const std::vector<Family>& allFamilies() {
+    static const std::vector<Family> families{
+        Family::MacroNesting, Family::RecursiveTemplate, Family::ManyInstantiations,
+        Family::LiteralTable, Family::CallChain, Family::NestedConditionals,
+        Family::NestedNamespaces,
+    };
+    return families;
+}
+
+string familyName(Family family) {
+    switch (family) {
+        case Family::MacroNesting: return "macro-nesting";
+        case Family::RecursiveTemplate: return "recursive-template";
+        case Family::ManyInstantiations: return "many-instantiations";
+        case Family::LiteralTable: return "literal-table";
+        case Family::CallChain: return "call-chain";
+        case Family::NestedConditionals: return "nested-conditionals";
+        case Family::NestedNamespaces: return "nested-namespaces";
+    }
+    throw std::logic_error("Unknown family");
+}
+
+bool parseFamily(const string& name, Family& family) {
+    for (Family f : allFamilies()) {
+        if (familyName(f) == name) {
+            family = f;
+            return true;
+        }
+    }
+    return false;
+}
+
+int maxScale(Family family) {
+    switch (family) {
+        case Family::MacroNesting: return 20;
+        // Default -ftemplate-depth is 1024
+        case Family::RecursiveTemplate: return 1000;
+        case Family::ManyInstantiations: return 20000;
+        case Family::LiteralTable: return 1000000;
+        case Family::CallChain: return 50000;
+        // Default -fbracket-depth is 256; conditionals are not limited, but keep it sane
+        case Family::NestedConditionals: return 5000;
+        case Family::NestedNamespaces: return 2000;
+    }
+    throw std::logic_error("Unknown family");
+}
+
+string generateSnippet(Family family, int scale, const string& entryPoint) {
+    scale = std::max(1, std::min(scale, maxScale(family)));
+    const string& p = entryPoint;
+    std::ostringstream out;
+
+    switch (family) {
+        case Family::MacroNesting:
+            out << "#define " << p << "_M0(x) ((x) + 1)\n";
+            for (int i = 1; i <= scale; ++i)
+                out << "#define " << p << "_M" << i << "(x) " << p << "_M" << (i - 1)
+                    << "(" << p << "_M" << (i - 1) << "(x))\n";
+            out << "int " << p << "() { return " << p << "_M" << scale << "(0); }\n";
+            break;
+
+        case Family::RecursiveTemplate:
+            out << "template<int N> struct " << p << "_R { enum { value = "
+                << p << "_R<N - 1>::value + 1 }; };\n"
+                << "template<> struct " << p << "_R<0> { enum { value = 0 }; };\n"
+                << "int " << p << "() { return " << p << "_R<" << scale << ">::value; }\n";
+            break;
+
+        case Family::ManyInstantiations:
+            out << "template<int N> int " << p << "_f() { return N; }\n"
+                << "template<int N> int " << p << "_unused() { return N; }\n"
+                << "int " << p << "() {\n    int sum = 0;\n";
+            for (int i = 0; i < scale; ++i)
+                out << "    sum += " << p << "_f<" << i << ">();\n";
+            out << "    return sum;\n}\n";
+            break;
+
+        case Family::LiteralTable:
+            out << "const int " << p << "_table[] = {";
+            for (int i = 0; i < scale; ++i) {
+                if (i % 16 == 0)
+                    out << "\n   ";
+                out << ' ' << ((i * 2654435761u) % 100000) << ',';
+            }
+            out << "\n};\n"
+                << "int " << p << "() { return " << p << "_table[" << (scale - 1) << "]; }\n";
+            break;
+
+        case Family::CallChain:
+            out << "int " << p << "_0() { return 0; }\n"
+                << "int " << p << "_unused0() { return 0; }\n";
+            for (int i = 1; i <= scale; ++i) {
+                out << "int " << p << "_" << i << "() { return " << p << "_" << (i - 1) << "() + 1; }\n";
+                out << "int " << p << "_unused" << i << "() { return " << p << "_unused" << (i - 1) << "(); }\n";
+            }
+            out << "int " << p << "() { return " << p << "_" << scale << "(); }\n";
+            break;
+
+        case Family::NestedConditionals:
+            out << "#define " << p << "_DEFINED 1\n";
+            for (int i = 0; i < scale; ++i)
+                out << "#if " << p << "_DEFINED\n";
+            out << "int " << p << "() { return 0; }\n";
+            for (int i = 0; i < scale; ++i)
+                out << "#else\nint " << p << "_dead" << i << "() { return " << i << "; }\n#endif\n";
+            break;
+
+        case Family::NestedNamespaces:
+            for (int i = 0; i < scale; ++i)
+                out << "namespace " << p << "_ns" << i << " {\nint unused" << i << "() { return " << i << "; }\n";
+            out << "inline int used() { return " << scale << "; }\n";
+            for (int i = 0; i < scale; ++i)
+                out << "}\n";
+            out << "int " << p << "() { return ";
+            for (int i = 0; i < scale; ++i)
+                out << p << "_ns" << i << "::";
+            out << "used(); }\n";
+            break;
+    }
+
+    return out.str();
+}
+
+string generateProgram(Family family, int scale) {
+    const string entryPoint = "gen";
+    return generateSnippet(family, scale, entryPoint) +
+        "int main() {\n    return " + entryPoint + "() == 42;\n}\n";
+}
+
+} }
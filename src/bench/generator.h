@@ -0,0 +1,49 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace caide { namespace bench {
+
+// Scaling generator of synthetic C++ code. Each family stresses one kind of input that
+// is known to be expensive for some stage of the inliner; the scale parameter controls
+// the size (or depth) of the construct.
+enum class Family {
+    // Macros expanding to 2^scale tokens.
+    MacroNesting,
+    // Class template instantiated recursively to depth scale.
+    RecursiveTemplate,
+    // scale distinct instantiations of a function template.
+    ManyInstantiations,
+    // Constant array with scale elements.
+    LiteralTable,
+    // Chain of scale functions, each calling the previous one.
+    CallChain,
+    // scale nested preprocessor conditionals, each with a dead branch.
+    NestedConditionals,
+    // scale nested namespaces with unused declarations.
+    NestedNamespaces,
+};
+
+const std::vector<Family>& allFamilies();
+std::string familyName(Family family);
+bool parseFamily(const std::string& name, Family& family);
+
+// Largest scale that is still compilable with default compiler limits.
+int maxScale(Family family);
+
+// A self-contained snippet (no includes) defining a function `int <entryPoint>()`.
+// All other identifiers are prefixed with entryPoint, so that several snippets
+// can be combined in one program.
+std::string generateSnippet(Family family, int scale, const std::string& entryPoint);
+
+// A complete program with a main function that uses the snippet.
+std::string generateProgram(Family family, int scale);
+
+} }
@@ -0,0 +1,383 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+// Micro-benchmarks for data structures and text passes on the hot paths of the inliner.
+// They don't parse any C++ code: inputs are synthetic and generated from fixed seeds, so
+// that results are comparable between runs and between revisions.
+//
+// Usage: micro-bench [--filter <substring>] [--repetitions <N>]
+
+#include "../IntervalSet.h"
+#include "../postprocess.h"
+#include "../reachability.h"
+#include "../SourceLocationComparers.h"
+#include "../SourceMap.h"
+
+#include <clang/Basic/Diagnostic.h>
+#include <clang/Basic/DiagnosticOptions.h>
+#include <clang/Basic/FileManager.h>
+#include <clang/Basic/FileSystemOptions.h>
+#include <clang/Basic/SourceManager.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+using caide::internal::IntervalSet;
+using caide::internal::SourceLocationComparer;
+using std::string;
+using std::vector;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+const std::uint32_t SEED = 20240101;
+
+// Accumulates results of benchmarked code so that the compiler can't optimize it away.
+std::uint64_t checksum = 0;
+
+struct Benchmark {
+    string name;
+    // Number of elementary operations in one run, used to report time per operation.
+    std::size_t numOperations;
+    // Returns a function doing one run. Preparation of inputs is not measured.
+    std::function<std::function<void()>()> prepare;
+};
+
+// Random intervals [left, left + length] in [0, range).
+vector<std::pair<int, int>> randomIntervals(std::size_t count, int range, int maxLength) {
+    std::mt19937 rng(SEED);
+    std::uniform_int_distribution<int> leftDist(0, range - 1);
+    std::uniform_int_distribution<int> lengthDist(0, maxLength);
+    vector<std::pair<int, int>> intervals(count);
+    for (auto& interval : intervals) {
+        interval.first = leftDist(rng);
+        interval.second = interval.first + lengthDist(rng);
+    }
+    return intervals;
+}
+
+// Intervals nested into each other, added from the innermost one: every addition
+// extends the only interval of the set.
+vector<std::pair<int, int>> nestedIntervals(std::size_t count) {
+    vector<std::pair<int, int>> intervals(count);
+    const int n = static_cast<int>(count);
+    for (int i = 0; i < n; ++i)
+        intervals[i] = std::make_pair(n - i, n + i);
+    return intervals;
+}
+
+// Disjoint short intervals that are then swallowed by a few long ones.
+vector<std::pair<int, int>> intervalsWithLargeMerges(std::size_t count) {
+    vector<std::pair<int, int>> intervals;
+    const int n = static_cast<int>(count);
+    for (int i = 0; i < n - n / 100; ++i)
+        intervals.emplace_back(4 * i, 4 * i + 1);
+    for (int i = 0; i < n / 100; ++i)
+        intervals.emplace_back(400 * i, 400 * i + 398);
+    return intervals;
+}
+
+template<typename Intervals>
+std::function<void()> addIntervals(Intervals intervals) {
+    return [intervals] {
+        IntervalSet<int> set;
+        for (const auto& interval : intervals)
+            set.add(interval.first, interval.second);
+        checksum += std::distance(set.begin(), set.end());
+    };
+}
+
+std::function<void()> queryIntervals(std::size_t numIntervals, std::size_t numQueries) {
+    auto set = std::make_shared<IntervalSet<int>>();
+    for (const auto& interval : randomIntervals(numIntervals, 10 * (int)numIntervals, 4))
+        set->add(interval.first, interval.second);
+    auto queries = randomIntervals(numQueries, 10 * (int)numIntervals, 4);
+    return [set, queries] {
+        for (const auto& query : queries)
+            checksum += set->intersects(query.first, query.second);
+    };
+}
+
+// A SourceManager with a main file and a file 'included' in the middle of it.
+class SourceManagerFixture {
+public:
+    explicit SourceManagerFixture(std::size_t fileSize)
+        : fileManager(clang::FileSystemOptions())
+        , diagnostics(new clang::DiagnosticIDs(), new clang::DiagnosticOptions(),
+                      new clang::IgnoringDiagConsumer())
+        , sourceManager(diagnostics, fileManager)
+    {
+        mainFileText = makeText(fileSize);
+        headerText = makeText(fileSize);
+        mainFile = sourceManager.createFileID(
+            llvm::MemoryBuffer::getMemBuffer(mainFileText, "main.cpp"));
+        sourceManager.setMainFileID(mainFile);
+        const clang::SourceLocation includeLoc =
+            sourceManager.getLocForStartOfFile(mainFile).getLocWithOffset((unsigned)fileSize / 2);
+        headerFile = sourceManager.createFileID(
+            llvm::MemoryBuffer::getMemBuffer(headerText, "header.h"),
+            clang::SrcMgr::C_User, 0, 0, includeLoc);
+    }
+
+    // Random locations in the main file, or in both files.
+    vector<clang::SourceLocation> randomLocations(std::size_t count, bool includeHeader) const {
+        std::mt19937 rng(SEED);
+        std::uniform_int_distribution<unsigned> offsetDist(0, (unsigned)mainFileText.size() - 1);
+        std::bernoulli_distribution inHeader(includeHeader ? 0.5 : 0.0);
+        vector<clang::SourceLocation> locations(count);
+        for (auto& loc : locations) {
+            clang::FileID fileID = inHeader(rng) ? headerFile : mainFile;
+            loc = sourceManager.getLocForStartOfFile(fileID).getLocWithOffset(offsetDist(rng));
+        }
+        return locations;
+    }
+
+    const clang::SourceManager& getSourceManager() const { return sourceManager; }
+
+private:
+    static string makeText(std::size_t size) {
+        string text(size, ' ');
+        for (std::size_t i = 79; i < size; i += 80)
+            text[i] = '\n';
+        return text;
+    }
+
+    clang::FileManager fileManager;
+    clang::DiagnosticsEngine diagnostics;
+    clang::SourceManager sourceManager;
+    string mainFileText;
+    string headerText;
+    clang::FileID mainFile;
+    clang::FileID headerFile;
+};
+
+std::function<void()> compareLocations(std::size_t numComparisons, bool includeHeader) {
+    auto fixture = std::make_shared<SourceManagerFixture>(1 << 20);
+    auto locations = fixture->randomLocations(numComparisons + 1, includeHeader);
+    return [fixture, locations] {
+        SourceLocationComparer isLess(fixture->getSourceManager());
+        for (std::size_t i = 0; i + 1 < locations.size(); ++i)
+            checksum += isLess(locations[i], locations[i + 1]);
+    };
+}
+
+std::function<void()> addLocationIntervals(std::size_t count) {
+    auto fixture = std::make_shared<SourceManagerFixture>(1 << 20);
+    auto locations = fixture->randomLocations(2 * count, false);
+    return [fixture, locations] {
+        SourceLocationComparer isLess(fixture->getSourceManager());
+        IntervalSet<clang::SourceLocation, SourceLocationComparer> set(isLess);
+        for (std::size_t i = 0; i + 1 < locations.size(); i += 2) {
+            clang::SourceLocation left = locations[i], right = locations[i + 1];
+            if (isLess(right, left))
+                std::swap(left, right);
+            set.add(left, right);
+        }
+        checksum += std::distance(set.begin(), set.end());
+    };
+}
+
+// Text resembling the result of the optimizer stage: code lines interleaved with runs of
+// empty lines left by removed code, and occasional directives.
+string makeSourceText(std::size_t numLines) {
+    std::mt19937 rng(SEED);
+    std::uniform_int_distribution<int> kind(0, 99);
+    std::ostringstream text;
+    for (std::size_t i = 0; i < numLines; ++i) {
+        int k = kind(rng);
+        if (k < 40)
+            text << '\n';
+        else if (k < 45)
+            text << "   \t \n";
+        else if (k < 46)
+            text << "#pragma once\n";
+        else if (k < 47)
+            text << "# line 42 \"file.h\"\n";
+        else
+            text << "    for (int i = 0; i < n; ++i) result += values[i] * weights[i];\n";
+    }
+    return text.str();
+}
+
+std::function<void()> appendWithoutInvalidDirectives(std::size_t numLines) {
+    string text = makeSourceText(numLines);
+    return [text] {
+        string out;
+        caide::internal::SourceMap sourceMap;
+        const std::uint32_t file = sourceMap.addFile("file.h");
+        caide::internal::appendWithoutInvalidDirectives(text.data(), text.data(), text.data() + text.size(),
+            file, out, sourceMap);
+        checksum += out.size() + sourceMap.getSegments().size();
+    };
+}
+
+// Mapping of compilation error locations.
+std::function<void()> sourceMapLookup(std::size_t numSegments, std::size_t numLookups) {
+    auto sourceMap = std::make_shared<caide::internal::SourceMap>();
+    std::mt19937 rng(SEED);
+    std::uniform_int_distribution<std::uint32_t> fileDist(0, 19);
+    std::uniform_int_distribution<std::uint64_t> lengthDist(1, 200);
+    for (int i = 0; i < 20; ++i)
+        sourceMap->addFile("file" + std::to_string(i) + ".h");
+    std::uint64_t outputOffset = 0;
+    for (std::size_t i = 0; i < numSegments; ++i) {
+        sourceMap->addSegment(outputOffset, fileDist(rng), lengthDist(rng) * 100);
+        outputOffset += lengthDist(rng);
+    }
+
+    std::uniform_int_distribution<std::uint64_t> offsetDist(0, outputOffset);
+    auto offsets = std::make_shared<vector<std::uint64_t>>();
+    for (std::size_t i = 0; i < numLookups; ++i)
+        offsets->push_back(offsetDist(rng));
+
+    return [sourceMap, offsets] {
+        string path;
+        std::uint64_t fileOffset = 0;
+        for (std::uint64_t offset : *offsets) {
+            if (sourceMap->lookup(offset, path, fileOffset))
+                checksum += fileOffset;
+        }
+    };
+}
+
+std::function<void()> removeEmptyLines(std::size_t numLines) {
+    string text = makeSourceText(numLines);
+    return [text] {
+        std::ostringstream out;
+        caide::internal::removeEmptyLines(text, 2, out);
+        checksum += out.str().size();
+    };
+}
+
+struct Node {
+    int id;
+};
+
+// A random graph resembling a dependency graph: most edges go to 'nearby' nodes
+// (same class or namespace), some go to a small set of hubs (common base classes, std types).
+std::function<void()> bfs(std::size_t numNodes, std::size_t averageDegree) {
+    auto nodes = std::make_shared<vector<Node>>(numNodes);
+    for (std::size_t i = 0; i < numNodes; ++i)
+        (*nodes)[i].id = (int)i;
+
+    auto graph = std::make_shared<std::map<Node*, std::set<Node*>>>();
+    std::mt19937 rng(SEED);
+    std::uniform_int_distribution<std::size_t> degreeDist(0, 2 * averageDegree);
+    std::uniform_int_distribution<int> nearDist(-50, 50);
+    std::uniform_int_distribution<std::size_t> hubDist(0, numNodes / 100);
+    std::bernoulli_distribution toHub(0.2);
+    for (std::size_t i = 0; i < numNodes; ++i) {
+        std::size_t degree = degreeDist(rng);
+        for (std::size_t j = 0; j < degree; ++j) {
+            std::size_t to = toHub(rng) ? hubDist(rng)
+                : (std::size_t)std::min<long long>((long long)numNodes - 1,
+                        std::max<long long>(0, (long long)i + nearDist(rng)));
+            (*graph)[&(*nodes)[i]].insert(&(*nodes)[to]);
+        }
+    }
+
+    vector<Node*> roots;
+    for (std::size_t i = 0; i < numNodes; i += numNodes / 10)
+        roots.push_back(&(*nodes)[i]);
+
+    return [nodes, graph, roots] {
+        auto reachable = caide::internal::findReachable<Node*>(*graph, roots);
+        checksum += reachable.size();
+    };
+}
+
+vector<Benchmark> allBenchmarks() {
+    const std::size_t N = 100000;
+    return {
+        {"IntervalSet::add/random", N, [=] { return addIntervals(randomIntervals(N, 10 * N, 20)); }},
+        {"IntervalSet::add/sorted", N, [=] {
+            auto intervals = randomIntervals(N, 10 * N, 20);
+            std::sort(intervals.begin(), intervals.end());
+            return addIntervals(intervals);
+        }},
+        {"IntervalSet::add/nested", N, [=] { return addIntervals(nestedIntervals(N)); }},
+        {"IntervalSet::add/large-merges", N, [=] { return addIntervals(intervalsWithLargeMerges(N)); }},
+        {"IntervalSet::intersects", N, [=] { return queryIntervals(N, N); }},
+        {"SourceLocationComparer/same-file", N, [=] { return compareLocations(N, false); }},
+        {"SourceLocationComparer/two-files", N, [=] { return compareLocations(N, true); }},
+        {"IntervalSet<SourceLocation>::add/random", N, [=] { return addLocationIntervals(N); }},
+        {"appendWithoutInvalidDirectives", N, [=] { return appendWithoutInvalidDirectives(N); }},
+        {"SourceMap::lookup", N, [=] { return sourceMapLookup(N, N); }},
+        {"removeEmptyLines", N, [=] { return removeEmptyLines(N); }},
+        {"findReachable/100k-nodes", N, [=] { return bfs(N, 5); }},
+    };
+}
+
+double toMilliseconds(Clock::duration d) {
+    return std::chrono::duration<double, std::milli>(d).count();
+}
+
+} // anonymous namespace
+
+
+int main(int argc, char* argv[]) {
+    string filter;
+    int repetitions = 7;
+    for (int i = 1; i < argc; ++i) {
+        const string arg = argv[i];
+        if (arg == "--filter" && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (arg == "--repetitions" && i + 1 < argc) {
+            repetitions = std::max(1, std::atoi(argv[++i]));
+        } else {
+            std::cerr << "Usage: micro-bench [--filter <substring>] [--repetitions <N>]\n";
+            return 1;
+        }
+    }
+
+    std::cout << std::left << std::setw(42) << "benchmark"
+        << std::right << std::setw(12) << "median ms" << std::setw(12) << "min ms"
+        << std::setw(12) << "ns/op" << "\n";
+
+    for (const Benchmark& benchmark : allBenchmarks()) {
+        if (benchmark.name.find(filter) == string::npos)
+            continue;
+
+        std::function<void()> run = benchmark.prepare();
+        // Warm up caches and the allocator.
+        run();
+
+        vector<double> times;
+        for (int i = 0; i < repetitions; ++i) {
+            Clock::time_point start = Clock::now();
+            run();
+            times.push_back(toMilliseconds(Clock::now() - start));
+        }
+        std::sort(times.begin(), times.end());
+        const double median = times[times.size() / 2];
+
+        std::cout << std::left << std::setw(42) << benchmark.name
+            << std::right << std::fixed << std::setprecision(3)
+            << std::setw(12) << median << std::setw(12) << times.front()
+            << std::setprecision(1)
+            << std::setw(12) << median * 1e6 / benchmark.numOperations << "\n";
+    }
+
+    std::cerr << "checksum: " << checksum << "\n";
+    return 0;
+}
+
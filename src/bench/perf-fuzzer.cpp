@@ -0,0 +1,440 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+// Performance fuzzer. Mutates C++ programs (test cases and the output of the scaling
+// generator), runs the inliner on them and measures time of each stage relative to input
+// size. Mutants whose additional time per additional input byte exceeds a threshold are
+// saved as reproducers in the test case format (1.cpp + clangOptions.txt), together with
+// a report of stage timings.
+//
+// Usage:
+//   perf-fuzzer <temp-directory> <compilation-options-file> <reproducer-directory>
+//       [--iterations <N>] [--seed <S>] [--threshold <microseconds-per-byte>]
+//       [--min-slowdown <ms>] [<test-directory>...]
+//   perf-fuzzer --generate <family> <scale>
+//
+// <compilation-options-file> has the same format as for test-tool; generate it with
+// 'test-tool <temp-directory> --prepare <file>'. Inputs that fail to compile are skipped.
+
+#include "generator.h"
+#include "../caideInliner.hpp"
+
+#include <llvm/Support/FileSystem.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+using caide::InlinerStatistics;
+using caide::bench::Family;
+using std::string;
+using std::vector;
+
+namespace {
+
+struct Settings {
+    string tempDirectory;
+    string reproducerDirectory;
+    vector<string> clangOptions;
+    int iterations = 200;
+    std::uint32_t seed = 20240101;
+    // Reproducer is saved when (extra time) / (extra bytes) exceeds this.
+    double thresholdMicrosecondsPerByte = 50;
+    // ...and the extra time is at least this, to filter out noise.
+    double minSlowdownMs = 200;
+};
+
+struct Program {
+    string name;
+    string text;
+    // Options specific to the program, in addition to Settings::clangOptions
+    vector<string> options;
+};
+
+struct Measurement {
+    double totalMs = 0;
+    InlinerStatistics statistics;
+};
+
+struct PoolEntry {
+    Program program;
+    Measurement measurement;
+};
+
+vector<string> readNonEmptyLines(const string& filePath) {
+    vector<string> lines;
+    std::ifstream file{filePath.c_str()};
+    string line;
+    while (std::getline(file, line)) {
+        if (line.find_first_not_of(" \t\r\n") != string::npos)
+            lines.push_back(line);
+    }
+    return lines;
+}
+
+void writeFile(const string& filePath, const string& contents) {
+    std::ofstream file{filePath.c_str(), std::ios::binary};
+    if (!file)
+        throw std::runtime_error("Couldn't write " + filePath);
+    file << contents;
+}
+
+string pathConcat(const string& directory, const string& fileName) {
+    return directory + "/" + fileName;
+}
+
+string baseName(const string& path) {
+    string p = path;
+    while (!p.empty() && (p.back() == '/' || p.back() == '\\'))
+        p.pop_back();
+    auto slash = p.find_last_of("/\\");
+    return slash == string::npos ? p : p.substr(slash + 1);
+}
+
+// Loads a test case as a single program: source files are concatenated like the inliner does.
+bool loadTestCase(const string& testDirectory, Program& program) {
+    program.name = baseName(testDirectory);
+    program.text.clear();
+    for (int i = 1; i <= 9; ++i) {
+        std::ostringstream fileName;
+        fileName << i << ".cpp";
+        std::ifstream file{pathConcat(testDirectory, fileName.str()).c_str()};
+        if (!file)
+            continue;
+        std::ostringstream contents;
+        contents << file.rdbuf();
+        program.text += contents.str();
+        program.text += '\n';
+    }
+    if (program.text.empty())
+        return false;
+
+    // The mutant is written elsewhere; let quoted includes still find headers of the test.
+    program.options = {"-I", testDirectory};
+    for (string opt : readNonEmptyLines(pathConcat(testDirectory, "clangOptions.txt"))) {
+        const static string TEST_ROOT_MARKER = "TEST_ROOT";
+        auto p = opt.find(TEST_ROOT_MARKER);
+        if (p != string::npos)
+            opt.replace(p, TEST_ROOT_MARKER.length(), testDirectory);
+        program.options.push_back(std::move(opt));
+    }
+    return true;
+}
+
+// Returns false if the inliner failed on the program.
+bool measure(const Settings& settings, const Program& program, Measurement& measurement) {
+    caide::CppInliner inliner{settings.tempDirectory};
+    inliner.clangCompilationOptions = settings.clangOptions;
+    inliner.clangCompilationOptions.insert(inliner.clangCompilationOptions.end(),
+        program.options.begin(), program.options.end());
+
+    const string inputPath = pathConcat(settings.tempDirectory, "fuzz-input.cpp");
+    const string outputPath = pathConcat(settings.tempDirectory, "fuzz-output.cpp");
+    writeFile(inputPath, program.text);
+
+    try {
+        inliner.inlineCode({inputPath}, outputPath, measurement.statistics);
+    } catch (const std::exception&) {
+        return false;
+    }
+
+    measurement.totalMs = 0;
+    for (const auto& stage : measurement.statistics.stages) {
+        if (stage.depth == 0)
+            measurement.totalMs += stage.milliseconds;
+    }
+    return true;
+}
+
+double microsecondsPerByte(double ms, double bytes) {
+    return ms * 1000.0 / std::max(bytes, 1.0);
+}
+
+string formatReport(const Measurement& m, const Measurement& parent) {
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(1);
+    out << "input bytes: " << m.statistics.inputBytes
+        << " (parent: " << parent.statistics.inputBytes << ")\n";
+    out << "total ms: " << m.totalMs << " (parent: " << parent.totalMs << ")\n\n";
+    out << "stage                                     ms    us/byte\n";
+    for (const auto& stage : m.statistics.stages) {
+        string name = string(2 * stage.depth, ' ') + stage.name;
+        out << std::left << std::setw(36) << name << std::right
+            << std::setw(10) << stage.milliseconds
+            << std::setw(11) << microsecondsPerByte(stage.milliseconds, m.statistics.inputBytes)
+            << '\n';
+    }
+    if (!m.statistics.counters.empty())
+        out << '\n';
+    for (const auto& counter : m.statistics.counters)
+        out << counter.first << ": " << counter.second << '\n';
+    return out.str();
+}
+
+void saveReproducer(const Settings& settings, const Program& program,
+                    const Measurement& m, const Measurement& parent)
+{
+    std::ostringstream name;
+    name << program.name << '-' << std::hex << std::hash<string>()(program.text);
+    const string directory = pathConcat(settings.reproducerDirectory, name.str());
+    if (llvm::sys::fs::create_directories(directory))
+        throw std::runtime_error("Couldn't create " + directory);
+
+    writeFile(pathConcat(directory, "1.cpp"), program.text);
+    std::ostringstream options;
+    for (const string& opt : program.options)
+        options << opt << '\n';
+    writeFile(pathConcat(directory, "clangOptions.txt"), options.str());
+    writeFile(pathConcat(directory, "report.txt"), formatReport(m, parent));
+
+    std::cout << "Saved reproducer " << directory << '\n';
+}
+
+vector<string> splitLines(const string& text) {
+    vector<string> lines;
+    std::istringstream in(text);
+    string line;
+    while (std::getline(in, line))
+        lines.push_back(line);
+    return lines;
+}
+
+string joinLines(const vector<string>& lines) {
+    string text;
+    for (const string& line : lines) {
+        text += line;
+        text += '\n';
+    }
+    return text;
+}
+
+class Mutator {
+public:
+    explicit Mutator(std::uint32_t seed)
+        : rng(seed)
+    {}
+
+    Program mutate(const Program& parent) {
+        Program mutant = parent;
+        vector<string> lines = splitLines(parent.text);
+        if (lines.empty())
+            lines.push_back(string());
+
+        switch (uniform(0, 4)) {
+            case 0:
+            case 1: {
+                // Generated code is more likely to compile, so it is chosen more often.
+                const auto& families = caide::bench::allFamilies();
+                Family family = families[uniform(0, (int)families.size() - 1)];
+                int scale = logUniform(caide::bench::maxScale(family));
+                std::ostringstream entryPoint;
+                entryPoint << "caide_fuzz" << counter++;
+                lines.push_back(caide::bench::generateSnippet(family, scale, entryPoint.str()));
+                mutant.name = parent.name + "+" + caide::bench::familyName(family);
+                break;
+            }
+            case 2: {
+                std::size_t i = randomLine(lines);
+                int copies = logUniform(64);
+                lines.insert(lines.begin() + i, copies, lines[i]);
+                break;
+            }
+            case 3: {
+                std::size_t first = randomLine(lines);
+                std::size_t last = first + uniform(0, (int)std::min<std::size_t>(lines.size() - first - 1, 20));
+                int depth = logUniform(256);
+                lines.insert(lines.begin() + last + 1, depth, "#endif");
+                lines.insert(lines.begin() + first, depth, "#if 1");
+                break;
+            }
+            case 4: {
+                lines.erase(lines.begin() + randomLine(lines));
+                break;
+            }
+        }
+
+        mutant.text = joinLines(lines);
+        return mutant;
+    }
+
+    template<typename T>
+    const T& pick(const vector<T>& v) {
+        return v[uniform(0, (int)v.size() - 1)];
+    }
+
+    int uniform(int from, int to) {
+        return std::uniform_int_distribution<int>(from, to)(rng);
+    }
+
+private:
+    // Small values are more likely, but large ones are tried too.
+    int logUniform(int maxValue) {
+        double exponent = std::uniform_real_distribution<double>(0, std::log(maxValue))(rng);
+        return std::max(1, (int)std::exp(exponent));
+    }
+
+    std::size_t randomLine(const vector<string>& lines) {
+        return (std::size_t)uniform(0, (int)lines.size() - 1);
+    }
+
+    std::mt19937 rng;
+    int counter = 0;
+};
+
+const std::size_t MAX_POOL_SIZE = 64;
+
+int fuzz(const Settings& settings, const vector<string>& testDirectories) {
+    vector<Program> seeds;
+    for (const string& dir : testDirectories) {
+        Program program;
+        if (loadTestCase(dir, program))
+            seeds.push_back(std::move(program));
+        else
+            std::cerr << "No source files in " << dir << "\n";
+    }
+    for (Family family : caide::bench::allFamilies()) {
+        Program program;
+        program.name = caide::bench::familyName(family);
+        program.text = caide::bench::generateProgram(family, 8);
+        seeds.push_back(std::move(program));
+    }
+
+    vector<PoolEntry> pool;
+    for (const Program& seed : seeds) {
+        PoolEntry entry{seed, Measurement{}};
+        if (measure(settings, seed, entry.measurement))
+            pool.push_back(std::move(entry));
+        else
+            std::cerr << "Skipping seed " << seed.name << ": inliner failed\n";
+    }
+    if (pool.empty()) {
+        std::cerr << "No usable seeds\n";
+        return 1;
+    }
+
+    Mutator mutator(settings.seed);
+    int numCompiled = 0;
+    int numReproducers = 0;
+    for (int iteration = 0; iteration < settings.iterations; ++iteration) {
+        const PoolEntry& parent = mutator.pick(pool);
+        Program mutant = mutator.mutate(parent.program);
+
+        Measurement m;
+        if (!measure(settings, mutant, m))
+            continue;
+        ++numCompiled;
+
+        const double extraMs = m.totalMs - parent.measurement.totalMs;
+        const double extraBytes = (double)m.statistics.inputBytes - (double)parent.measurement.statistics.inputBytes;
+        const double score = microsecondsPerByte(extraMs, extraBytes);
+
+        if (extraMs >= settings.minSlowdownMs && score >= settings.thresholdMicrosecondsPerByte) {
+            // Confirm with another run to rule out a hiccup of the machine.
+            Measurement again;
+            if (measure(settings, mutant, again) && again.totalMs < m.totalMs)
+                m = again;
+            const double confirmedExtraMs = m.totalMs - parent.measurement.totalMs;
+            if (confirmedExtraMs >= settings.minSlowdownMs &&
+                microsecondsPerByte(confirmedExtraMs, extraBytes) >= settings.thresholdMicrosecondsPerByte)
+            {
+                saveReproducer(settings, mutant, m, parent.measurement);
+                ++numReproducers;
+            }
+        }
+
+        // Keep mutants that are relatively slower than their parents for further mutation.
+        const double parentRatio = microsecondsPerByte(parent.measurement.totalMs,
+                                                       parent.measurement.statistics.inputBytes);
+        if (microsecondsPerByte(m.totalMs, m.statistics.inputBytes) > parentRatio) {
+            PoolEntry entry{std::move(mutant), std::move(m)};
+            if (pool.size() < MAX_POOL_SIZE)
+                pool.push_back(std::move(entry));
+            else
+                pool[mutator.uniform(0, (int)pool.size() - 1)] = std::move(entry);
+        }
+
+        if ((iteration + 1) % 10 == 0) {
+            std::cerr << (iteration + 1) << " iterations, " << numCompiled << " compiled, "
+                      << numReproducers << " reproducers\n";
+        }
+    }
+
+    std::cout << numReproducers << " reproducer(s) saved\n";
+    return 0;
+}
+
+void usage() {
+    std::cerr << "Usage:\n"
+        << "  perf-fuzzer <temp-directory> <compilation-options-file> <reproducer-directory>\n"
+        << "      [--iterations <N>] [--seed <S>] [--threshold <microseconds-per-byte>]\n"
+        << "      [--min-slowdown <ms>] [<test-directory>...]\n"
+        << "  perf-fuzzer --generate <family> <scale>\n"
+        << "Families:";
+    for (Family family : caide::bench::allFamilies())
+        std::cerr << ' ' << caide::bench::familyName(family);
+    std::cerr << '\n';
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    if (argc == 4 && string(argv[1]) == "--generate") {
+        Family family;
+        if (!caide::bench::parseFamily(argv[2], family)) {
+            usage();
+            return 1;
+        }
+        std::cout << caide::bench::generateProgram(family, std::atoi(argv[3]));
+        return 0;
+    }
+
+    if (argc < 4) {
+        usage();
+        return 1;
+    }
+
+    Settings settings;
+    settings.tempDirectory = argv[1];
+    settings.clangOptions = readNonEmptyLines(argv[2]);
+    settings.reproducerDirectory = argv[3];
+
+    vector<string> testDirectories;
+    for (int i = 4; i < argc; ++i) {
+        const string arg = argv[i];
+        if (i + 1 < argc && arg == "--iterations")
+            settings.iterations = std::atoi(argv[++i]);
+        else if (i + 1 < argc && arg == "--seed")
+            settings.seed = (std::uint32_t)std::strtoul(argv[++i], nullptr, 10);
+        else if (i + 1 < argc && arg == "--threshold")
+            settings.thresholdMicrosecondsPerByte = std::atof(argv[++i]);
+        else if (i + 1 < argc && arg == "--min-slowdown")
+            settings.minSlowdownMs = std::atof(argv[++i]);
+        else if (!arg.empty() && arg[0] == '-') {
+            usage();
+            return 1;
+        } else
+            testDirectories.push_back(arg);
+    }
+
+    try {
+        return fuzz(settings, testDirectories);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+}
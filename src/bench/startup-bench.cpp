@@ -0,0 +1,174 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+// Benchmark of process startup: for small inputs, the fixed cost of starting the cmd
+// binary is a large share of the latency of a request.
+//
+// Usage:
+//   startup-bench <path-to-cmd> <temp-directory> [--repetitions <N>] [-- <clang options>]
+//
+// Runs 'cmd <clang options> -- -d <temp-directory> --startup-probe' as a child process
+// N times and reports medians of:
+//
+//   process          wall clock time from spawning the process to its exit
+//   outside main     time before main and after it returns: exec, dynamic linking
+//                    (significant with CAIDE_LINK_LLVM_DYLIB/CAIDE_LINK_CLANG_DYLIB),
+//                    static initializers, static destructors
+//   static init      static initializers of the executable and of statically linked
+//                    libraries (part of 'outside main')
+//   first run        first run of the inliner on a trivial program without includes:
+//                    creation of a compiler instance, target and diagnostics setup,
+//                    and processing up to and past the first preprocessor token
+//
+// Linux and macOS only.
+
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+extern char** environ;
+
+using std::string;
+using std::vector;
+
+namespace {
+
+struct Settings {
+    string cmdPath;
+    string tempDirectory;
+    vector<string> clangOptions;
+    int repetitions = 20;
+};
+
+double median(vector<double> values) {
+    if (values.empty())
+        return 0;
+    std::sort(values.begin(), values.end());
+    const std::size_t n = values.size();
+    return n % 2 == 1 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+}
+
+// Runs the command and returns its standard output.
+string runProcess(const vector<string>& args, double& milliseconds) {
+    vector<char*> argv;
+    for (const string& arg : args)
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    argv.push_back(nullptr);
+
+    int pipeFds[2];
+    if (pipe(pipeFds) != 0)
+        throw std::runtime_error("pipe() failed");
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, pipeFds[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addclose(&actions, pipeFds[0]);
+    posix_spawn_file_actions_addclose(&actions, pipeFds[1]);
+
+    const auto start = std::chrono::steady_clock::now();
+    pid_t pid = 0;
+    const int spawnError = posix_spawn(&pid, argv[0], &actions, nullptr, argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(pipeFds[1]);
+    if (spawnError != 0) {
+        close(pipeFds[0]);
+        throw std::runtime_error("Couldn't run " + args[0]);
+    }
+
+    string output;
+    char buffer[4096];
+    ssize_t n = 0;
+    while ((n = read(pipeFds[0], buffer, sizeof(buffer))) > 0)
+        output.append(buffer, n);
+    close(pipeFds[0]);
+
+    int status = 0;
+    waitpid(pid, &status, 0);
+    milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        throw std::runtime_error(args[0] + " failed");
+    return output;
+}
+
+// Extracts a number from the flat JSON object printed by the probe.
+double getField(const string& json, const string& name) {
+    const string key = "\"" + name + "\":";
+    const std::size_t pos = json.find(key);
+    if (pos == string::npos)
+        throw std::runtime_error("Unexpected output of the probe: " + json);
+    return std::atof(json.c_str() + pos + key.size());
+}
+
+int run(const Settings& settings) {
+    vector<string> args{settings.cmdPath};
+    args.insert(args.end(), settings.clangOptions.begin(), settings.clangOptions.end());
+    args.insert(args.end(), {"--", "-d", settings.tempDirectory, "--startup-probe"});
+
+    // Warmup run: fills the OS file cache for the binary and shared libraries.
+    double milliseconds = 0;
+    runProcess(args, milliseconds);
+
+    std::map<string, vector<double>> measurements;
+    for (int rep = 0; rep < settings.repetitions; ++rep) {
+        const string output = runProcess(args, milliseconds);
+        const double mainMilliseconds = getField(output, "mainMs");
+        measurements["process"].push_back(milliseconds);
+        measurements["outside main"].push_back(milliseconds - mainMilliseconds);
+        measurements["static init"].push_back(getField(output, "staticInitMs"));
+        measurements["first run"].push_back(getField(output, "firstRunMs"));
+    }
+
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "Median time, ms (" << settings.repetitions << " repetitions)\n\n";
+    for (const char* name : {"process", "outside main", "static init", "first run"})
+        std::cout << std::left << std::setw(20) << name << std::right << std::setw(10)
+                  << median(measurements[name]) << '\n';
+    return 0;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        std::cerr << "Usage: startup-bench <path-to-cmd> <temp-directory>"
+                     " [--repetitions <N>] [-- <clang options>]\n";
+        return 1;
+    }
+
+    Settings settings;
+    settings.cmdPath = argv[1];
+    settings.tempDirectory = argv[2];
+
+    for (int i = 3; i < argc; ++i) {
+        const string arg = argv[i];
+        if (i + 1 < argc && arg == "--repetitions") {
+            settings.repetitions = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--") {
+            settings.clangOptions.assign(argv + i + 1, argv + argc);
+            break;
+        } else {
+            std::cerr << "Unknown argument: " << arg << "\n";
+            return 1;
+        }
+    }
+
+    try {
+        return run(settings);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+}
@@ -7,20 +7,45 @@
 #include "caideInliner.hpp"
 #include "caideInliner.h"
 
+#include "Budget.h"
+#include "caide_trace.h"
+#include "CacheArchive.h"
+#include "ConcatenatedFile.h"
+#include "CostPredictor.h"
 #include "detect_options.h"
+#include "FileCache.h"
+#include "HeaderBundle.h"
 #include "inliner.h"
 #include "optimizer.h"
+#include "postprocess.h"
+#include "PrecompiledHeader.h"
+#include "SourceMap.h"
+#include "Timer.h"
+#include "verifier.h"
+
+#include <clang/Basic/FileManager.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/xxhash.h>
 
 #include <algorithm>
-#include <limits>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
 #include <fstream>
+#include <iterator>
+#include <map>
+#include <mutex>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <system_error>
+#include <thread>
 #include <vector>
 
 
-using std::istringstream;
 using std::ofstream;
 using std::string;
 using std::vector;
@@ -28,6 +53,14 @@ using std::vector;
 
 namespace caide {
 
+LimitExceededError::LimitExceededError(const string& message, const string& limit_,
+                                       const InlinerStatistics& statistics_)
+    : std::runtime_error(message)
+    , limit(limit_)
+    , statistics(statistics_)
+{
+}
+
 static string trimEndPathSeparators(const string& path) {
     string result{path};
     auto lastSymbol = result.find_last_not_of("/\\");
@@ -36,10 +69,6 @@ static string trimEndPathSeparators(const string& path) {
     return result;
 }
 
-static bool startsWith(const string& s, const char* prefix) {
-    return s.rfind(prefix, 0) == 0;
-}
-
 CppInliner::CppInliner(const string& temporaryDirectory_)
     : clangCompilationOptions{}
     , macrosToKeep{"__cplusplus", "__STDC_VERSION__",
@@ -47,100 +76,681 @@ CppInliner::CppInliner(const string& temporaryDirectory_)
         "_WIN32", "_WIN64", "_M_AMD64", "__linux", "__linux__", "__APPLE__",
         "__GNUC__", "__GLIBC__", "__clang__", "_MSC_VER"}
     , maxConsequentEmptyLines{2}
+    , approximateDependencies{false}
+    , verifyOutput{false}
+    , writeSourceMap{false}
+    , canonicalIncludes{false}
+    , precompileSharedPrefix{false}
     , temporaryDirectory{trimEndPathSeparators(temporaryDirectory_)}
 {
 }
 
-static void concatFiles(const vector<string>& cppFilePaths, const string& outputFilePath) {
-    ofstream out{outputFilePath};
+static std::shared_ptr<internal::ConcatenatedFile> concatFiles(const vector<string>& cppFilePaths,
+        const string& outputFilePath, internal::SourceMap& sourceMap)
+{
+    auto concatenatedFile = std::make_shared<internal::ConcatenatedFile>(outputFilePath);
     for (const string& filePath : cppFilePaths) {
-        std::ifstream in{filePath};
-        if (!in)
-            throw std::runtime_error(string("File not found: " + filePath));
-        out << in.rdbuf();
-        out << '\n'; // in case there was no return at end of file
+        sourceMap.addSegment(concatenatedFile->getSize(), sourceMap.addFile(filePath), 0);
+        concatenatedFile->append(filePath);
+        sourceMap.addSegment(concatenatedFile->getSize(), internal::SourceMap::noFile, 0);
+        concatenatedFile->appendNewline(); // in case there was no return at end of file
     }
+    return concatenatedFile;
 }
 
-// Certain directives become invalid after the first stage (inliner) runs. Those include:
-// * #pragma once (used to be in a header, now in the inlined source file).
-// * #line number [file name] (became incorrect due to inlining header files).
-//
-// Ideally, the inliner would not emit these directives. However, it may be hard to do
-// with currently available clang API. Instead, we use a simplistic postprocessing that
-// should work in most cases.
-static bool isInvalidDirective(string line) {
-    auto it = std::remove_if(line.begin(), line.end(),
-                [](char c) { return c == ' ' || c == '\t' || c == '\r'; });
-    line.erase(it, line.end());
-    // This is technically incorrect due to multiline directives and strings.
-    return line == "#pragmaonce" || startsWith(line, "#line");
-}
-
-static void removeInvalidDirectives(const string& textInBinaryMode, const string& outputFilePath) {
-    istringstream in{textInBinaryMode};
-    ofstream out{outputFilePath, std::ios::binary};
-    string line;
-    while (std::getline(in, line)) {
-        if (!isInvalidDirective(line))
-            out << line << '\n';
+static string pathConcat(const string& path, const string& fileName) {
+    string result{path};
+    result.push_back('/');
+    result += fileName;
+    return result;
+}
+
+// Sidecar of an output file: '<hash of contents> <size> <modification time> <time of writing>',
+// as last checked by the inliner. While the file keeps this size and modification time, its
+// hash is taken from the sidecar instead of reading the file back.
+static const char* const OUTPUT_HASH_SUFFIX = ".hash";
+
+// Coarsest timestamp granularity of common file systems (FAT). A file modified again within
+// this time after the sidecar was written may keep its modification time, so such a sidecar
+// is 'racily clean' (as git calls it) and is not trusted.
+static const std::int64_t TIMESTAMP_GRANULARITY_NS = 2000000000;
+
+template <typename TimePoint>
+static std::int64_t toNanoseconds(TimePoint time) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+}
+
+static void writeSidecar(const string& filePath, std::uint64_t hash, const llvm::sys::fs::file_status& status) {
+    ofstream sidecar{filePath + OUTPUT_HASH_SUFFIX, std::ios::binary};
+    sidecar << std::hex << hash << std::dec << ' ' << status.getSize() << ' '
+            << toNanoseconds(status.getLastModificationTime()) << ' '
+            << toNanoseconds(std::chrono::system_clock::now()) << '\n';
+}
+
+static bool isSameOutput(const string& filePath, const string& contents, std::uint64_t hash) {
+    llvm::sys::fs::file_status status;
+    if (llvm::sys::fs::status(filePath, status) || status.getSize() != contents.size())
+        return false;
+
+    std::ifstream sidecar{filePath + OUTPUT_HASH_SUFFIX, std::ios::binary};
+    std::uint64_t storedHash = 0, storedSize = 0;
+    std::int64_t storedTime = 0, writtenTime = 0;
+    const std::int64_t modificationTime = toNanoseconds(status.getLastModificationTime());
+    if (sidecar >> std::hex >> storedHash >> std::dec >> storedSize >> storedTime >> writtenTime &&
+            storedSize == status.getSize() && storedTime == modificationTime &&
+            writtenTime - storedTime >= TIMESTAMP_GRANULARITY_NS)
+        return storedHash == hash;
+    sidecar.close();
+
+    // No sidecar, a racily clean one, or the file was modified by someone else: compare the
+    // contents, and record them if they match.
+    auto buffer = llvm::MemoryBuffer::getFile(filePath);
+    if (!buffer || (*buffer)->getBuffer() != contents)
+        return false;
+    writeSidecar(filePath, hash, status);
+    return true;
+}
+
+// Writes the file unless it already has these contents, so that its modification time
+// only changes together with the contents. Returns false if the file was left untouched.
+static bool writeIfChanged(const string& filePath, const string& contents) {
+    const std::uint64_t hash = llvm::xxHash64(contents);
+    if (isSameOutput(filePath, contents, hash))
+        return false;
+
+    // A sidecar that outlives a failed write must not describe the new contents.
+    llvm::sys::fs::remove(filePath + OUTPUT_HASH_SUFFIX);
+    {
+        ofstream out{filePath, std::ios::binary};
+        out << contents;
+        if (!out)
+            throw std::runtime_error("Couldn't write " + filePath);
     }
+    llvm::sys::fs::file_status status;
+    if (!llvm::sys::fs::status(filePath, status))
+        writeSidecar(filePath, hash, status);
+    return true;
 }
 
-static bool isWhitespaceOnly(const string& text) {
-    return text.find_first_not_of(" \t\r") == string::npos;
+// Stored in a header bundle to check that it is used with the same options.
+static string headerBundleDescription(const vector<string>& clangCompilationOptions) {
+    string description;
+    for (const string& option : clangCompilationOptions) {
+        description += option;
+        description += '\n';
+    }
+    return description;
 }
 
-static void removeEmptyLines(const string& textInBinaryMode,
-                             int maxConsequentEmptyLines,
-                             const string& outputFilePath)
+void CppInliner::inlineCode(const vector<string>& cppFilePaths, const string& outputFilePath) const {
+    InlinerStatistics statistics;
+    inlineCode(cppFilePaths, outputFilePath, statistics);
+}
+
+static void copyStatistics(const internal::StatisticsCollector& collector, InlinerStatistics& statistics) {
+    statistics.stages.clear();
+    for (const auto& stage : collector.getStages()) {
+        InlinerStatistics::Stage s;
+        s.name = stage.name;
+        s.depth = stage.depth;
+        s.milliseconds = std::chrono::duration<double, std::milli>(stage.duration).count();
+        s.allocations = stage.allocations.allocations;
+        s.allocatedBytes = stage.allocations.bytes;
+        statistics.stages.push_back(s);
+    }
+    statistics.counters.assign(collector.getCounters().begin(), collector.getCounters().end());
+}
+
+void CppInliner::inlineCode(const vector<string>& cppFilePaths, const string& outputFilePath,
+                            InlinerStatistics& statistics) const
 {
-    if (maxConsequentEmptyLines < 0)
-        maxConsequentEmptyLines = std::numeric_limits<int>::max();
-    istringstream in{textInBinaryMode};
-    ofstream out{outputFilePath, std::ios::binary};
-    int currentConsequentEmptyLines = 0;
-    bool readNonEmptyLine = false;
-    string line;
-    while (std::getline(in, line)) {
-        if (isWhitespaceOnly(line))
-            ++currentConsequentEmptyLines;
-        else {
-            currentConsequentEmptyLines = 0;
-            readNonEmptyLine = true;
+    inlineCode(cppFilePaths, outputFilePath, temporaryDirectory, PrecompiledPrefix{}, statistics);
+}
+
+void CppInliner::inlineCode(const vector<string>& cppFilePaths, const string& outputFilePath,
+                            const string& workingDirectory, const PrecompiledPrefix& precompiledPrefix,
+                            InlinerStatistics& statistics) const
+{
+    statistics = InlinerStatistics{};
+    internal::StatisticsCollector collector;
+
+    internal::BudgetLimits budgetLimits;
+    budgetLimits.wallMilliseconds = limits.wallMilliseconds;
+    budgetLimits.cpuMilliseconds = limits.cpuMilliseconds;
+    budgetLimits.megabytes = limits.megabytes;
+    budgetLimits.outputBytes = limits.outputBytes;
+    internal::Budget budget{budgetLimits};
+
+    // Statistics of the stages that did run are useful for failed runs too.
+    try {
+        doInlineCode(cppFilePaths, outputFilePath, workingDirectory, precompiledPrefix, statistics);
+    } catch (...) {
+        copyStatistics(collector, statistics);
+        // A stage stopped by an exceeded limit fails with its own error.
+        if (!budget.getExceededLimit().empty())
+            throw LimitExceededError(budget.getMessage(), budget.getExceededLimit(), statistics);
+        throw;
+    }
+    copyStatistics(collector, statistics);
+}
+
+// Throws if a limit of the current run is exceeded.
+static void checkLimits(unsigned long long outputBytes = 0) {
+    internal::Budget* budget = internal::Budget::current();
+    if (budget && budget->checkOutputSize(outputBytes))
+        throw std::runtime_error(budget->getMessage());
+}
+
+void CppInliner::doInlineCode(const vector<string>& cppFilePaths, const string& outputFilePath,
+                              const string& workingDirectory, const PrecompiledPrefix& precompiledPrefix,
+                              InlinerStatistics& statistics) const
+{
+    const string concatStage{pathConcat(workingDirectory, "concat.cpp")};
+    const string inlinedStage{pathConcat(workingDirectory, "inlined.cpp")};
+
+    internal::SourceMap concatSourceMap;
+    std::shared_ptr<internal::ConcatenatedFile> concatenatedFile;
+    {
+        internal::ScopedTimer timer("concatFiles");
+        CAIDE_TRACE1(concat_begin, cppFilePaths.size());
+        concatenatedFile = concatFiles(cppFilePaths, concatStage, concatSourceMap);
+        statistics.inputBytes = concatenatedFile->getSize();
+        CAIDE_TRACE1(concat_end, statistics.inputBytes);
+    }
+    checkLimits();
+
+    // Both stages read the same system headers; share file system state between them.
+    std::shared_ptr<const internal::HeaderBundle> bundle;
+    if (!headerBundle.empty()) {
+        bundle = internal::HeaderBundle::load(headerBundle);
+        if (bundle->getDescription() != headerBundleDescription(clangCompilationOptions))
+            throw std::runtime_error("Header bundle " + headerBundle +
+                " was built with different compilation options");
+    }
+
+    std::shared_ptr<internal::FileCache> fileCache = internal::FileCache::getProcessCache();
+    fileCache->beginRequest();
+    llvm::IntrusiveRefCntPtr<clang::FileManager> fileManager =
+        fileCache->createFileManager(workingDirectory, bundle, concatenatedFile);
+    if (!fileManager) {
+        // Clang reads the file from disk.
+        internal::ScopedTimer timer("concatFiles.write");
+        concatenatedFile->writeTo(concatStage);
+    }
+
+    internal::Inliner inliner{clangCompilationOptions, fileManager};
+    std::string inlinedCode{inliner.doInline(concatStage, &concatSourceMap)};
+    statistics.inlinedBytes = inlinedCode.size();
+    checkLimits();
+    {
+        ofstream out{inlinedStage, std::ios::binary};
+        out << inlinedCode;
+    }
+    const internal::SourceMap* inlinedSourceMap = &inliner.getSourceMap();
+
+    vector<string> optimizerOptions{inliner.getResultingCommandLineOptions()};
+    if (!moduleCacheDirectory.empty()) {
+        optimizerOptions.push_back("-fmodules");
+        optimizerOptions.push_back("-fimplicit-module-maps");
+        optimizerOptions.push_back("-fmodules-cache-path=" + moduleCacheDirectory);
+    }
+    if (!precompiledPrefix.pchPath.empty()) {
+        // The headers are included first by the program too, so loading them before the main
+        // file doesn't change its meaning; the include directives are then skipped by include guards.
+        optimizerOptions.push_back("-include-pch");
+        optimizerOptions.push_back(precompiledPrefix.pchPath);
+        internal::StatisticsCollector::count("precompiledPrefix.headers", precompiledPrefix.numHeaders);
+    }
+
+    internal::PreambleOptions preambleOptions;
+    preambleOptions.canonical = canonicalIncludes;
+    if (!includePrelude.empty()) {
+        std::ifstream in{includePrelude, std::ios::binary};
+        if (!in)
+            throw std::runtime_error("File not found: " + includePrelude);
+        preambleOptions.prelude.assign(std::istreambuf_iterator<char>{in}, std::istreambuf_iterator<char>{});
+    }
+
+    std::string onlyReachableCode;
+    // Maps onlyReachableCode to the original files.
+    internal::SourceMap optimizedSourceMap;
+    bool haveResult = false;
+    if (approximateDependencies) {
+        internal::Optimizer optimizer{optimizerOptions, macrosToKeep, identifiersToKeep, fileManager,
+                                      internal::DependencyAnalysis::Approximate, preambleOptions};
+        onlyReachableCode = optimizer.doOptimize(inlinedStage, inlinedSourceMap);
+        optimizedSourceMap = optimizer.getSourceMap();
+
+        const string approximateStage{pathConcat(workingDirectory, "approximate.cpp")};
+        {
+            ofstream out{approximateStage, std::ios::binary};
+            out << onlyReachableCode;
         }
+        internal::Verifier verifier{optimizerOptions, fileManager};
+        haveResult = verifier.check(approximateStage).empty();
+        checkLimits();
+        internal::StatisticsCollector::count("approximateDependencies.rejected", haveResult ? 0 : 1);
+    }
 
-        if (readNonEmptyLine && currentConsequentEmptyLines <= maxConsequentEmptyLines)
-            out << line << '\n';
+    if (!haveResult) {
+        internal::Optimizer optimizer{optimizerOptions, macrosToKeep, identifiersToKeep, fileManager,
+                                      internal::DependencyAnalysis::Exact, preambleOptions};
+        onlyReachableCode = optimizer.doOptimize(inlinedStage, inlinedSourceMap);
+        optimizedSourceMap = optimizer.getSourceMap();
+    }
+    checkLimits();
+
+    // Maps the output to the original files.
+    internal::SourceMap outputSourceMap;
+    {
+        internal::ScopedTimer timer("removeEmptyLines");
+        CAIDE_TRACE1(postprocess_begin, onlyReachableCode.size());
+        std::ostringstream out;
+        if (verifyOutput || writeSourceMap) {
+            const std::uint32_t optimizedFile = outputSourceMap.addFile(inlinedStage);
+            internal::removeEmptyLines(onlyReachableCode, maxConsequentEmptyLines, out,
+                                       optimizedFile, outputSourceMap);
+            outputSourceMap.resolveThrough(optimizedFile, optimizedSourceMap);
+        } else {
+            internal::removeEmptyLines(onlyReachableCode, maxConsequentEmptyLines, out);
+        }
+        onlyReachableCode = out.str();
+        statistics.outputBytes = onlyReachableCode.size();
+        CAIDE_TRACE1(postprocess_end, statistics.outputBytes);
+    }
+    checkLimits(statistics.outputBytes);
+    statistics.outputUnchanged = !writeIfChanged(outputFilePath, onlyReachableCode);
+    if (writeSourceMap) {
+        ofstream out{outputFilePath + ".map", std::ios::binary};
+        out << outputSourceMap.serialize();
+        if (!out)
+            throw std::runtime_error("Couldn't write " + outputFilePath + ".map");
+    }
+
+    if (verifyOutput) {
+        internal::Verifier verifier{optimizerOptions, fileManager};
+        vector<string> errors = verifier.check(outputFilePath, &outputSourceMap);
+        checkLimits(statistics.outputBytes);
+        internal::StatisticsCollector::count("verification.errors", errors.size());
+        if (!errors.empty()) {
+            string message = "Inlined code doesn't compile. The following compilation errors were detected: ";
+            for (const string& error : errors) {
+                message += error;
+                message.push_back('\n');
+            }
+            throw std::runtime_error(message);
+        }
     }
 }
 
-static string pathConcat(const string& path, const string& fileName) {
-    string result{path};
-    result.push_back('/');
-    result += fileName;
-    return result;
+// Identifies the inputs of a job by contents: the C++ files in order, followed by all user
+// files they include in the order of the first inclusion. Returns false if a file can't be read.
+static bool computeJobKey(const vector<string>& cppFilePaths, const vector<string>& clangOptions,
+                          std::uint64_t& key)
+{
+    vector<string> files{cppFilePaths};
+    const vector<string> userFiles = internal::collectUserFiles(cppFilePaths, clangOptions);
+    files.insert(files.end(), userFiles.begin(), userFiles.end());
+
+    string data;
+    for (const string& filePath : files) {
+        auto buffer = llvm::MemoryBuffer::getFile(filePath);
+        if (!buffer)
+            return false;
+        // Length prefix, so that different splits of the same text into files differ.
+        data += std::to_string((*buffer)->getBufferSize());
+        data.push_back('\n');
+        data.append((*buffer)->getBufferStart(), (*buffer)->getBufferEnd());
+    }
+    key = llvm::xxHash64(data);
+    return true;
 }
 
-void CppInliner::inlineCode(const vector<string>& cppFilePaths, const string& outputFilePath) const {
-    const string concatStage{pathConcat(temporaryDirectory, "concat.cpp")};
-    const string inlinedStage{pathConcat(temporaryDirectory, "inlined.cpp")};
+namespace {
+
+// The first job with a given key; duplicates wait until it is done.
+struct BatchLeader {
+    int index = -1;
+    bool done = false;
+};
+
+}
+
+vector<InlinerJobResult> CppInliner::inlineBatch(const vector<InlinerJob>& jobs, int numThreads) const {
+    if (numThreads <= 0)
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+    numThreads = std::min<int>(numThreads, std::max<std::size_t>(jobs.size(), 1));
 
-    concatFiles(cppFilePaths, concatStage);
+    const PrecompiledPrefix precompiledPrefix = buildPrecompiledPrefix(jobs);
 
-    internal::Inliner inliner{clangCompilationOptions};
-    std::string inlinedCode{inliner.doInline(concatStage)};
-    removeInvalidDirectives(inlinedCode, inlinedStage);
+    vector<InlinerJobResult> results(jobs.size());
+    std::atomic<std::size_t> nextJob{0};
+    std::mutex mutex;
+    std::condition_variable jobDone;
+    std::map<std::uint64_t, BatchLeader> leaders;
 
-    internal::Optimizer optimizer{inliner.getResultingCommandLineOptions(), macrosToKeep, identifiersToKeep};
-    std::string onlyReachableCode{optimizer.doOptimize(inlinedStage)};
-    removeEmptyLines(onlyReachableCode, maxConsequentEmptyLines, outputFilePath);
+    auto runJobs = [&](int worker) {
+        const string workingDirectory{pathConcat(temporaryDirectory, "worker-" + std::to_string(worker))};
+        const std::error_code directoryError = llvm::sys::fs::create_directories(workingDirectory);
+
+        for (std::size_t i = nextJob++; i < jobs.size(); i = nextJob++) {
+            const InlinerJob& job = jobs[i];
+            InlinerJobResult& result = results[i];
+            const auto start = std::chrono::steady_clock::now();
+
+            std::uint64_t key = 0;
+            const bool haveKey = computeJobKey(job.cppFilePaths, clangCompilationOptions, key);
+            BatchLeader* leader = nullptr;
+            if (haveKey) {
+                std::unique_lock<std::mutex> lock(mutex);
+                auto inserted = leaders.emplace(key, BatchLeader{});
+                leader = &inserted.first->second;
+                if (inserted.second) {
+                    leader->index = static_cast<int>(i);
+                } else {
+                    jobDone.wait(lock, [&] { return leader->done; });
+                    const InlinerJobResult& leaderResult = results[leader->index];
+                    result.duplicateOf = leader->index;
+                    result.error = leaderResult.error;
+                    result.statistics = leaderResult.statistics;
+                    leader = nullptr;
+                }
+            }
+
+            if (result.duplicateOf >= 0) {
+                const string& source = jobs[result.duplicateOf].outputFilePath;
+                if (result.error.empty() && source != job.outputFilePath) {
+                    auto buffer = llvm::MemoryBuffer::getFile(source);
+                    if (!buffer) {
+                        result.error = "Couldn't copy " + source + " to " + job.outputFilePath + ": " +
+                            buffer.getError().message();
+                    } else {
+                        try {
+                            result.statistics.outputUnchanged =
+                                !writeIfChanged(job.outputFilePath, (*buffer)->getBuffer().str());
+                        } catch (const std::exception& e) {
+                            result.error = e.what();
+                        }
+                    }
+                    if (result.error.empty() && writeSourceMap) {
+                        if (std::error_code error = llvm::sys::fs::copy_file(source + ".map",
+                                                                             job.outputFilePath + ".map"))
+                            result.error = "Couldn't copy " + source + ".map: " + error.message();
+                    }
+                }
+            } else if (directoryError) {
+                result.error = "Couldn't create " + workingDirectory + ": " + directoryError.message();
+            } else {
+                try {
+                    inlineCode(job.cppFilePaths, job.outputFilePath, workingDirectory, precompiledPrefix,
+                               result.statistics);
+                } catch (const std::exception& e) {
+                    result.error = e.what();
+                    if (result.error.empty())
+                        result.error = "Unknown error";
+                } catch (...) {
+                    result.error = "Unknown error";
+                }
+            }
+
+            result.milliseconds = std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - start).count();
+
+            if (leader) {
+                std::lock_guard<std::mutex> lock(mutex);
+                leader->done = true;
+                jobDone.notify_all();
+            }
+        }
+    };
+
+    vector<std::thread> workers;
+    for (int worker = 1; worker < numThreads; ++worker)
+        workers.emplace_back(runJobs, worker);
+    runJobs(0);
+    for (std::thread& worker : workers)
+        worker.join();
+
+    if (!precompiledPrefix.directory.empty())
+        llvm::sys::fs::remove_directories(precompiledPrefix.directory);
+
+    return results;
+}
+
+CppInliner::PrecompiledPrefix CppInliner::buildPrecompiledPrefix(const vector<InlinerJob>& jobs) const {
+    PrecompiledPrefix result;
+    if (!precompileSharedPrefix || jobs.size() < 2 || !moduleCacheDirectory.empty() ||
+            std::find(clangCompilationOptions.begin(), clangCompilationOptions.end(), "-include") !=
+                clangCompilationOptions.end())
+        return result;
+
+    // Longest common prefix of the system headers included at the beginning of each job.
+    vector<string> headers;
+    for (std::size_t i = 0; i < jobs.size(); ++i) {
+        if (jobs[i].cppFilePaths.empty())
+            return result;
+        const vector<string> jobHeaders =
+            internal::scanLeadingSystemIncludes(jobs[i].cppFilePaths.front(), clangCompilationOptions);
+        if (i == 0) {
+            headers = jobHeaders;
+        } else {
+            auto mismatch = std::mismatch(headers.begin(), headers.end(), jobHeaders.begin(), jobHeaders.end());
+            headers.erase(mismatch.first, headers.end());
+        }
+        if (headers.empty())
+            return result;
+    }
+
+    // A directory of its own, so that concurrent batches don't overwrite the precompiled
+    // header while jobs of another batch load it.
+    llvm::SmallString<256> directory;
+    if (llvm::sys::fs::createUniqueDirectory(pathConcat(temporaryDirectory, "shared-prefix"), directory))
+        return result;
+    result.directory.assign(directory.begin(), directory.end());
+
+    const string headerPath{pathConcat(result.directory, "shared-prefix.hpp")};
+    {
+        ofstream out{headerPath, std::ios::binary};
+        for (const string& header : headers)
+            out << "#include <" << header << ">\n";
+    }
+
+    // Use the same file system view as the jobs, so that the precompiled header is valid for them.
+    std::shared_ptr<const internal::HeaderBundle> bundle;
+    if (!headerBundle.empty()) {
+        try {
+            bundle = internal::HeaderBundle::load(headerBundle);
+        } catch (const std::exception&) {
+            // The jobs will report the error.
+            return result;
+        }
+    }
+    llvm::IntrusiveRefCntPtr<clang::FileManager> fileManager =
+        internal::FileCache::getProcessCache()->createFileManager(temporaryDirectory, bundle);
+
+    const string pchPath{headerPath + ".pch"};
+    if (internal::buildPrecompiledHeader(clangCompilationOptions, headerPath, pchPath, fileManager).empty()) {
+        result.pchPath = pchPath;
+        result.numHeaders = headers.size();
+    }
+    return result;
+}
+
+CostEstimate CppInliner::estimateCost(const vector<string>& cppFilePaths) const {
+    const internal::CostFeatures features = internal::scanCostFeatures(cppFilePaths, clangCompilationOptions);
+    const internal::CostModel model =
+        costModelFile.empty() ? internal::CostModel{} : internal::CostModel::load(costModelFile);
+
+    CostEstimate estimate;
+    estimate.milliseconds = model.predict("total", features);
+    estimate.megabytes = model.predict("megabytes", features);
+    for (const string& stage : model.getStages()) {
+        const double milliseconds = model.predict(stage, features);
+        if (estimate.stages.empty() || milliseconds > model.predict(estimate.dominantStage, features))
+            estimate.dominantStage = stage;
+        estimate.stages.emplace_back(stage, milliseconds);
+    }
+    estimate.features = features.getValues();
+    return estimate;
 }
 
 void CppInliner::autoDetectCompilationOptions() {
     clangCompilationOptions = internal::detectClangOptions(temporaryDirectory);
 }
 
+void CppInliner::buildHeaderBundle(const string& bundlePath, const vector<string>& probeFiles) const {
+    vector<string> probes{probeFiles};
+    if (probes.empty()) {
+        const string probePath{pathConcat(temporaryDirectory, "bundle-probe.cpp")};
+        ofstream probe{probePath, std::ios::binary};
+        probe << internal::getDefaultHeaderBundleProbe();
+        probes.push_back(probePath);
+    }
+
+    vector<string> headers = internal::collectSystemHeaders(clangCompilationOptions, probes);
+    internal::writeHeaderBundle(headers, headerBundleDescription(clangCompilationOptions), bundlePath);
+}
+
+static const char* const CACHE_OPTIONS_FILE = "clangOptions.txt";
+static const char* const CACHE_BUNDLE_FILE = "headers.bundle";
+static const char* const CACHE_MODULES_DIRECTORY = "modules";
+
+// Manifest of a cache archive: lines '<key> <value>'.
+static string getCacheManifestValue(const string& manifest, const string& key) {
+    std::istringstream in{manifest};
+    string line;
+    while (std::getline(in, line)) {
+        if (line.compare(0, key.size() + 1, key + ' ') == 0)
+            return line.substr(key.size() + 1);
+    }
+    return "";
+}
+
+void CppInliner::exportCaches(const string& archivePath) const {
+    vector<std::pair<string, string>> files;
+
+    const string optionsPath{pathConcat(temporaryDirectory, CACHE_OPTIONS_FILE)};
+    {
+        ofstream out{optionsPath, std::ios::binary};
+        for (const string& option : clangCompilationOptions)
+            out << option << '\n';
+    }
+    files.emplace_back(CACHE_OPTIONS_FILE, optionsPath);
+
+    const string bundlePath{pathConcat(temporaryDirectory, CACHE_BUNDLE_FILE)};
+    buildHeaderBundle(bundlePath);
+    files.emplace_back(CACHE_BUNDLE_FILE, bundlePath);
+
+    if (!moduleCacheDirectory.empty()) {
+        // Modules are built on first use; build all of them by inlining a program
+        // that includes every standard header.
+        const string probePath{pathConcat(temporaryDirectory, "cache-probe.cpp")};
+        {
+            ofstream probe{probePath, std::ios::binary};
+            probe << internal::getDefaultHeaderBundleProbe() << "\nint main() {}\n";
+        }
+        inlineCode({probePath}, pathConcat(temporaryDirectory, "cache-probe-result.cpp"));
+
+        std::error_code ec;
+        for (llvm::sys::fs::recursive_directory_iterator it(moduleCacheDirectory, ec), end;
+             it != end && !ec; it.increment(ec))
+        {
+            const string path = it->path();
+            const bool isLock = path.size() >= 5 && path.compare(path.size() - 5, 5, ".lock") == 0;
+            if (it->type() != llvm::sys::fs::file_type::regular_file || isLock)
+                continue;
+            string relativePath = path.substr(moduleCacheDirectory.size());
+            relativePath.erase(0, relativePath.find_first_not_of("/\\"));
+            std::replace(relativePath.begin(), relativePath.end(), '\\', '/');
+            files.emplace_back(string(CACHE_MODULES_DIRECTORY) + "/" + relativePath, path);
+        }
+        if (ec)
+            throw std::runtime_error("Couldn't read module cache " + moduleCacheDirectory + ": " + ec.message());
+    }
+
+    string manifest = "format 1\n";
+    manifest += "fingerprint " + internal::getToolchainFingerprint(clangCompilationOptions) + "\n";
+    manifest += "clang " + internal::getClangVersion() + "\n";
+    internal::writeCacheArchive(archivePath, manifest, files);
+}
+
+void CppInliner::clearFileCache() {
+    internal::FileCache::getProcessCache()->clear();
+}
+
+// Checks the caches unpacked into the directory; throws std::runtime_error if they can't be
+// used on this machine. Returns the compilation options they were built with.
+static vector<string> validateCaches(const string& archivePath, const string& manifest,
+                                     const string& directory, const vector<string>& clangCompilationOptions)
+{
+    vector<string> options;
+    {
+        std::ifstream in{pathConcat(directory, CACHE_OPTIONS_FILE)};
+        string line;
+        while (std::getline(in, line))
+            options.push_back(line);
+    }
+
+    if (getCacheManifestValue(manifest, "fingerprint") != internal::getToolchainFingerprint(options))
+        throw std::runtime_error("Cache archive " + archivePath + " was built by " +
+            getCacheManifestValue(manifest, "clang") + ", not by " + internal::getClangVersion());
+    if (!clangCompilationOptions.empty() && clangCompilationOptions != options)
+        throw std::runtime_error("Cache archive " + archivePath +
+            " was built with different compilation options");
+
+    // Bundled headers shadow the files on disk; they must be the same files.
+    std::shared_ptr<const internal::HeaderBundle> bundle =
+        internal::HeaderBundle::load(pathConcat(directory, CACHE_BUNDLE_FILE));
+    for (std::size_t i = 0; i < bundle->getNumFiles(); ++i) {
+        const internal::HeaderBundle::File file = bundle->getFile(i);
+        auto buffer = llvm::MemoryBuffer::getFile(file.path);
+        if (!buffer)
+            throw std::runtime_error("Cache archive " + archivePath + ": header " + file.path.str() +
+                " doesn't exist on this machine");
+        if ((*buffer)->getBuffer() != file.contents)
+            throw std::runtime_error("Cache archive " + archivePath + ": header " + file.path.str() +
+                " differs on this machine");
+    }
+
+    return options;
+}
+
+void CppInliner::importCaches(const string& archivePath, const string& cacheDirectory_) {
+    internal::CacheArchiveReader reader{archivePath};
+    const string& manifest = reader.getManifest();
+    if (getCacheManifestValue(manifest, "format") != "1")
+        throw std::runtime_error("Unsupported format of cache archive " + archivePath);
+
+    // The archive is unpacked and checked next to the cache directory, which is replaced
+    // only if the caches can be used: a rejected archive leaves the previous caches intact.
+    const string cacheDirectory{trimEndPathSeparators(cacheDirectory_)};
+    const string stagingDirectory{cacheDirectory + ".importing"};
+    llvm::sys::fs::remove_directories(stagingDirectory); // left by an interrupted import
+
+    vector<string> names;
+    vector<string> options;
+    try {
+        names = reader.extractTo(stagingDirectory);
+        options = validateCaches(archivePath, manifest, stagingDirectory, clangCompilationOptions);
+    } catch (...) {
+        llvm::sys::fs::remove_directories(stagingDirectory);
+        throw;
+    }
+
+    llvm::sys::fs::remove_directories(cacheDirectory);
+    if (std::error_code error = llvm::sys::fs::rename(stagingDirectory, cacheDirectory)) {
+        llvm::sys::fs::remove_directories(stagingDirectory);
+        throw std::runtime_error("Couldn't move the caches to " + cacheDirectory + ": " + error.message());
+    }
+
+    clangCompilationOptions = options;
+    headerBundle = pathConcat(cacheDirectory, CACHE_BUNDLE_FILE);
+    const string modulesPrefix = string(CACHE_MODULES_DIRECTORY) + "/";
+    if (std::any_of(names.begin(), names.end(),
+            [&](const string& name) { return name.compare(0, modulesPrefix.size(), modulesPrefix) == 0; }))
+        moduleCacheDirectory = pathConcat(cacheDirectory, CACHE_MODULES_DIRECTORY);
+}
+
 } // namespace caide
 
 static vector<string> arrayToCppVector(const char** array, int size) {
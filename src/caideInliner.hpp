@@ -6,7 +6,10 @@
 
 #pragma once
 
+#include <cstddef>
+#include <stdexcept>
 #include <string>
+#include <utility>
 #include <vector>
 
 /// \file caideInliner.hpp
@@ -15,6 +18,145 @@
 
 namespace caide {
 
+/// \brief Measurements collected during one run of the inliner
+///
+/// \sa CppInliner::inlineCode()
+struct InlinerStatistics {
+    /// \brief A processing stage (e.g. preprocessing or unused code removal)
+    struct Stage {
+        std::string name;
+
+        /// \brief Nesting level of the stage; top-level stages have depth 0.
+        /// A stage is nested in the closest preceding stage with a smaller depth.
+        int depth = 0;
+
+        /// \brief Wall clock time spent in the stage
+        double milliseconds = 0;
+
+        /// \brief Number and total size of heap allocations made in the stage.
+        /// Zero unless the library is built with CAIDE_PROFILE_ALLOCATIONS
+        /// and the environment variable CAIDE_PROFILE_ALLOCATIONS=1 is set.
+        unsigned long long allocations = 0;
+        unsigned long long allocatedBytes = 0;
+    };
+
+    /// \brief Stages in the order in which they were started
+    std::vector<Stage> stages;
+
+    /// \brief Named counters (e.g. number of declarations), in the order of first use
+    std::vector<std::pair<std::string, unsigned long long>> counters;
+
+    /// \brief Total size of the input C++ files
+    unsigned long long inputBytes = 0;
+
+    /// \brief Size of the program after inlining of user headers
+    unsigned long long inlinedBytes = 0;
+
+    /// \brief Size of the output file
+    unsigned long long outputBytes = 0;
+
+    /// \brief True if the output file already had the resulting contents and was
+    /// left untouched (its modification time didn't change)
+    ///
+    /// The check uses the sidecar file <outputFilePath>.hash, which holds the hash, size and
+    /// modification time of the output; while they match, the output isn't read back.
+    bool outputUnchanged = false;
+};
+
+/// \brief Limits on the resources used by one run of CppInliner::inlineCode()
+///
+/// Zero means no limit. Limits are checked between stages and periodically while
+/// a stage runs (every few thousand tokens and on entering each file), so a run may
+/// exceed a limit by the time between two checks.
+///
+/// \sa CppInliner::limits
+struct InlinerLimits {
+    /// \brief Wall clock time, in milliseconds
+    double wallMilliseconds = 0;
+
+    /// \brief CPU time of the thread running the request, in milliseconds
+    double cpuMilliseconds = 0;
+
+    /// \brief Memory used by the request, in megabytes (glibc only)
+    ///
+    /// Measured as the growth of heap memory held by the thread running the request since
+    /// the request started, so memory held before (e.g. caches of earlier requests) doesn't
+    /// count, and requests running in parallel (e.g. in CppInliner::inlineBatch()) don't
+    /// affect each other. Heap is tracked through operator new, which the library replaces;
+    /// memory allocated with malloc directly, such as the AST with LLVM versions before 11,
+    /// is not counted.
+    double megabytes = 0;
+
+    /// \brief Size of the output file, in bytes
+    unsigned long long outputBytes = 0;
+};
+
+/// \brief Exception thrown by CppInliner::inlineCode() when one of CppInliner::limits
+/// is exceeded
+class LimitExceededError: public std::runtime_error {
+public:
+    LimitExceededError(const std::string& message, const std::string& limit,
+                       const InlinerStatistics& statistics);
+
+    /// \brief Name of the exceeded limit, e.g. "wallMilliseconds" (a field of InlinerLimits)
+    const std::string& getLimit() const { return limit; }
+
+    /// \brief Measurements of the stages run before the limit was exceeded
+    const InlinerStatistics& getStatistics() const { return statistics; }
+
+private:
+    std::string limit;
+    InlinerStatistics statistics;
+};
+
+/// \brief One program to inline in CppInliner::inlineBatch()
+struct InlinerJob {
+    /// \brief Full paths of all C++ files of the program
+    std::vector<std::string> cppFilePaths;
+
+    /// \brief Path to a file where the inlined program will be written
+    std::string outputFilePath;
+};
+
+/// \brief Outcome of an InlinerJob
+struct InlinerJobResult {
+    /// \brief Empty if the job succeeded
+    std::string error;
+
+    /// \brief Measurements of the run that produced the result
+    ///
+    /// For a duplicate job, these are the measurements of the job it duplicates.
+    InlinerStatistics statistics;
+
+    /// \brief Wall clock time from the start of the job to its completion, including
+    /// the time spent waiting for the job it duplicates
+    double milliseconds = 0;
+
+    /// \brief Index of the job whose result was reused, or -1 if the job was run
+    int duplicateOf = -1;
+};
+
+/// \brief Predicted cost of a request
+///
+/// \sa CppInliner::estimateCost()
+struct CostEstimate {
+    /// \brief Predicted wall clock time of CppInliner::inlineCode()
+    double milliseconds = 0;
+
+    /// \brief Predicted peak memory usage
+    double megabytes = 0;
+
+    /// \brief Stage predicted to take most time
+    std::string dominantStage;
+
+    /// \brief Predicted time of each stage, in milliseconds
+    std::vector<std::pair<std::string, double>> stages;
+
+    /// \brief Values of the features the prediction is based on (for calibration
+    /// of the cost model)
+    std::vector<std::pair<std::string, double>> features;
+};
+
 /// \brief C++ code inliner and unused code remover
 ///
 /// The C++ inliner transforms a program implemented as multiple C++ source files
@@ -44,15 +186,114 @@ public:
     /// All input C++ files and included user headers will be combined into a single C++ file,
     /// and only code reachable from main function will be kept. In addition, declarations
     /// marked with a comment 'caide keep' will be kept too.
+    ///
+    /// The output file is only rewritten if its contents change. Each successful run
+    /// creates or updates the file <outputFilePath>.hash next to it
+    /// (see InlinerStatistics::outputUnchanged).
     void inlineCode(const std::vector<std::string>& cppFilePaths,
                     const std::string& outputFilePath) const;
 
+    /// \brief Same as inlineCode(cppFilePaths, outputFilePath), but also collects
+    /// timings and sizes of intermediate results into \p statistics.
+    ///
+    /// The previous contents of \p statistics are replaced. If an exception is thrown,
+    /// \p statistics contains the measurements of the stages that were run.
+    void inlineCode(const std::vector<std::string>& cppFilePaths,
+                    const std::string& outputFilePath,
+                    InlinerStatistics& statistics) const;
+
+    /// \brief Run inlineCode() for multiple programs in parallel
+    /// \param jobs programs to inline
+    /// \param numThreads number of worker threads; if not positive, the number of
+    ///   hardware threads is used
+    /// \return results in the order of \p jobs
+    ///
+    /// Jobs with identical inputs are run once, and the result is copied to the output
+    /// files of the other jobs (also while the first job is still running: later duplicates
+    /// wait for it). Jobs are identical if the contents of their C++ files and of the user
+    /// headers these files include are identical; paths don't matter. User headers are
+    /// found as in estimateCost().
+    ///
+    /// Each worker thread uses its own subdirectory of the temporary directory.
+    /// Errors of individual jobs are reported in the results, not thrown.
+    ///
+    /// \sa precompileSharedPrefix
+    std::vector<InlinerJobResult> inlineBatch(const std::vector<InlinerJob>& jobs,
+                                              int numThreads = 0) const;
+
+    /// \brief Predict the cost of inlineCode() for the given files
+    ///
+    /// The prediction is based on a fast scan of the input files and of the user
+    /// headers they include, with a lexer only (no preprocessing or parsing). It takes
+    /// into account sizes of user files, system headers included, and the number of
+    /// templates, macros and literals. Use it to schedule requests before running them.
+    ///
+    /// \sa costModelFile
+    CostEstimate estimateCost(const std::vector<std::string>& cppFilePaths) const;
+
     /// \brief Try to detect system include paths automatically and adjust
     /// clangCompilationOptions accordingly.
     ///
     /// \sa clangCompilationOptions
     void autoDetectCompilationOptions();
 
+    /// \brief Build a header bundle: a single file containing the system headers used
+    /// by the probe files and all clang builtin headers.
+    ///
+    /// Reading headers from a memory-mapped bundle replaces thousands of small file
+    /// opens per run, which dominate cold-start latency in fresh containers and on
+    /// network file systems. The bundle must be rebuilt when system headers or
+    /// clangCompilationOptions change.
+    ///
+    /// \param bundlePath path of the bundle file to write
+    /// \param probeFiles C++ files whose system headers are bundled. If empty, a probe
+    ///   including all standard library headers is used.
+    ///
+    /// \sa headerBundle
+    void buildHeaderBundle(const std::string& bundlePath,
+                           const std::vector<std::string>& probeFiles = {}) const;
+
+    /// \brief Build persistent caches and write them into a single archive file
+    ///
+    /// The archive contains clangCompilationOptions, a header bundle built with the
+    /// default probe (see buildHeaderBundle()) and, if moduleCacheDirectory is not empty,
+    /// the module cache after all standard library modules have been built. Build the
+    /// archive once, e.g. when a container image is built, and import it with
+    /// importCaches() on machines with the same toolchain, so that the first request
+    /// doesn't pay for building caches.
+    ///
+    /// \sa importCaches()
+    void exportCaches(const std::string& archivePath) const;
+
+    /// \brief Unpack an archive written by exportCaches() and start using the caches
+    /// \param archivePath path of the archive
+    /// \param cacheDirectory directory where the caches are unpacked
+    ///
+    /// The archive is rejected (std::runtime_error is thrown) if it was built by a different
+    /// version of the library's clang, if clangCompilationOptions is not empty and differs
+    /// from the options the archive was built with, or if any of the bundled system headers
+    /// is missing or differs from the file on this machine. Otherwise clangCompilationOptions,
+    /// headerBundle and moduleCacheDirectory (if the archive contains modules) are set.
+    ///
+    /// The archive is unpacked and checked in a sibling directory (`<cacheDirectory>.importing`),
+    /// which then replaces cacheDirectory. A rejected archive leaves cacheDirectory untouched.
+    ///
+    /// Files written by importCaches() are:
+    ///
+    /// \li `clangOptions.txt`: compilation options, one per line
+    /// \li `headers.bundle`: header bundle
+    /// \li `modules/`: module cache
+    ///
+    /// \sa exportCaches()
+    void importCaches(const std::string& archivePath, const std::string& cacheDirectory);
+
+    /// \brief Drop the contents of files cached in memory by all instances in the process
+    ///
+    /// Files read by a request (system and user headers) are kept in memory for later
+    /// requests while they don't change on disk. After this call, the next request reads
+    /// them from disk, like the first request of a process does.
+    static void clearFileCache();
+
     /// \brief clang compilation options (see http://clang.llvm.org/docs/CommandGuide/clang.html
     /// and http://clang.llvm.org/docs/UsersManual.html)
     ///
@@ -116,7 +357,162 @@ public:
     /// Identifiers must be fully qualified, e.g. "NamespaceName::ClassName::method".
     std::vector<std::string> identifiersToKeep;
 
+    /// \brief Directory where precompiled clang modules of system headers are stored
+    ///
+    /// If not empty, unused code removal parses the program with `-fmodules`: system
+    /// headers covered by a module map (e.g. libc++ with `-stdlib=libc++`, or any
+    /// headers with a module map passed via `-fmodule-map-file`) are imported as
+    /// precompiled modules instead of being parsed textually. Declarations of a module
+    /// are deserialized lazily, which saves time and memory for programs using a small
+    /// part of the standard library. Modules are built on first use and reused by later
+    /// runs with the same toolchain and compilation options. Headers that are not
+    /// covered by a module map are parsed as usual.
+    ///
+    /// This setting doesn't affect the output: include directives of system headers
+    /// are kept as they are.
+    ///
+    /// Default value is empty (modules are not used).
+    std::string moduleCacheDirectory;
+
+    /// \brief Path to a header bundle to read system headers from
+    ///
+    /// Files that are not in the bundle are read from disk. The bundle must have been
+    /// built with the same clangCompilationOptions.
+    ///
+    /// Default value is empty (headers are read from disk).
+    ///
+    /// \sa buildHeaderBundle()
+    std::string headerBundle;
+
+    /// \brief Try a faster, approximate analysis of dependencies first
+    ///
+    /// If true, unused code is first removed without analyzing template instantiations:
+    /// code that templates might refer to is kept conservatively. The result is then
+    /// checked by compiling it (without code generation). Only if the check fails, unused
+    /// code removal is repeated with the exact analysis. The output may contain slightly
+    /// more unused code than with the exact analysis.
+    ///
+    /// The counter `approximateDependencies.rejected` in InlinerStatistics is 1 if
+    /// the fallback was taken.
+    ///
+    /// Default value is false.
+    bool approximateDependencies;
+
+    /// \brief Check that the output file compiles
+    ///
+    /// If true, the output is compiled without code generation after it is written,
+    /// and inlineCode() throws an exception listing the compilation errors if there are
+    /// any. The check reads system headers (and precompiled modules, see
+    /// moduleCacheDirectory) from the state already loaded by unused code removal,
+    /// so it is much cheaper than a separate compiler run.
+    ///
+    /// Errors are reported at their locations in the original C++ files and user headers.
+    /// Errors in text that doesn't come from them (e.g. the include directives written at
+    /// the beginning of the output) are reported at their locations in the output file.
+    ///
+    /// Default value is false.
+    bool verifyOutput;
+
+    /// \brief Write a source map of the output file
+    ///
+    /// If true, the map from byte offsets in the output file to the original C++ files
+    /// and user headers is written next to the output, to \<outputFilePath\>.map
+    /// (see SourceMap::serialize() for the encoding).
+    ///
+    /// Default value is false.
+    bool writeSourceMap;
+
+    /// \brief Write system include directives at the beginning of the output in a
+    /// canonical form
+    ///
+    /// Include directives of system headers that are not inside a conditional block are
+    /// moved to the beginning of the output. If this option is true, they are also
+    /// normalized (whitespace), sorted and deduplicated, so that programs using the same
+    /// headers start with byte-identical text. This makes precompiled headers and compiler
+    /// caches effective when the output of many programs is compiled.
+    ///
+    /// Default value is false (directives are kept in the order of inclusion).
+    ///
+    /// \sa includePrelude
+    bool canonicalIncludes;
+
+    /// \brief Path to a file written at the beginning of the output, before system
+    /// include directives
+    ///
+    /// Typically, the file includes the headers most programs use, e.g. `bits/stdc++.h`,
+    /// and a precompiled header is built from it. Include directives that the file
+    /// contains literally (up to whitespace) are not repeated in the output.
+    ///
+    /// Default value is empty (no prelude).
+    ///
+    /// \sa canonicalIncludes
+    std::string includePrelude;
+
+    /// \brief Parse system headers shared by all jobs of inlineBatch() once
+    ///
+    /// If true, inlineBatch() finds the system headers that the first C++ file of every job
+    /// includes at its very beginning, in the same order (e.g. `#include <bits/stdc++.h>`),
+    /// and builds a precompiled header from them before running the jobs. Unused code
+    /// removal of each job loads the precompiled header instead of parsing these headers.
+    /// User headers are never precompiled: their code is part of the output.
+    ///
+    /// The option is ignored if moduleCacheDirectory is set or clangCompilationOptions
+    /// contain `-include`. If the precompiled header can't be built, jobs run as usual.
+    /// The counter `precompiledPrefix.headers` in InlinerStatistics of a job is the number
+    /// of headers loaded from the precompiled header.
+    ///
+    /// The precompiled header is built in a new subdirectory of the temporary directory
+    /// (`shared-prefix-XXXXXX`), which is removed when the batch ends, so concurrent batches
+    /// don't interfere.
+    ///
+    /// Default value is false.
+    bool precompileSharedPrefix;
+
+    /// \brief Limits on the resources used by each run of inlineCode(), including each
+    /// job of inlineBatch()
+    ///
+    /// If a limit is exceeded, the run stops and LimitExceededError is thrown (for a batch,
+    /// the error is reported in the result of the job). Set limits per request on the
+    /// instance that serves the request.
+    ///
+    /// Default value: no limits.
+    InlinerLimits limits;
+
+    /// \brief Path to a cost model used by estimateCost()
+    ///
+    /// A model calibrated for the machine and the typical workload is produced by
+    /// the corpus benchmark (`corpus-bench ... --calibrate <model-file>`).
+    ///
+    /// The built-in model has uncalibrated placeholder coefficients, so that without a
+    /// model file the predicted times and memory are only meaningful for comparing
+    /// requests with each other.
+    ///
+    /// Default value is empty (the built-in model is used).
+    std::string costModelFile;
+
 private:
+    /// Precompiled system headers that all inputs include first (see precompileSharedPrefix)
+    struct PrecompiledPrefix {
+        /// Unique to the batch; removed when the batch ends
+        std::string directory;
+        std::string pchPath;
+        std::size_t numHeaders = 0;
+    };
+
+    void inlineCode(const std::vector<std::string>& cppFilePaths,
+                    const std::string& outputFilePath,
+                    const std::string& workingDirectory,
+                    const PrecompiledPrefix& precompiledPrefix,
+                    InlinerStatistics& statistics) const;
+
+    void doInlineCode(const std::vector<std::string>& cppFilePaths,
+                      const std::string& outputFilePath,
+                      const std::string& workingDirectory,
+                      const PrecompiledPrefix& precompiledPrefix,
+                      InlinerStatistics& statistics) const;
+
+    PrecompiledPrefix buildPrecompiledPrefix(const std::vector<InlinerJob>& jobs) const;
+
     const std::string temporaryDirectory;
 };
 
@@ -0,0 +1,44 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#pragma once
+
+// Static tracepoints at stage boundaries, for system-level tracing of production hosts
+// without rebuilding. Enabled by the CMake option CAIDE_USDT, which requires <sys/sdt.h>
+// (systemtap-sdt-dev). A probe compiles to a single nop and costs nothing until a tracer
+// attaches to it; without CAIDE_USDT, probes and their arguments are compiled out.
+//
+// All probes are in the provider 'caide'. List them with
+//     readelf -n <binary>    or    bpftrace -l 'usdt:<binary>:caide:*'
+// For example, time of unused code removal per request:
+//     bpftrace -e 'usdt:./cmd:caide:optimize_begin { @start[tid] = nsecs; }
+//                  usdt:./cmd:caide:optimize_end { @ms = hist((nsecs - @start[tid]) / 1000000); }'
+//
+// Probes (arguments in order):
+//     concat_begin(files), concat_end(bytes)
+//     inline_begin(path), inline_end(bytes)
+//     optimize_begin(path, approximate), optimize_end(bytes)
+//     phase_begin(name), phase_end(name, count) - phases of unused code removal, named as
+//         the corresponding stages in InlinerStatistics. count is the number of declarations
+//         written in the source (BuildNonImplicitDeclMap), in the dependency graph
+//         (DependenciesCollector), reachable (BFS) or removed (OptimizerVisitor,
+//         MergeNamespacesVisitor), or the output size in bytes (Finalize+Rewrite)
+//     verify_begin(path), verify_end(errors)
+//     postprocess_begin(bytes), postprocess_end(bytes) - removal of empty lines
+
+#ifdef CAIDE_USDT
+
+#include <sys/sdt.h>
+
+#define CAIDE_TRACE1(name, a) DTRACE_PROBE1(caide, name, a)
+#define CAIDE_TRACE2(name, a, b) DTRACE_PROBE2(caide, name, a, b)
+
+#else
+
+#define CAIDE_TRACE1(name, a)
+#define CAIDE_TRACE2(name, a, b)
+
+#endif
@@ -6,28 +6,221 @@
 
 #include "../caideInliner.hpp"
 
+#include <chrono>
+#include <cstdio>
 #include <cstdlib>
+#include <ctime>
 #include <fstream>
 #include <iostream>
+#include <sstream>
 #include <stdexcept>
 #include <string>
 
 
 using namespace std;
 
+// Time of the first static initializer of the executable. With GCC and clang, it runs before
+// the static initializers of statically linked libraries (LLVM and clang register command line
+// options and other globals in them), which is what --startup-probe measures.
+#if defined(__GNUC__)
+static const chrono::steady_clock::time_point processInitTime __attribute__((init_priority(101))) =
+    chrono::steady_clock::now();
+#else
+static const chrono::steady_clock::time_point processInitTime = chrono::steady_clock::now();
+#endif
+
+static double millisecondsSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+static string jsonString(const string& s) {
+    string res = "\"";
+    for (char c : s) {
+        switch (c) {
+            case '"': res += "\\\""; break;
+            case '\\': res += "\\\\"; break;
+            case '\n': res += "\\n"; break;
+            case '\r': res += "\\r"; break;
+            case '\t': res += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    char buf[8];
+                    snprintf(buf, sizeof(buf), "\\u%04x", c);
+                    res += buf;
+                } else {
+                    res += c;
+                }
+        }
+    }
+    res += '"';
+    return res;
+}
+
+// Appends one line in JSON format describing this invocation.
+static void writeMetrics(const string& metricsFile, const caide::InlinerStatistics& statistics,
+                         double wallMilliseconds, int exitStatus, const string& error)
+{
+    ostringstream line;
+    line << "{\"timestamp\":" << time(nullptr)
+         << ",\"exitStatus\":" << exitStatus;
+    if (!error.empty())
+        line << ",\"error\":" << jsonString(error);
+    line << ",\"wallMs\":" << wallMilliseconds
+         << ",\"inputBytes\":" << statistics.inputBytes
+         << ",\"inlinedBytes\":" << statistics.inlinedBytes
+         << ",\"outputBytes\":" << statistics.outputBytes
+         << ",\"outputUnchanged\":" << (statistics.outputUnchanged ? "true" : "false")
+         << ",\"stages\":[";
+    for (size_t i = 0; i < statistics.stages.size(); ++i) {
+        const auto& stage = statistics.stages[i];
+        if (i > 0)
+            line << ',';
+        line << "{\"name\":" << jsonString(stage.name)
+             << ",\"depth\":" << stage.depth
+             << ",\"ms\":" << stage.milliseconds;
+        if (stage.allocations > 0)
+            line << ",\"allocations\":" << stage.allocations
+                 << ",\"allocatedBytes\":" << stage.allocatedBytes;
+        line << '}';
+    }
+    line << "],\"counters\":{";
+    for (size_t i = 0; i < statistics.counters.size(); ++i) {
+        if (i > 0)
+            line << ',';
+        line << jsonString(statistics.counters[i].first) << ':' << statistics.counters[i].second;
+    }
+    line << "}}\n";
+
+    // Write the line at once, so that lines of concurrent invocations don't interleave.
+    ofstream out(metricsFile, ios::app | ios::binary);
+    const string text = line.str();
+    out.write(text.data(), text.size());
+    if (!out)
+        cerr << "Couldn't write metrics to " << metricsFile << endl;
+}
+
+// Each non-empty line of a batch file describes a job: the output file followed by
+// the C++ files, separated by whitespace.
+static vector<caide::InlinerJob> readBatch(const string& batchFile) {
+    ifstream in(batchFile);
+    if (!in)
+        throw runtime_error("Couldn't read " + batchFile);
+    vector<caide::InlinerJob> jobs;
+    string line;
+    while (getline(in, line)) {
+        istringstream fields(line);
+        caide::InlinerJob job;
+        if (!(fields >> job.outputFilePath))
+            continue;
+        string cppFile;
+        while (fields >> cppFile)
+            job.cppFilePaths.push_back(cppFile);
+        if (job.cppFilePaths.empty())
+            throw runtime_error("No source files for " + job.outputFilePath + " in " + batchFile);
+        jobs.push_back(std::move(job));
+    }
+    return jobs;
+}
+
+// Prints the estimate in JSON format, as one line.
+static void writeCostEstimate(const caide::CostEstimate& estimate) {
+    cout << "{\"ms\":" << estimate.milliseconds
+         << ",\"megabytes\":" << estimate.megabytes
+         << ",\"dominantStage\":" << jsonString(estimate.dominantStage)
+         << ",\"stages\":{";
+    for (size_t i = 0; i < estimate.stages.size(); ++i) {
+        if (i > 0)
+            cout << ',';
+        cout << jsonString(estimate.stages[i].first) << ':' << estimate.stages[i].second;
+    }
+    cout << "},\"features\":{";
+    for (size_t i = 0; i < estimate.features.size(); ++i) {
+        if (i > 0)
+            cout << ',';
+        cout << jsonString(estimate.features[i].first) << ':' << estimate.features[i].second;
+    }
+    cout << "}}" << endl;
+}
+
+// Measures the fixed cost of a run: static initializers, and the first run of the inliner
+// on a trivial program (initialization of clang on first use, reading of the compiler's
+// builtin headers, but no system headers). Prints one line in JSON format. The time spent
+// before the first static initializer (exec, dynamic linking) is measured by startup-bench,
+// which runs this probe as a child process.
+static void runStartupProbe(const caide::CppInliner& inliner, const string& tmpDirectory,
+                            chrono::steady_clock::time_point mainStart)
+{
+    const double staticInitMilliseconds =
+        chrono::duration<double, milli>(mainStart - processInitTime).count();
+
+    const string probeFile = tmpDirectory + "/startup-probe.cpp";
+    {
+        ofstream out(probeFile);
+        out << "int main() {}\n";
+    }
+    const auto runStart = chrono::steady_clock::now();
+    inliner.inlineCode({probeFile}, tmpDirectory + "/startup-probe-result.cpp");
+    const double firstRunMilliseconds = millisecondsSince(runStart);
+
+    cout << "{\"staticInitMs\":" << staticInitMilliseconds
+         << ",\"firstRunMs\":" << firstRunMilliseconds
+         << ",\"mainMs\":" << millisecondsSince(mainStart) << "}" << endl;
+}
+
 int main(int argc, const char* argv[]) {
+    const auto mainStart = chrono::steady_clock::now();
     vector<string> sourceFiles;
     string tmpDirectory = "./caide-tmp";
     string outputFile = "./caide-tmp/result.cpp";
     vector<string> clangOptions;
     vector<string> macrosToKeep;
     int maxConsecutiveEmptyLines = 2;
+    string metricsFile;
+    string moduleCacheDirectory;
+    string headerBundle;
+    string headerBundleToBuild;
+    bool approximateDependencies = false;
+    bool verifyOutput = false;
+    bool writeSourceMap = false;
+    bool estimateCost = false;
+    string costModelFile;
+    string batchFile;
+    int numThreads = 0;
+    bool startupProbe = false;
+    bool canonicalIncludes = false;
+    bool precompileSharedPrefix = false;
+    caide::InlinerLimits limits;
+    string includePrelude;
+    string cacheToExport;
+    string cacheToImport;
+    string cacheDirectory;
 
     const string clangOptionsEnd = "--";
     const string directoryFlag = "-d";
     const string outputFlag = "-o";
     const string keepMacrosFlag = "-k";
     const string emptyLinesFlag = "-l";
+    const string metricsFileFlag = "--metrics-file";
+    const string moduleCacheFlag = "--module-cache";
+    const string headerBundleFlag = "--header-bundle";
+    const string buildHeaderBundleFlag = "--build-header-bundle";
+    const string approximateDependenciesFlag = "--approximate-dependencies";
+    const string verifyFlag = "--verify";
+    const string sourceMapFlag = "--source-map";
+    const string estimateCostFlag = "--estimate-cost";
+    const string costModelFlag = "--cost-model";
+    const string batchFlag = "--batch";
+    const string jobsFlag = "--jobs";
+    const string startupProbeFlag = "--startup-probe";
+    const string canonicalIncludesFlag = "--canonical-includes";
+    const string includePreludeFlag = "--include-prelude";
+    const string precompileSharedPrefixFlag = "--precompile-shared-prefix";
+    const string maxWallTimeFlag = "--max-wall-ms";
+    const string maxCpuTimeFlag = "--max-cpu-ms";
+    const string maxMemoryFlag = "--max-memory-mb";
+    const string maxOutputFlag = "--max-output-bytes";
+    const string exportCacheFlag = "--export-cache";
+    const string importCacheFlag = "--import-cache";
 
     int i = 1;
     for (; i < argc && clangOptionsEnd != argv[i]; ++i) {
@@ -55,6 +248,64 @@ int main(int argc, const char* argv[]) {
         } else if (emptyLinesFlag == argv[i]) {
             ++i;
             if (i < argc) maxConsecutiveEmptyLines = strtol(argv[i], nullptr, 10);
+        } else if (metricsFileFlag == argv[i]) {
+            ++i;
+            if (i < argc) metricsFile = argv[i];
+        } else if (moduleCacheFlag == argv[i]) {
+            ++i;
+            if (i < argc) moduleCacheDirectory = argv[i];
+        } else if (headerBundleFlag == argv[i]) {
+            ++i;
+            if (i < argc) headerBundle = argv[i];
+        } else if (buildHeaderBundleFlag == argv[i]) {
+            ++i;
+            if (i < argc) headerBundleToBuild = argv[i];
+        } else if (approximateDependenciesFlag == argv[i]) {
+            approximateDependencies = true;
+        } else if (verifyFlag == argv[i]) {
+            verifyOutput = true;
+        } else if (sourceMapFlag == argv[i]) {
+            writeSourceMap = true;
+        } else if (estimateCostFlag == argv[i]) {
+            estimateCost = true;
+        } else if (costModelFlag == argv[i]) {
+            ++i;
+            if (i < argc) costModelFile = argv[i];
+        } else if (batchFlag == argv[i]) {
+            ++i;
+            if (i < argc) batchFile = argv[i];
+        } else if (jobsFlag == argv[i]) {
+            ++i;
+            if (i < argc) numThreads = strtol(argv[i], nullptr, 10);
+        } else if (startupProbeFlag == argv[i]) {
+            startupProbe = true;
+        } else if (canonicalIncludesFlag == argv[i]) {
+            canonicalIncludes = true;
+        } else if (includePreludeFlag == argv[i]) {
+            ++i;
+            if (i < argc) includePrelude = argv[i];
+        } else if (precompileSharedPrefixFlag == argv[i]) {
+            precompileSharedPrefix = true;
+        } else if (maxWallTimeFlag == argv[i]) {
+            ++i;
+            if (i < argc) limits.wallMilliseconds = strtod(argv[i], nullptr);
+        } else if (maxCpuTimeFlag == argv[i]) {
+            ++i;
+            if (i < argc) limits.cpuMilliseconds = strtod(argv[i], nullptr);
+        } else if (maxMemoryFlag == argv[i]) {
+            ++i;
+            if (i < argc) limits.megabytes = strtod(argv[i], nullptr);
+        } else if (maxOutputFlag == argv[i]) {
+            ++i;
+            if (i < argc) limits.outputBytes = strtoull(argv[i], nullptr, 10);
+        } else if (exportCacheFlag == argv[i]) {
+            ++i;
+            if (i < argc) cacheToExport = argv[i];
+        } else if (importCacheFlag == argv[i]) {
+            ++i;
+            if (i < argc) cacheToImport = argv[i];
+            ++i;
+            if (i < argc) cacheDirectory = argv[i];
         } else {
             sourceFiles.emplace_back(argv[i]);
         }
@@ -65,8 +316,115 @@ int main(int argc, const char* argv[]) {
     inliner.macrosToKeep.insert(inliner.macrosToKeep.end(),
         macrosToKeep.begin(), macrosToKeep.end());
     inliner.maxConsequentEmptyLines = maxConsecutiveEmptyLines;
-    inliner.inlineCode(sourceFiles, outputFile);
+    inliner.moduleCacheDirectory = moduleCacheDirectory;
+    inliner.headerBundle = headerBundle;
+    inliner.approximateDependencies = approximateDependencies;
+    inliner.verifyOutput = verifyOutput;
+    inliner.writeSourceMap = writeSourceMap;
+    inliner.costModelFile = costModelFile;
+    inliner.canonicalIncludes = canonicalIncludes;
+    inliner.precompileSharedPrefix = precompileSharedPrefix;
+    inliner.limits = limits;
+    inliner.includePrelude = includePrelude;
+
+    if (!headerBundleToBuild.empty()) {
+        // Source files, if any, are used as probes
+        try {
+            inliner.buildHeaderBundle(headerBundleToBuild, sourceFiles);
+        } catch (const exception& e) {
+            cerr << e.what() << endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    if (!cacheToExport.empty()) {
+        try {
+            inliner.exportCaches(cacheToExport);
+        } catch (const exception& e) {
+            cerr << e.what() << endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    if (!cacheToImport.empty()) {
+        // Unpacks and validates the caches; later runs use them with the printed options.
+        try {
+            inliner.importCaches(cacheToImport, cacheDirectory);
+        } catch (const exception& e) {
+            cerr << e.what() << endl;
+            return 1;
+        }
+        cout << "@" << cacheDirectory << "/clangOptions.txt -- --header-bundle " << inliner.headerBundle;
+        if (!inliner.moduleCacheDirectory.empty())
+            cout << " --module-cache " << inliner.moduleCacheDirectory;
+        cout << endl;
+        return 0;
+    }
+
+    if (startupProbe) {
+        try {
+            runStartupProbe(inliner, tmpDirectory, mainStart);
+        } catch (const exception& e) {
+            cerr << e.what() << endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    if (estimateCost) {
+        try {
+            writeCostEstimate(inliner.estimateCost(sourceFiles));
+        } catch (const exception& e) {
+            cerr << e.what() << endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    if (!batchFile.empty()) {
+        vector<caide::InlinerJob> jobs;
+        try {
+            jobs = readBatch(batchFile);
+        } catch (const exception& e) {
+            cerr << e.what() << endl;
+            return 1;
+        }
+
+        const vector<caide::InlinerJobResult> results = inliner.inlineBatch(jobs, numThreads);
+        int exitStatus = 0;
+        for (size_t job = 0; job < jobs.size(); ++job) {
+            const caide::InlinerJobResult& result = results[job];
+            const int jobStatus = result.error.empty() ? 0 : 1;
+            if (jobStatus != 0) {
+                cerr << jobs[job].outputFilePath << ": " << result.error << endl;
+                exitStatus = 1;
+            }
+            if (!metricsFile.empty())
+                writeMetrics(metricsFile, result.statistics, result.milliseconds, jobStatus, result.error);
+        }
+        return exitStatus;
+    }
+
+    const auto start = chrono::steady_clock::now();
+    caide::InlinerStatistics statistics;
+    int exitStatus = 0;
+    string error;
+    try {
+        inliner.inlineCode(sourceFiles, outputFile, statistics);
+    } catch (const exception& e) {
+        error = e.what();
+        exitStatus = 1;
+    }
+
+    if (!metricsFile.empty()) {
+        writeMetrics(metricsFile, statistics, millisecondsSince(start), exitStatus, error);
+    }
+
+    if (exitStatus != 0)
+        cerr << error << endl;
 
-    return 0;
+    return exitStatus;
 }
 
@@ -5,8 +5,11 @@
 // option) any later version. See LICENSE.TXT for details.
 
 #include "inliner.h"
+#include "Budget.h"
+#include "caide_trace.h"
 #include "clang_compat.h"
 #include "clang_version.h"
+#include "postprocess.h"
 #include "util.h"
 #include "Timer.h"
 
@@ -22,6 +25,7 @@
 #include <clang/Tooling/CompilationDatabase.h>
 #include <clang/Tooling/Tooling.h>
 
+#include <cstdint>
 #include <iostream>
 #include <memory>
 #include <stdexcept>
@@ -42,12 +46,20 @@ namespace internal {
 struct InlinerState {
     string result;
     std::unordered_set<string>& inlinedPathsFromCommandLine;
+    SourceMap sourceMap;
+    std::uint32_t mainFile;
+};
+
+// Text with the source map describing its origin
+struct SplicedText {
+    string text;
+    SourceMap sourceMap;
 };
 
 struct IncludeReplacement {
     SourceRange includeDirectiveRange;
     const FileEntry* includingFile = nullptr;
-    string replaceWith;
+    SplicedText replaceWith;
 };
 
 class TrackMacro: public PPCallbacks {
@@ -113,7 +125,6 @@ public:
             // remember this file and process it in FileChanged.
             pendingInlinedPathsFromCommandLine[File] = FileName.str();
             rep.includeDirectiveRange = SourceRange(HashLoc, HashLoc);
-            rep.replaceWith = "";
         } else {
             SourceLocation end = FilenameRange.getEnd();
             // Initially assume the directive remains unchanged (this is the
@@ -121,10 +132,14 @@ public:
             const char* s = srcManager.getCharacterData(HashLoc);
             const char* e = srcManager.getCharacterData(end);
             rep.includeDirectiveRange = SourceRange(HashLoc, end);
-            if (s && e)
-                rep.replaceWith = string(s, e);
-            else
-                rep.replaceWith = "<Inliner error>\n";
+            if (s && e) {
+                const std::uint32_t file =
+                    rep.replaceWith.sourceMap.addFile(getFilePath(srcManager.getFileID(HashLoc)));
+                rep.replaceWith.sourceMap.addSegment(0, file, srcManager.getFileOffset(HashLoc));
+                rep.replaceWith.text = string(s, e);
+            } else {
+                rep.replaceWith.text = "<Inliner error>\n";
+            }
         }
 
         replacementStack.push_back(rep);
@@ -162,7 +177,7 @@ public:
             // - Mark this header as visited for future CPP files.
             if (!markAsIncluded(*curEntry)) {
                 // - If current header should be skipped, set empty replacement
-                replacementStack[includedFrom].replaceWith = "";
+                replacementStack[includedFrom].replaceWith = SplicedText{};
             } else if (isSystemHeader(PrevFID)) {
                 // - This is a new system header. Leave include directive as is,
                 //   i. e. do nothing.
@@ -180,7 +195,9 @@ public:
         dbg(CAIDE_FUNC);
         replacementStack[0].replaceWith = calcReplacements(0, srcManager.getMainFileID());
         replacementStack.resize(1);
-        state.result = replacementStack[0].replaceWith;
+        state.result = std::move(replacementStack[0].replaceWith.text);
+        state.sourceMap = std::move(replacementStack[0].replaceWith.sourceMap);
+        state.mainFile = state.sourceMap.addFile(getFilePath(srcManager.getMainFileID()));
     }
 
 #if CAIDE_CLANG_VERSION_AT_LEAST(10, 0)
@@ -201,7 +218,7 @@ public:
             // the header may not have been included. In other words, we need to explicitly
             // include every file that we use.
             if (!markAsIncluded(SkippedFile))
-                replacementStack.back().replaceWith = "";
+                replacementStack.back().replaceWith = SplicedText{};
         }
     }
 
@@ -227,17 +244,25 @@ private:
      */
     vector<IncludeReplacement> replacementStack;
 
+    string getFilePath(FileID fileID) const {
+        return srcManager.getFilename(srcManager.getLocForStartOfFile(fileID)).str();
+    }
+
     /*
      * Unwinds inclusion stack and calculates the result of inclusion of current file
      */
-    string calcReplacements(int includedFrom, FileID currentFID) const {
-        std::ostringstream result;
+    SplicedText calcReplacements(int includedFrom, FileID currentFID) const {
+        SplicedText result;
+        const std::uint32_t file = result.sourceMap.addFile(getFilePath(currentFID));
+        bool invalidFile = false;
+        const char* fileStart = srcManager.getBufferData(currentFID, &invalidFile).data();
 
         // We go over each #include directive in current file and replace it
         // with the result of inclusion.
         // The last value of i doesn't correspond to an include directive,
         // it's used to output the part of the file after the last include directive.
-        // TODO: Output #line directives for correct warning/error messages in optimizer stage.
+        // Instead of #line directives, the origin of the output is recorded in the source map,
+        // and the directives that were in the file are dropped.
         const int lastIndex = (int)replacementStack.size();
         for (int i = includedFrom + 1; i <= lastIndex; ++i) {
             // First output the block before the #include directive.
@@ -270,18 +295,23 @@ private:
                 const char* e = 0;
                 if (!invalid)
                     e = srcManager.getCharacterData(blockEnd, &invalid);
-                if (invalid || !b || !e)
-                    result << "<Inliner error>\n";
-                else
-                    result << string(b, e);
+                if (invalid || invalidFile || !b || !e) {
+                    result.sourceMap.addSegment(result.text.size(), SourceMap::noFile, 0);
+                    result.text += "<Inliner error>\n";
+                } else {
+                    appendWithoutInvalidDirectives(fileStart, b, e, file, result.text, result.sourceMap);
+                }
             }
 
             // Now output the result of file inclusion.
-            if (i != lastIndex)
-                result << replacementStack[i].replaceWith;
+            if (i != lastIndex) {
+                const SplicedText& replacement = replacementStack[i].replaceWith;
+                result.sourceMap.append(replacement.sourceMap, result.text.size());
+                result.text += replacement.text;
+            }
         }
 
-        return result.str();
+        return result;
     }
 
     string getCanonicalPath(const FileEntry* entry) const {
@@ -329,7 +359,7 @@ private:
             auto entry = replacementStack[i].includingFile;
             std::cerr << "<<<"
                 << (entry ? getCanonicalPath(entry) : std::string{"null"})
-                << " " << replacementStack[i].replaceWith << ">>>\n";
+                << " " << replacementStack[i].replaceWith.text << ">>>\n";
         }
     }
 };
@@ -351,6 +381,7 @@ public:
     {
         compiler.getPreprocessor().addPPCallbacks(std::unique_ptr<TrackMacro>(new TrackMacro(
                 compiler.getSourceManager(), state)));
+        Budget::watch(compiler);
         return true;
     }
 };
@@ -374,12 +405,15 @@ public:
 #endif
 };
 
-Inliner::Inliner(const vector<string>& cmdLineOptions_)
+Inliner::Inliner(const vector<string>& cmdLineOptions_,
+                 llvm::IntrusiveRefCntPtr<FileManager> fileManager_)
     : cmdLineOptions(cmdLineOptions_)
+    , fileManager(std::move(fileManager_))
 {}
 
-string Inliner::doInline(const string& cppFile) {
+string Inliner::doInline(const string& cppFile, const SourceMap* cppFileSourceMap) {
     ScopedTimer t("Inliner::doInline");
+    CAIDE_TRACE1(inline_begin, cppFile.c_str());
     std::unique_ptr<clang::tooling::FixedCompilationDatabase> compilationDatabase(
         createCompilationDatabaseFromCommandLine(cmdLineOptions));
 
@@ -389,15 +423,21 @@ string Inliner::doInline(const string& cppFile) {
     InlinerState state{"", inlinedPathsFromCommandLine};
     InlinerFrontendActionFactory factory(state);
 
-    clang::tooling::ClangTool tool(*compilationDatabase, sources);
+    std::unique_ptr<clang::tooling::ClangTool> tool =
+        createClangTool(*compilationDatabase, sources, fileManager);
 
     ScopedTimer t2("Inliner::tool.run");
-    int ret = tool.run(&factory);
+    int ret = tool->run(&factory);
 
     if (ret != 0)
         throw std::runtime_error("Compilation error");
 
+    sourceMap = std::move(state.sourceMap);
+    if (cppFileSourceMap)
+        sourceMap.resolveThrough(state.mainFile, *cppFileSourceMap);
+
     inlineResults.push_back(state.result);
+    CAIDE_TRACE1(inline_end, state.result.size());
     return state.result;
 }
 
@@ -6,21 +6,37 @@
 
 #pragma once
 
+#include "SourceMap.h"
+
+#include <llvm/ADT/IntrusiveRefCntPtr.h>
+
 #include <vector>
 #include <string>
 #include <unordered_set>
 
+namespace clang {
+    class FileManager;
+}
+
 namespace caide {
 namespace internal {
 
 // First inliner stage: inline included headers
 class Inliner {
 public:
-    explicit Inliner(const std::vector<std::string>& clangCommandLineOptions);
+    // If fileManager is not null, it is used for all file system access.
+    explicit Inliner(const std::vector<std::string>& clangCommandLineOptions,
+                     llvm::IntrusiveRefCntPtr<clang::FileManager> fileManager = nullptr);
 
     // The file is read in binary mode, so the returned string is also
     // 'in binary mode' (contains \r\n on Windows)
-    std::string doInline(const std::string& cppFile);
+    //
+    // If cppFile was itself generated, cppFileSourceMap describes its origin; the source
+    // map of the result then refers to the original files.
+    std::string doInline(const std::string& cppFile, const SourceMap* cppFileSourceMap = nullptr);
+
+    // Source map of the result of the last doInline() call.
+    const SourceMap& getSourceMap() const { return sourceMap; }
 
     // Return compilation options for the inlined file. Normally, they match
     // compilation options for the inliner provided in the constructor. But if
@@ -30,9 +46,11 @@ public:
 
 private:
     std::vector<std::string> cmdLineOptions;
+    llvm::IntrusiveRefCntPtr<clang::FileManager> fileManager;
     std::unordered_set<std::string> includedHeaders;
     std::vector<std::string> inlineResults;
     std::unordered_set<std::string> inlinedPathsFromCommandLine;
+    SourceMap sourceMap;
 };
 
 }
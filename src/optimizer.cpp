@@ -5,9 +5,13 @@
 // option) any later version. See LICENSE.TXT for details.
 
 #include "optimizer.h"
+#include "Budget.h"
+#include "caide_trace.h"
 #include "DependenciesCollector.h"
+#include "ErrorCollector.h"
 #include "MergeNamespacesVisitor.h"
 #include "OptimizerVisitor.h"
+#include "reachability.h"
 #include "RemoveInactivePreprocessorBlocks.h"
 #include "SmartRewriter.h"
 #include "SourceInfo.h"
@@ -114,30 +118,44 @@ public:
             std::unique_ptr<SmartRewriter> smartRewriter_,
             RemoveInactivePreprocessorBlocks& ppCallbacks_,
             const std::unordered_set<string>& identifiersToKeep_,
-            string& result_)
+            DependencyAnalysis dependencyAnalysis_,
+            string& result_, SourceMap& resultSourceMap_)
         : compiler(compiler_)
         , sourceManager(compiler.getSourceManager())
         , smartRewriter(std::move(smartRewriter_))
         , ppCallbacks(ppCallbacks_)
         , identifiersToKeep(identifiersToKeep_)
+        , dependencyAnalysis(dependencyAnalysis_)
         , result(result_)
+        , resultSourceMap(resultSourceMap_)
     {
     }
 
     virtual void HandleTranslationUnit(ASTContext& Ctx) override {
+        // The inliner reports an exceeded limit after the tool returns.
+        if (Budget::exceeded())
+            return;
+
         // 0. Collect auxiliary information.
         {
             ScopedTimer t("BuildNonImplicitDeclMap");
+            CAIDE_TRACE1(phase_begin, "BuildNonImplicitDeclMap");
             BuildNonImplicitDeclMap visitor(srcInfo);
             visitor.TraverseDecl(Ctx.getTranslationUnitDecl());
+            CAIDE_TRACE2(phase_end, "BuildNonImplicitDeclMap", srcInfo.nonImplicitDecls.size());
         }
 
         // 1. Build dependency graph for semantic declarations.
         {
             ScopedTimer t("DependenciesCollector");
+            CAIDE_TRACE1(phase_begin, "DependenciesCollector");
             clang::Sema& sema = compiler.getSema();
-            DependenciesCollector depsVisitor(sourceManager, sema, identifiersToKeep, srcInfo);
+            const bool approximate = dependencyAnalysis == DependencyAnalysis::Approximate;
+            DependenciesCollector depsVisitor(sourceManager, sema, identifiersToKeep, srcInfo, approximate);
             depsVisitor.TraverseDecl(Ctx.getTranslationUnitDecl());
+            if (approximate)
+                depsVisitor.addReferencesByName();
+            StatisticsCollector::count("dependencyGraph.repeatedTypesSkipped", depsVisitor.getNumSkippedTypes());
 
             // Source range of delayed-parsed template functions includes only declaration part.
             //     Force their parsing to get correct source ranges.
@@ -151,6 +169,7 @@ public:
                 sema.LateTemplateParser(sema.OpaqueParser, *lpt);
             }
             diag.setSuppressAllDiagnostics(suppressAll);
+            CAIDE_TRACE2(phase_end, "DependenciesCollector", srcInfo.uses.size());
 
 #ifdef CAIDE_DEBUG_MODE
             std::ofstream file("caide-graph.dot");
@@ -162,30 +181,42 @@ public:
         std::unordered_set<Decl*> used;
         {
             ScopedTimer t("BFS");
-            set<Decl*> queue;
+            CAIDE_TRACE1(phase_begin, "BFS");
+            set<Decl*> roots;
             for (Decl* decl : srcInfo.declsToKeep)
-                queue.insert(decl->getCanonicalDecl());
+                roots.insert(decl->getCanonicalDecl());
 
-            while (!queue.empty()) {
-                Decl* decl = *queue.begin();
-                queue.erase(queue.begin());
-                if (used.insert(decl).second)
-                    queue.insert(srcInfo.uses[decl].begin(), srcInfo.uses[decl].end());
-            }
+            used = findReachable<Decl*>(srcInfo.uses, roots);
+            CAIDE_TRACE2(phase_end, "BFS", used.size());
         }
 
+        std::uint64_t numEdges = 0;
+        for (const auto& kv : srcInfo.uses)
+            numEdges += kv.second.size();
+        StatisticsCollector::count("dependencyGraph.declarations", srcInfo.uses.size());
+        StatisticsCollector::count("dependencyGraph.edges", numEdges);
+        StatisticsCollector::count("dependencyGraph.reachable", used.size());
+        if (Budget::exceeded())
+            return;
+
         // 3. Remove unnecessary lexical declarations.
         std::unordered_set<Decl*> removedDecls;
         {
             ScopedTimer t("OptimizerVisitor");
-            OptimizerVisitor visitor(sourceManager, used, removedDecls, *smartRewriter);
+            CAIDE_TRACE1(phase_begin, "OptimizerVisitor");
+            OptimizerVisitor visitor(sourceManager, Ctx.getLangOpts(), used, removedDecls, *smartRewriter);
             visitor.TraverseDecl(Ctx.getTranslationUnitDecl());
-            visitor.Finalize(Ctx);
+            visitor.Finalize();
+            StatisticsCollector::count("optimizerVisitor.lexerRestarts", visitor.getNumLexerRestarts());
+            CAIDE_TRACE2(phase_end, "OptimizerVisitor", removedDecls.size());
         }
+        StatisticsCollector::count("removedDeclarations", removedDecls.size());
         {
             ScopedTimer t("MergeNamespacesVisitor");
+            CAIDE_TRACE1(phase_begin, "MergeNamespacesVisitor");
             MergeNamespacesVisitor visitor(sourceManager, removedDecls, *smartRewriter);
             visitor.TraverseDecl(Ctx.getTranslationUnitDecl());
+            CAIDE_TRACE2(phase_end, "MergeNamespacesVisitor", removedDecls.size());
         }
 
         // 4. Remove inactive preprocessor branches that have not yet been removed.
@@ -195,11 +226,14 @@ public:
         // Finalize() method that will actually use the information collected by callbacks
         // to remove unused preprocessor code
         ScopedTimer t("Finalize+Rewrite");
+        CAIDE_TRACE1(phase_begin, "Finalize+Rewrite");
         ppCallbacks.Finalize();
 
         smartRewriter->applyChanges();
 
         result = getResult();
+        resultSourceMap = smartRewriter->getSourceMap();
+        CAIDE_TRACE2(phase_end, "Finalize+Rewrite", result.size());
     }
 
 private:
@@ -229,7 +263,9 @@ private:
     std::unique_ptr<SmartRewriter> smartRewriter;
     RemoveInactivePreprocessorBlocks& ppCallbacks;
     const std::unordered_set<string>& identifiersToKeep;
+    DependencyAnalysis dependencyAnalysis;
     string& result;
+    SourceMap& resultSourceMap;
     SourceInfo srcInfo;
 };
 
@@ -237,14 +273,23 @@ private:
 class OptimizerFrontendAction : public ASTFrontendAction {
 private:
     string& result;
+    SourceMap& resultSourceMap;
     const set<string>& macrosToKeep;
     const std::unordered_set<string>& identifiersToKeep;
+    DependencyAnalysis dependencyAnalysis;
+    const PreambleOptions& preambleOptions;
 public:
-    OptimizerFrontendAction(string& result_, const std::set<string>& macrosToKeep_,
-            const std::unordered_set<string>& identifiersToKeep_)
+    OptimizerFrontendAction(string& result_, SourceMap& resultSourceMap_,
+            const std::set<string>& macrosToKeep_,
+            const std::unordered_set<string>& identifiersToKeep_,
+            DependencyAnalysis dependencyAnalysis_,
+            const PreambleOptions& preambleOptions_)
         : result(result_)
+        , resultSourceMap(resultSourceMap_)
         , macrosToKeep(macrosToKeep_)
         , identifiersToKeep(identifiersToKeep_)
+        , dependencyAnalysis(dependencyAnalysis_)
+        , preambleOptions(preambleOptions_)
     {}
 
     virtual std::unique_ptr<ASTConsumer> CreateASTConsumer(CompilerInstance& compiler, StringRef /*file*/) override
@@ -252,13 +297,15 @@ public:
         if (!compiler.hasSourceManager())
             throw "No source manager";
         auto smartRewriter = std::unique_ptr<SmartRewriter>(
-            new SmartRewriter(compiler.getSourceManager(), compiler.getLangOpts()));
+            new SmartRewriter(compiler.getSourceManager(), compiler.getLangOpts(), preambleOptions));
         auto ppCallbacks = std::unique_ptr<RemoveInactivePreprocessorBlocks>(
             new RemoveInactivePreprocessorBlocks(compiler.getSourceManager(), compiler.getLangOpts(),
                 *smartRewriter, macrosToKeep));
         auto consumer = std::unique_ptr<OptimizerConsumer>(
-            new OptimizerConsumer(compiler, std::move(smartRewriter), *ppCallbacks, identifiersToKeep, result));
+            new OptimizerConsumer(compiler, std::move(smartRewriter), *ppCallbacks, identifiersToKeep,
+                dependencyAnalysis, result, resultSourceMap));
         compiler.getPreprocessor().addPPCallbacks(std::move(ppCallbacks));
+        Budget::watch(compiler);
         return consumer;
     }
 };
@@ -266,67 +313,54 @@ public:
 class OptimizerFrontendActionFactory: public tooling::FrontendActionFactory {
 private:
     string& result;
+    SourceMap& resultSourceMap;
     const std::set<string>& macrosToKeep;
     const std::unordered_set<string>& identifiersToKeep;
+    DependencyAnalysis dependencyAnalysis;
+    const PreambleOptions& preambleOptions;
 public:
-    OptimizerFrontendActionFactory(string& result_, const std::set<string>& macrosToKeep_,
-            const std::unordered_set<string>& identifiersToKeep_)
+    OptimizerFrontendActionFactory(string& result_, SourceMap& resultSourceMap_,
+            const std::set<string>& macrosToKeep_,
+            const std::unordered_set<string>& identifiersToKeep_,
+            DependencyAnalysis dependencyAnalysis_,
+            const PreambleOptions& preambleOptions_)
         : result(result_)
+        , resultSourceMap(resultSourceMap_)
         , macrosToKeep(macrosToKeep_)
         , identifiersToKeep(identifiersToKeep_)
+        , dependencyAnalysis(dependencyAnalysis_)
+        , preambleOptions(preambleOptions_)
     {}
 #if CAIDE_CLANG_VERSION_AT_LEAST(10, 0)
     std::unique_ptr<FrontendAction> create() override {
-        return std::make_unique<OptimizerFrontendAction>(result, macrosToKeep, identifiersToKeep);
+        return std::make_unique<OptimizerFrontendAction>(result, resultSourceMap, macrosToKeep,
+                                                         identifiersToKeep, dependencyAnalysis, preambleOptions);
     }
 #else
     FrontendAction* create() override {
-        return new OptimizerFrontendAction(result, macrosToKeep, identifiersToKeep);
+        return new OptimizerFrontendAction(result, resultSourceMap, macrosToKeep, identifiersToKeep,
+                                           dependencyAnalysis, preambleOptions);
     }
 #endif
 };
 
-// Like clang::TextDiagnosticBuffer, but resolves source locations eagerly and
-// adds them to error messages.
-class ErrorCollector: public DiagnosticConsumer {
-public:
-    void HandleDiagnostic(DiagnosticsEngine::Level DiagLevel, const Diagnostic& Info) override {
-        // Default implementation (Warnings/errors count).
-        DiagnosticConsumer::HandleDiagnostic(DiagLevel, Info);
-        if (DiagLevel >= DiagnosticsEngine::Level::Error) {
-            string message;
-            if (Info.hasSourceManager()) {
-                message = Info.getLocation().printToString(Info.getSourceManager());
-                message += ": ";
-            }
-            llvm::SmallVector<char, 256> buffer;
-            Info.FormatDiagnostic(buffer);
-            message += string(buffer.data(), buffer.size());
-            errors.push_back(std::move(message));
-        }
-    }
-
-    void clear() override {
-        DiagnosticConsumer::clear();
-        errors.clear();
-    }
-
-    const vector<string>& getErrors() const { return errors; }
-
-private:
-    vector<string> errors;
-};
-
 Optimizer::Optimizer(const vector<string>& cmdLineOptions_,
                      const vector<string>& macrosToKeep_,
-                     const std::vector<std::string>& identifiersToKeep_)
+                     const std::vector<std::string>& identifiersToKeep_,
+                     llvm::IntrusiveRefCntPtr<FileManager> fileManager_,
+                     DependencyAnalysis dependencyAnalysis_,
+                     PreambleOptions preambleOptions_)
     : cmdLineOptions(cmdLineOptions_)
     , macrosToKeep(macrosToKeep_.begin(), macrosToKeep_.end())
     , identifiersToKeep(identifiersToKeep_.begin(), identifiersToKeep_.end())
+    , fileManager(std::move(fileManager_))
+    , dependencyAnalysis(dependencyAnalysis_)
+    , preambleOptions(std::move(preambleOptions_))
 {}
 
-string Optimizer::doOptimize(const string& cppFile) {
+string Optimizer::doOptimize(const string& cppFile, const SourceMap* sourceMap) {
     ScopedTimer t("Optimizer::doOptimize");
+    CAIDE_TRACE2(optimize_begin, cppFile.c_str(), dependencyAnalysis == DependencyAnalysis::Approximate ? 1 : 0);
     std::unique_ptr<tooling::FixedCompilationDatabase> compilationDatabase(
         createCompilationDatabaseFromCommandLine(cmdLineOptions));
 
@@ -334,14 +368,18 @@ string Optimizer::doOptimize(const string& cppFile) {
     sources.push_back(cppFile);
 
     ErrorCollector errors;
-    clang::tooling::ClangTool tool(*compilationDatabase, sources);
-    tool.setDiagnosticConsumer(&errors);
+    errors.setSourceMap(sourceMap);
+    std::unique_ptr<clang::tooling::ClangTool> tool =
+        createClangTool(*compilationDatabase, sources, fileManager);
+    tool->setDiagnosticConsumer(&errors);
 
     string result;
-    OptimizerFrontendActionFactory factory(result, macrosToKeep, identifiersToKeep);
+    resultSourceMap = SourceMap();
+    OptimizerFrontendActionFactory factory(result, resultSourceMap, macrosToKeep, identifiersToKeep,
+                                           dependencyAnalysis, preambleOptions);
 
     ScopedTimer t2("Optimizer::tool.run");
-    int ret = tool.run(&factory);
+    int ret = tool->run(&factory);
     if (ret != 0) {
         string message = "Inliner failed.";
         if (!errors.getErrors().empty()) {
@@ -354,6 +392,10 @@ string Optimizer::doOptimize(const string& cppFile) {
         throw std::runtime_error(message.c_str());
     }
 
+    if (sourceMap && !resultSourceMap.getFiles().empty())
+        resultSourceMap.resolveThrough(0, *sourceMap);
+
+    CAIDE_TRACE1(optimize_end, result.size());
     return result;
 }
 
@@ -6,29 +6,61 @@
 
 #pragma once
 
+#include "SmartRewriter.h"
+#include "SourceMap.h"
+
+#include <llvm/ADT/IntrusiveRefCntPtr.h>
+
 #include <vector>
 #include <set>
 #include <string>
 #include <unordered_set>
 
+namespace clang {
+    class FileManager;
+}
+
 namespace caide {
 namespace internal {
 
+enum class DependencyAnalysis {
+    // Dependencies are collected from all template instantiations.
+    Exact,
+    // Template instantiations are not traversed. Instead, dependencies of templates
+    // are over-approximated by name. Faster, but the result may keep more code than
+    // necessary or (rarely) miss a declaration needed by an instantiation; callers
+    // must verify that the result compiles.
+    Approximate,
+};
+
 // Second inliner stage: remove unused code
 class Optimizer {
 public:
     Optimizer(const std::vector<std::string>& cmdLineOptions,
               const std::vector<std::string>& macrosToKeep,
-              const std::vector<std::string>& identifiersToKeep);
+              const std::vector<std::string>& identifiersToKeep,
+              llvm::IntrusiveRefCntPtr<clang::FileManager> fileManager = nullptr,
+              DependencyAnalysis dependencyAnalysis = DependencyAnalysis::Exact,
+              PreambleOptions preambleOptions = {});
 
     // The file is read in binary mode, so the returned string is also
     // 'in binary mode' (contains \r\n on Windows)
-    std::string doOptimize(const std::string& cppFile);
+    //
+    // If sourceMap is not null, compilation errors are reported in the original files.
+    std::string doOptimize(const std::string& cppFile, const SourceMap* sourceMap = nullptr);
+
+    // Source map of the result of the last doOptimize() call. Refers to the original files
+    // if sourceMap was passed to doOptimize(), and to cppFile otherwise.
+    const SourceMap& getSourceMap() const { return resultSourceMap; }
 
 private:
     std::vector<std::string> cmdLineOptions;
+    llvm::IntrusiveRefCntPtr<clang::FileManager> fileManager;
     std::set<std::string> macrosToKeep;
     std::unordered_set<std::string> identifiersToKeep;
+    DependencyAnalysis dependencyAnalysis;
+    PreambleOptions preambleOptions;
+    SourceMap resultSourceMap;
 };
 
 }
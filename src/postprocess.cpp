@@ -0,0 +1,115 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#include "postprocess.h"
+#include "SourceMap.h"
+
+#include <algorithm>
+#include <limits>
+#include <ostream>
+#include <sstream>
+#include <string>
+
+
+using std::istringstream;
+using std::string;
+
+
+namespace caide {
+namespace internal {
+
+// Certain directives become invalid after the first stage (inliner) runs. Those include:
+// * #pragma once (used to be in a header, now in the inlined source file).
+// * #line number [file name] (became incorrect due to inlining header files).
+//
+// This is technically incorrect due to multiline directives and strings.
+static bool isInvalidDirective(const char* lineBegin, const char* lineEnd) {
+    // Directives are compared ignoring whitespace.
+    static const struct {
+        const char* text;
+        bool wholeLine;
+    } directives[] = {{"#pragmaonce", true}, {"#line", false}};
+    auto isSpace = [](char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; };
+
+    for (const auto& directive : directives) {
+        const char* p = lineBegin;
+        const char* expected = directive.text;
+        for (; p != lineEnd && *expected; ++p) {
+            if (isSpace(*p))
+                continue;
+            if (*p != *expected)
+                break;
+            ++expected;
+        }
+        if (*expected)
+            continue;
+        if (!directive.wholeLine || std::all_of(p, lineEnd, isSpace))
+            return true;
+    }
+    return false;
+}
+
+void appendWithoutInvalidDirectives(const char* fileStart, const char* begin, const char* end,
+                                    std::uint32_t file, string& out, SourceMap& sourceMap)
+{
+    // A directive can only start at the beginning of a line.
+    bool atLineStart = begin == fileStart || begin[-1] == '\n';
+    for (const char* lineBegin = begin; lineBegin != end; atLineStart = true) {
+        const char* lineEnd = std::find(lineBegin, end, '\n');
+        if (lineEnd != end)
+            ++lineEnd;
+        if (!atLineStart || !isInvalidDirective(lineBegin, lineEnd)) {
+            sourceMap.addSegment(out.size(), file, lineBegin - fileStart);
+            out.append(lineBegin, lineEnd);
+        }
+        lineBegin = lineEnd;
+    }
+}
+
+static bool isWhitespaceOnly(const string& text) {
+    return text.find_first_not_of(" \t\r") == string::npos;
+}
+
+static void removeEmptyLines(const string& textInBinaryMode, int maxConsequentEmptyLines, std::ostream& out,
+                             std::uint32_t file, SourceMap* sourceMap)
+{
+    if (maxConsequentEmptyLines < 0)
+        maxConsequentEmptyLines = std::numeric_limits<int>::max();
+    istringstream in{textInBinaryMode};
+    int currentConsequentEmptyLines = 0;
+    bool readNonEmptyLine = false;
+    string line;
+    std::uint64_t inputOffset = 0, outputOffset = 0;
+    while (std::getline(in, line)) {
+        if (isWhitespaceOnly(line))
+            ++currentConsequentEmptyLines;
+        else {
+            currentConsequentEmptyLines = 0;
+            readNonEmptyLine = true;
+        }
+
+        if (readNonEmptyLine && currentConsequentEmptyLines <= maxConsequentEmptyLines) {
+            if (sourceMap)
+                sourceMap->addSegment(outputOffset, file, inputOffset);
+            out << line << '\n';
+            outputOffset += line.size() + 1;
+        }
+        inputOffset += line.size() + 1;
+    }
+}
+
+void removeEmptyLines(const string& textInBinaryMode, int maxConsequentEmptyLines, std::ostream& out) {
+    removeEmptyLines(textInBinaryMode, maxConsequentEmptyLines, out, 0, nullptr);
+}
+
+void removeEmptyLines(const string& textInBinaryMode, int maxConsequentEmptyLines, std::ostream& out,
+                      std::uint32_t file, SourceMap& sourceMap)
+{
+    removeEmptyLines(textInBinaryMode, maxConsequentEmptyLines, out, file, &sourceMap);
+}
+
+}
+}
@@ -0,0 +1,39 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#pragma once
+
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+
+namespace caide {
+namespace internal {
+
+class SourceMap;
+
+// Text passes applied to the results of inliner stages. Input and output are 'in binary mode'
+// (may contain \r\n).
+
+// Appends the part [begin, end) of a file starting at fileStart to out, dropping directives
+// that become invalid after the first stage (#pragma once, #line), and records the origin
+// of the appended text in sourceMap.
+void appendWithoutInvalidDirectives(const char* fileStart, const char* begin, const char* end,
+                                    std::uint32_t file, std::string& out, SourceMap& sourceMap);
+
+// Limits the number of consecutive empty lines and removes empty lines at the beginning.
+// A negative limit means that empty lines are not removed.
+void removeEmptyLines(const std::string& textInBinaryMode, int maxConsequentEmptyLines,
+                      std::ostream& out);
+
+// Same, and records the origin of the output in sourceMap: offsets in the input are offsets
+// in file.
+void removeEmptyLines(const std::string& textInBinaryMode, int maxConsequentEmptyLines,
+                      std::ostream& out, std::uint32_t file, SourceMap& sourceMap);
+
+}
+}
+
@@ -0,0 +1,38 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#pragma once
+
+#include <set>
+#include <unordered_set>
+
+namespace caide {
+namespace internal {
+
+// Finds all nodes reachable from roots in a graph. The graph is an associative container
+// mapping a node to a container of its successors (e.g. SourceInfo::uses); nodes without
+// successors may be missing from it.
+template<typename Node, typename Graph, typename Roots>
+std::unordered_set<Node> findReachable(const Graph& graph, const Roots& roots) {
+    std::unordered_set<Node> reachable;
+    std::set<Node> queue(roots.begin(), roots.end());
+
+    while (!queue.empty()) {
+        Node node = *queue.begin();
+        queue.erase(queue.begin());
+        if (reachable.insert(node).second) {
+            auto it = graph.find(node);
+            if (it != graph.end())
+                queue.insert(it->second.begin(), it->second.end());
+        }
+    }
+
+    return reachable;
+}
+
+}
+}
+
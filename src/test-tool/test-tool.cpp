@@ -5,15 +5,20 @@
 // option) any later version. See LICENSE.TXT for details.
 
 #include "../caideInliner.hpp"
+#include "../SourceMap.h"
 
 #include <algorithm>
+#include <cstdint>
 #include <fstream>
 #include <iostream>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <utility>
 #include <vector>
 
+#include <sys/stat.h>
+
 
 using std::ifstream;
 using std::string;
@@ -36,7 +41,306 @@ static string pathConcat(const string& directory, const string& fileName) {
     return directory + "/" + fileName;
 }
 
-static bool runTest(const string& testDirectory, const string& tempDirectory, caide::CppInliner inliner) {
+// One option per line of inlinerOptions.txt, or passed with --option:
+//   approximateDependencies
+//   canonicalIncludes
+//   includePrelude <file in test directory>
+//   moduleCache                 (modules are cached in the temporary directory)
+//   headerBundle                (system headers of the test are read from a bundle built
+//                                in the temporary directory)
+//   expectCounter <name> <value>
+//                               (the counter of InlinerStatistics, 0 if absent; of the first
+//                                job in batch tests)
+//   expectCounterOnRerun <name> (the test is run twice; the counter of InlinerStatistics
+//                                must be positive in the second run)
+//   expectOutputUnchangedOnRerun
+//                               (the test is run twice; the second run must leave the output
+//                                and its modification time untouched, and a third run with an
+//                                extra declaration in the last file must rewrite the output)
+//   batch <file in test directory>
+//                               (the test is run with inlineBatch(), together with a copy of
+//                                its files and two jobs inlining the file, which must fail
+//                                to compile)
+//   precompileSharedPrefix
+//   limit <field> <value>       (a field of InlinerLimits)
+//   expectLimitExceeded <field> (inlineCode() must fail with LimitExceededError for the limit;
+//                                there is no etalon)
+//   writeSourceMap
+//   expectMapped <token> <file> (the first occurrence of the token in the output must be
+//                                mapped to its first occurrence in the file of the test)
+//   verifyOutput
+//   expectError <text>          (inlineCode() must fail with an error containing the text;
+//                                there is no etalon)
+struct TestSettings {
+    bool buildHeaderBundle = false;
+    vector<std::pair<string, unsigned long long>> expectedCounters;
+    vector<string> countersOnRerun;
+    bool expectOutputUnchangedOnRerun = false;
+    string batchFailingFile;
+    string expectedExceededLimit;
+    string expectedError;
+    vector<std::pair<string, string>> expectedMappings;
+};
+
+static void applyInlinerOption(const string& option, const string& testDirectory, const string& tempDirectory,
+                               caide::CppInliner& inliner, TestSettings& settings)
+{
+    std::istringstream fields{option};
+    string name, value;
+    fields >> name >> value;
+    if (name == "approximateDependencies")
+        inliner.approximateDependencies = true;
+    else if (name == "canonicalIncludes")
+        inliner.canonicalIncludes = true;
+    else if (name == "includePrelude")
+        inliner.includePrelude = pathConcat(testDirectory, value);
+    else if (name == "moduleCache")
+        inliner.moduleCacheDirectory = pathConcat(tempDirectory, "modules");
+    else if (name == "headerBundle")
+        settings.buildHeaderBundle = true;
+    else if (name == "expectCounter") {
+        unsigned long long expected = 0;
+        fields >> expected;
+        settings.expectedCounters.emplace_back(value, expected);
+    } else if (name == "expectCounterOnRerun")
+        settings.countersOnRerun.push_back(value);
+    else if (name == "expectOutputUnchangedOnRerun")
+        settings.expectOutputUnchangedOnRerun = true;
+    else if (name == "precompileSharedPrefix")
+        inliner.precompileSharedPrefix = true;
+    else if (name == "batch")
+        settings.batchFailingFile = pathConcat(testDirectory, value);
+    else if (name == "limit" && value == "wallMilliseconds")
+        fields >> inliner.limits.wallMilliseconds;
+    else if (name == "limit" && value == "cpuMilliseconds")
+        fields >> inliner.limits.cpuMilliseconds;
+    else if (name == "limit" && value == "megabytes")
+        fields >> inliner.limits.megabytes;
+    else if (name == "limit" && value == "outputBytes")
+        fields >> inliner.limits.outputBytes;
+    else if (name == "expectLimitExceeded")
+        settings.expectedExceededLimit = value;
+    else if (name == "writeSourceMap")
+        inliner.writeSourceMap = true;
+    else if (name == "expectMapped") {
+        string file;
+        fields >> file;
+        settings.expectedMappings.emplace_back(value, file);
+    } else if (name == "verifyOutput")
+        inliner.verifyOutput = true;
+    else if (name == "expectError")
+        settings.expectedError = value;
+    else
+        throw std::runtime_error("Unknown inliner option: " + option);
+}
+
+static unsigned long long getCounter(const caide::InlinerStatistics& statistics, const string& name) {
+    for (const auto& counter : statistics.counters) {
+        if (counter.first == name)
+            return counter.second;
+    }
+    return 0;
+}
+
+static string readFile(const string& filePath) {
+    ifstream file{filePath.c_str(), std::ios::binary};
+    std::ostringstream contents;
+    contents << file.rdbuf();
+    return contents.str();
+}
+
+// Modification time of the file in nanoseconds (seconds where the OS doesn't report more),
+// or -1 if the file doesn't exist.
+static long long getModificationTime(const string& filePath) {
+    struct stat st;
+    if (stat(filePath.c_str(), &st) != 0)
+        return -1;
+#if defined(__linux__)
+    return st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+#else
+    return st.st_mtime * 1000000000LL;
+#endif
+}
+
+// Runs the inliner again on the same files, then on a copy of the last file with an extra
+// declaration that must be kept in the output.
+static bool checkRerunOutputUnchanged(const string& tempDirectory, const string& testDirectory,
+                                      caide::CppInliner inliner, vector<string> cppFiles,
+                                      const string& outputFilePath, const string& etalonFilePath)
+{
+    if (getModificationTime(outputFilePath + ".hash") < 0) {
+        std::cout << "No " << outputFilePath << ".hash after the first run\n";
+        return false;
+    }
+
+    const long long modificationTime = getModificationTime(outputFilePath);
+    caide::InlinerStatistics statistics;
+    inliner.inlineCode(cppFiles, outputFilePath, statistics);
+    if (!statistics.outputUnchanged) {
+        std::cout << "Output was rewritten in the second run\n";
+        return false;
+    }
+    if (getModificationTime(outputFilePath) != modificationTime) {
+        std::cout << "Modification time of the output changed in the second run\n";
+        return false;
+    }
+    if (readNonEmptyLines(outputFilePath) != readNonEmptyLines(etalonFilePath)) {
+        std::cout << "Different output in the second run\n";
+        return false;
+    }
+
+    // The copy lives in the temporary directory; quoted includes of the test are found with -I.
+    const string changedFilePath = pathConcat(tempDirectory, "changed-input.cpp");
+    {
+        std::ofstream changedFile{changedFilePath.c_str(), std::ios::binary};
+        changedFile << readFile(cppFiles.back()) << "\n/// caide keep\nint changedInput;\n";
+    }
+    cppFiles.back() = changedFilePath;
+    inliner.clangCompilationOptions.push_back("-I" + testDirectory);
+    inliner.inlineCode(cppFiles, outputFilePath, statistics);
+    if (statistics.outputUnchanged) {
+        std::cout << "Output was not rewritten after the input changed\n";
+        return false;
+    }
+    if (readFile(outputFilePath).find("changedInput") == string::npos) {
+        std::cout << "Output doesn't reflect the changed input\n";
+        return false;
+    }
+
+    return true;
+}
+
+static bool checkSourceMap(const string& outputFilePath, const string& testDirectory,
+                           const vector<std::pair<string, string>>& expectedMappings)
+{
+    const string output = readFile(outputFilePath);
+    const caide::internal::SourceMap sourceMap =
+        caide::internal::SourceMap::deserialize(readFile(outputFilePath + ".map"));
+    for (const auto& mapping : expectedMappings) {
+        const string& token = mapping.first;
+        const string& file = mapping.second;
+        const string::size_type outputOffset = output.find(token);
+        const string::size_type expectedOffset = readFile(pathConcat(testDirectory, file)).find(token);
+        if (outputOffset == string::npos || expectedOffset == string::npos) {
+            std::cout << "Token " << token << " not found\n";
+            return false;
+        }
+
+        string path;
+        std::uint64_t fileOffset = 0;
+        const bool mapped = sourceMap.lookup(outputOffset, path, fileOffset);
+        const string fileName = path.substr(path.find_last_of("/\\") + 1);
+        if (!mapped || fileName != file || fileOffset != expectedOffset) {
+            std::cout << "Token " << token << " is mapped to " << (mapped ? path : "nothing") << ":"
+                      << fileOffset << ", expected " << file << ":" << expectedOffset << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool checkCounters(const caide::InlinerStatistics& statistics,
+                          const vector<std::pair<string, unsigned long long>>& expectedCounters)
+{
+    for (const auto& counter : expectedCounters) {
+        const unsigned long long value = getCounter(statistics, counter.first);
+        if (value != counter.second) {
+            std::cout << "Counter " << counter.first << " is " << value << ", expected " << counter.second << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool compareWithEtalon(const string& outputFilePath, const string& etalonFilePath) {
+    const vector<string> output = readNonEmptyLines(outputFilePath);
+    const vector<string> etalon = readNonEmptyLines(etalonFilePath);
+
+    const int minLength = (int)std::min(output.size(), etalon.size());
+    for (int i = 0; i < minLength; ++i) {
+        // TODO: Print line numbers
+        if (output[i] != etalon[i]) {
+            std::cout
+                << "< " << etalon[i] << "\n"
+                << "> " << output[i] << "\n";
+            return false;
+        }
+    }
+
+    if (output.size() < etalon.size()) {
+        std::cout << "Unexpected end of file: " << outputFilePath << "\n";
+        return false;
+    }
+
+    if (output.size() > etalon.size()) {
+        std::cout << "Unexpected end of file: " << etalonFilePath << "\n";
+        return false;
+    }
+
+    return true;
+}
+
+// Jobs:
+//   0: the test files (runs)
+//   1: copies of the test files (same contents: waits for job 0 and copies its output)
+//   2: the failing file (runs and fails)
+//   3: the failing file (waits for job 2 and copies its error)
+// One thread per job, so that the duplicates start while their leaders run.
+static bool runBatchTest(const string& testDirectory, const string& tempDirectory, const caide::CppInliner& inliner,
+                         const vector<string>& cppFiles, const TestSettings& settings)
+{
+    vector<caide::InlinerJob> jobs(4);
+    jobs[0].cppFilePaths = cppFiles;
+    for (const string& cppFile : cppFiles) {
+        const string fileName = cppFile.substr(cppFile.find_last_of("/\\") + 1);
+        const string copyPath = pathConcat(tempDirectory, "batch-copy-" + fileName);
+        ifstream in{cppFile.c_str(), std::ios::binary};
+        std::ofstream out{copyPath.c_str(), std::ios::binary};
+        out << in.rdbuf();
+        jobs[1].cppFilePaths.push_back(copyPath);
+    }
+    jobs[2].cppFilePaths.push_back(settings.batchFailingFile);
+    jobs[3].cppFilePaths.push_back(settings.batchFailingFile);
+    for (std::size_t i = 0; i < jobs.size(); ++i)
+        jobs[i].outputFilePath = pathConcat(tempDirectory, "batch-" + std::to_string(i) + ".cpp");
+
+    const vector<caide::InlinerJobResult> results = inliner.inlineBatch(jobs, (int)jobs.size());
+
+    const int expectedDuplicateOf[] = {-1, 0, -1, 2};
+    for (std::size_t i = 0; i < jobs.size(); ++i) {
+        if (results[i].duplicateOf != expectedDuplicateOf[i]) {
+            std::cout << "Job " << i << " is a duplicate of " << results[i].duplicateOf
+                      << ", expected " << expectedDuplicateOf[i] << "\n";
+            return false;
+        }
+    }
+
+    for (std::size_t i = 0; i < 2; ++i) {
+        if (!results[i].error.empty()) {
+            std::cout << "Job " << i << " failed: " << results[i].error << "\n";
+            return false;
+        }
+        if (!compareWithEtalon(jobs[i].outputFilePath, pathConcat(testDirectory, "etalon.cpp")))
+            return false;
+    }
+    if (!checkCounters(results[0].statistics, settings.expectedCounters))
+        return false;
+
+    if (results[2].error.empty()) {
+        std::cout << "Job 2 didn't fail\n";
+        return false;
+    }
+    if (results[3].error != results[2].error) {
+        std::cout << "Job 3 failed with a different error: " << results[3].error << "\n";
+        return false;
+    }
+
+    return true;
+}
+
+static bool runTest(const string& testDirectory, const string& tempDirectory, caide::CppInliner inliner,
+                    const vector<string>& extraOptions)
+{
     // Setup
     vector<string> cppFiles = readNonEmptyLines(pathConcat(testDirectory, "fileList.txt"));
     for (string& s : cppFiles)
@@ -73,44 +377,92 @@ static bool runTest(const string& testDirectory, const string& tempDirectory, ca
     inliner.macrosToKeep = readNonEmptyLines(pathConcat(testDirectory, "macrosToKeep.txt"));
     inliner.identifiersToKeep = readNonEmptyLines(pathConcat(testDirectory, "identifiersToKeep.txt"));
 
-    const string outputFilePath = pathConcat(tempDirectory, "result.cpp");
+    vector<string> options = readNonEmptyLines(pathConcat(testDirectory, "inlinerOptions.txt"));
+    options.insert(options.end(), extraOptions.begin(), extraOptions.end());
+    TestSettings settings;
+    for (const string& option : options)
+        applyInlinerOption(option, testDirectory, tempDirectory, inliner, settings);
 
-    // Run
-    inliner.inlineCode(cppFiles, outputFilePath);
+    if (settings.buildHeaderBundle) {
+        inliner.headerBundle = pathConcat(tempDirectory, "headers.bundle");
+        inliner.buildHeaderBundle(inliner.headerBundle, cppFiles);
+    }
 
-    // Assert
-    const string etalonFilePath = pathConcat(testDirectory, "etalon.cpp");
-    const vector<string> output = readNonEmptyLines(outputFilePath);
-    const vector<string> etalon = readNonEmptyLines(etalonFilePath);
+    if (!settings.batchFailingFile.empty())
+        return runBatchTest(testDirectory, tempDirectory, inliner, cppFiles, settings);
 
-    const int minLength = (int)std::min(output.size(), etalon.size());
-    for (int i = 0; i < minLength; ++i) {
-        // TODO: Print line numbers
-        if (output[i] != etalon[i]) {
-            std::cout
-                << "< " << etalon[i] << "\n"
-                << "> " << output[i] << "\n";
+    const string outputFilePath = pathConcat(tempDirectory, "result.cpp");
+
+    // Run
+    if (!settings.expectedExceededLimit.empty()) {
+        try {
+            inliner.inlineCode(cppFiles, outputFilePath);
+        } catch (const caide::LimitExceededError& e) {
+            if (e.getLimit() == settings.expectedExceededLimit)
+                return true;
+            std::cout << "Unexpected limit exceeded: " << e.what() << "\n";
             return false;
         }
+        std::cout << "Limit " << settings.expectedExceededLimit << " was not exceeded\n";
+        return false;
     }
 
-    if (output.size() < etalon.size()) {
-        std::cout << "Unexpected end of file: " << outputFilePath << "\n";
+    if (!settings.expectedError.empty()) {
+        try {
+            inliner.inlineCode(cppFiles, outputFilePath);
+        } catch (const std::exception& e) {
+            if (string(e.what()).find(settings.expectedError) != string::npos)
+                return true;
+            std::cout << "Unexpected error: " << e.what() << "\n";
+            return false;
+        }
+        std::cout << "No error containing " << settings.expectedError << "\n";
         return false;
     }
 
-    if (output.size() > etalon.size()) {
-        std::cout << "Unexpected end of file: " << etalonFilePath << "\n";
+    caide::InlinerStatistics firstRunStatistics;
+    inliner.inlineCode(cppFiles, outputFilePath, firstRunStatistics);
+
+    // Assert
+    const string etalonFilePath = pathConcat(testDirectory, "etalon.cpp");
+    if (!compareWithEtalon(outputFilePath, etalonFilePath))
         return false;
+
+    if (!settings.expectedMappings.empty() &&
+            !checkSourceMap(outputFilePath, testDirectory, settings.expectedMappings))
+        return false;
+
+    if (!checkCounters(firstRunStatistics, settings.expectedCounters))
+        return false;
+
+    if (!settings.countersOnRerun.empty()) {
+        caide::InlinerStatistics statistics;
+        inliner.inlineCode(cppFiles, outputFilePath, statistics);
+        if (readNonEmptyLines(outputFilePath) != readNonEmptyLines(etalonFilePath)) {
+            std::cout << "Different output in the second run\n";
+            return false;
+        }
+        for (const string& name : settings.countersOnRerun) {
+            if (getCounter(statistics, name) == 0) {
+                std::cout << "Counter " << name << " is zero in the second run\n";
+                return false;
+            }
+        }
     }
 
+    if (settings.expectOutputUnchangedOnRerun &&
+            !checkRerunOutputUnchanged(tempDirectory, testDirectory, inliner, cppFiles,
+                                       outputFilePath, etalonFilePath))
+        return false;
+
     return true;
 }
 
 
 int main(int argc, char* argv[]) {
     if (argc < 3) {
-        std::cout << "Usage: test-tool <temp-directory> <compilation-options-file> [<test-directory>...]\n";
+        std::cout << "Usage: test-tool <temp-directory> <compilation-options-file>"
+                     " [--option <inliner option>...] [<test-directory>...]\n";
         return 1;
     }
 
@@ -128,10 +480,20 @@ int main(int argc, char* argv[]) {
 
     inliner.clangCompilationOptions = readNonEmptyLines(argv[2]);
 
-    int numFailedTests = 0;
+    // Options applied to all tests, in addition to their inlinerOptions.txt
+    vector<string> extraOptions;
+    vector<string> testDirectories;
     for (int i = 3; i < argc; ++i) {
+        if (string(argv[i]) == "--option" && i + 1 < argc)
+            extraOptions.push_back(argv[++i]);
+        else
+            testDirectories.push_back(argv[i]);
+    }
+
+    int numFailedTests = 0;
+    for (const string& testDirectory : testDirectories) {
         try {
-            if (!runTest(argv[i], tempDirectory, inliner)) {
+            if (!runTest(testDirectory, tempDirectory, inliner, extraOptions)) {
                 ++numFailedTests;
             }
         } catch (const std::exception& e) {
@@ -16,6 +16,7 @@
 #include <clang/Lex/Lexer.h>
 #include <clang/Lex/Preprocessor.h>
 #include <clang/Tooling/CompilationDatabase.h>
+#include <clang/Tooling/Tooling.h>
 
 #include <llvm/Support/raw_ostream.h>
 
@@ -134,6 +135,20 @@ std::unique_ptr<tooling::FixedCompilationDatabase> createCompilationDatabaseFrom
 #endif
 }
 
+std::unique_ptr<tooling::ClangTool> createClangTool(
+        const tooling::CompilationDatabase& compilationDatabase,
+        const std::vector<std::string>& sources,
+        llvm::IntrusiveRefCntPtr<FileManager> fileManager)
+{
+#if CAIDE_CLANG_VERSION_AT_LEAST(10, 0)
+    return std::unique_ptr<tooling::ClangTool>(new tooling::ClangTool(compilationDatabase, sources,
+        std::make_shared<PCHContainerOperations>(), llvm::vfs::getRealFileSystem(), fileManager));
+#else
+    (void)fileManager;
+    return std::unique_ptr<tooling::ClangTool>(new tooling::ClangTool(compilationDatabase, sources));
+#endif
+}
+
 std::string rangeToString(SourceManager& sourceManager, const SourceLocation& start, const SourceLocation& end) {
     bool invalid;
     const char* b = sourceManager.getCharacterData(start, &invalid);
@@ -270,6 +285,113 @@ SourceRange getExpansionRange(SourceManager& sourceManager, const Decl* decl) {
             getExpansionEnd(sourceManager, decl));
 }
 
+LocationFinder::LocationFinder(SourceManager& sourceManager_, const LangOptions& langOptions_)
+    : sourceManager(sourceManager_)
+    , langOptions(langOptions_)
+{
+}
+
+LocationFinder::~LocationFinder() = default;
+
+SourceRange LocationFinder::getExpansionRange(const Decl* decl) {
+    auto it = expansionRanges.find(decl);
+    if (it == expansionRanges.end())
+        it = expansionRanges.insert({decl, internal::getExpansionRange(sourceManager, decl)}).first;
+    return it->second;
+}
+
+SourceLocation LocationFinder::getExpansionStart(const Decl* decl) {
+    return getExpansionRange(decl).getBegin();
+}
+
+SourceLocation LocationFinder::getExpansionEnd(const Decl* decl) {
+    return getExpansionRange(decl).getEnd();
+}
+
+unsigned LocationFinder::getOffset(SourceLocation loc) const {
+    return sourceManager.getFileOffset(loc);
+}
+
+void LocationFinder::restart(unsigned offset) {
+    ++numRestarts;
+    StringRef file = sourceManager.getBufferData(currentFile);
+    lexer.reset(new Lexer(sourceManager.getLocForStartOfFile(currentFile), langOptions,
+            file.begin(), file.begin() + offset, file.end()));
+    // Comments are returned as tokens, so that a comment spanning the requested offset
+    // is detected in seek().
+    lexer->SetCommentRetentionState(true);
+    previousEnd = offset;
+    lexer->LexFromRawLexer(current);
+}
+
+void LocationFinder::lexNext() {
+    previousEnd = getOffset(current.getLocation()) + current.getLength();
+    lexer->LexFromRawLexer(current);
+}
+
+bool LocationFinder::seek(FileID fileID, unsigned offset) {
+    if (!lexer || fileID != currentFile) {
+        bool invalid = false;
+        sourceManager.getBufferData(fileID, &invalid);
+        if (invalid)
+            return false;
+        currentFile = fileID;
+        restart(offset);
+    } else if (offset < previousEnd) {
+        restart(offset);
+    }
+
+    while (current.isNot(tok::eof) && getOffset(current.getLocation()) + current.getLength() <= offset)
+        lexNext();
+
+    if (current.isNot(tok::eof) && getOffset(current.getLocation()) < offset) {
+        // The token spans the offset: the lexer got out of sync with the real token
+        // boundaries (e.g. in the text of an inactive preprocessor block).
+        restart(offset);
+    }
+
+    while (current.is(tok::comment))
+        lexNext();
+    return true;
+}
+
+SourceLocation LocationFinder::findTokenAfterLocation(SourceLocation loc, tok::TokenKind tokenType, bool IsDecl) {
+    if (loc.isMacroID()) {
+        if (!Lexer::isAtEndOfMacroExpansion(loc, sourceManager, langOptions, &loc))
+            return SourceLocation();
+    }
+
+    std::pair<FileID, unsigned> locInfo = sourceManager.getDecomposedLoc(loc);
+    if (!seek(locInfo.first, locInfo.second))
+        return SourceLocation();
+
+    unsigned offset = 0;
+    if (current.isNot(tok::eof) && getOffset(current.getLocation()) == locInfo.second) {
+        offset = locInfo.second + current.getLength();
+    } else {
+        SourceLocation end = Lexer::getLocForEndOfToken(loc, /*Offset=*/0, sourceManager, langOptions);
+        if (end.isInvalid())
+            return SourceLocation();
+        offset = getOffset(end);
+    }
+
+    // Declaration may be followed with other tokens, such as an __attribute,
+    // before ending with a semicolon.
+    while (true) {
+        if (!seek(locInfo.first, offset))
+            return SourceLocation();
+        if (current.is(tokenType))
+            return current.getLocation();
+        if (!IsDecl || current.is(tok::eof))
+            return SourceLocation();
+        offset = getOffset(current.getLocation()) + current.getLength();
+    }
+}
+
+SourceLocation LocationFinder::findSemiAfterLocation(SourceLocation loc, bool IsDecl) {
+    return findTokenAfterLocation(loc, tok::semi, IsDecl);
+}
+
 }
 }
 
@@ -6,7 +6,11 @@
 
 #pragma once
 
+#include <clang/Basic/SourceLocation.h>
 #include <clang/Basic/TokenKinds.h>
+#include <clang/Lex/Token.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/IntrusiveRefCntPtr.h>
 
 #include <memory>
 #include <string>
@@ -16,13 +20,15 @@
 namespace clang {
     class ASTContext;
     class Decl;
+    class FileManager;
     class LangOptions;
-    class SourceLocation;
+    class Lexer;
     class SourceManager;
-    class SourceRange;
     class Stmt;
 
     namespace tooling {
+        class ClangTool;
+        class CompilationDatabase;
         class FixedCompilationDatabase;
     }
 }
@@ -38,6 +44,13 @@ std::pair<const char*, const char*> getCharRange(clang::SourceRange range, const
 
 std::unique_ptr<clang::tooling::FixedCompilationDatabase> createCompilationDatabaseFromCommandLine(const std::vector<std::string>& cmdLine);
 
+// If fileManager is not null, the tool will use it for all file system access
+// (supported since clang 10; ignored in earlier versions).
+std::unique_ptr<clang::tooling::ClangTool> createClangTool(
+        const clang::tooling::CompilationDatabase& compilationDatabase,
+        const std::vector<std::string>& sources,
+        llvm::IntrusiveRefCntPtr<clang::FileManager> fileManager);
+
 std::string rangeToString(clang::SourceManager& sourceManager,
         const clang::SourceLocation& start, const clang::SourceLocation& end);
 
@@ -54,6 +67,45 @@ clang::SourceLocation getExpansionEnd(clang::SourceManager& sourceManager,
 clang::SourceRange getExpansionRange(clang::SourceManager& sourceManager,
         const clang::Decl* decl);
 
+// Same as the functions above, for many queries over one file: expansion ranges of
+// declarations are memoized, and tokens are found with one raw lexer that moves forward
+// through the file. Queries mostly come in source order, so the lexer is rarely restarted.
+class LocationFinder {
+public:
+    LocationFinder(clang::SourceManager& sourceManager, const clang::LangOptions& langOptions);
+    ~LocationFinder();
+
+    clang::SourceRange getExpansionRange(const clang::Decl* decl);
+    clang::SourceLocation getExpansionStart(const clang::Decl* decl);
+    clang::SourceLocation getExpansionEnd(const clang::Decl* decl);
+
+    clang::SourceLocation findTokenAfterLocation(clang::SourceLocation loc, clang::tok::TokenKind tokenType,
+            bool IsDecl = false);
+    clang::SourceLocation findSemiAfterLocation(clang::SourceLocation loc, bool IsDecl);
+
+    // Number of times the lexer was started at a new position
+    std::size_t getNumRestarts() const { return numRestarts; }
+
+private:
+    // Positions the lexer at the first token (other than a comment) starting at or after
+    // the offset, which must be a token boundary. Returns false if the buffer is invalid.
+    bool seek(clang::FileID fileID, unsigned offset);
+    void restart(unsigned offset);
+    void lexNext();
+    unsigned getOffset(clang::SourceLocation loc) const;
+
+    clang::SourceManager& sourceManager;
+    const clang::LangOptions& langOptions;
+    llvm::DenseMap<const clang::Decl*, clang::SourceRange> expansionRanges;
+
+    clang::FileID currentFile;
+    std::unique_ptr<clang::Lexer> lexer;
+    // Current token, and end offset of the token before it
+    clang::Token current;
+    unsigned previousEnd = 0;
+    std::size_t numRestarts = 0;
+};
+
 }
 }
 
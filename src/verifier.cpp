@@ -0,0 +1,86 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#include "verifier.h"
+#include "Budget.h"
+#include "caide_trace.h"
+#include "clang_version.h"
+#include "ErrorCollector.h"
+#include "Timer.h"
+#include "util.h"
+
+#include <clang/Basic/FileManager.h>
+#include <clang/Frontend/CompilerInstance.h>
+#include <clang/Frontend/FrontendActions.h>
+#include <clang/Tooling/CompilationDatabase.h>
+#include <clang/Tooling/Tooling.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+using namespace clang;
+using std::string;
+using std::vector;
+
+
+namespace caide {
+namespace internal {
+
+namespace {
+
+class VerifierFrontendAction: public SyntaxOnlyAction {
+protected:
+#if CAIDE_CLANG_VERSION_AT_LEAST(5,0)
+    bool BeginSourceFileAction(CompilerInstance& compiler) override
+#else
+    bool BeginSourceFileAction(CompilerInstance& compiler, StringRef /*FileName*/) override
+#endif
+    {
+        Budget::watch(compiler);
+        return true;
+    }
+};
+
+}
+
+Verifier::Verifier(const vector<string>& cmdLineOptions_,
+                   llvm::IntrusiveRefCntPtr<FileManager> fileManager_)
+    : cmdLineOptions(cmdLineOptions_)
+    , fileManager(std::move(fileManager_))
+{}
+
+vector<string> Verifier::check(const string& cppFile, const SourceMap* sourceMap) {
+    ScopedTimer t("Verifier::check");
+    CAIDE_TRACE1(verify_begin, cppFile.c_str());
+    std::unique_ptr<tooling::FixedCompilationDatabase> compilationDatabase(
+        createCompilationDatabaseFromCommandLine(cmdLineOptions));
+
+    vector<string> sources;
+    sources.push_back(cppFile);
+
+    ErrorCollector errors;
+    errors.setSourceMap(sourceMap);
+    std::unique_ptr<tooling::ClangTool> tool =
+        createClangTool(*compilationDatabase, sources, fileManager);
+    tool->setDiagnosticConsumer(&errors);
+
+    std::unique_ptr<tooling::FrontendActionFactory> factory =
+        tooling::newFrontendActionFactory<VerifierFrontendAction>();
+    const int ret = tool->run(factory.get());
+    CAIDE_TRACE1(verify_end, ret == 0 ? 0 : std::max<std::size_t>(errors.getErrors().size(), 1));
+    if (ret == 0)
+        return {};
+
+    if (errors.getErrors().empty())
+        return {"Compilation of " + cppFile + " failed"};
+    return errors.getErrors();
+}
+
+}
+}
@@ -0,0 +1,43 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#pragma once
+
+#include <llvm/ADT/IntrusiveRefCntPtr.h>
+
+#include <string>
+#include <vector>
+
+namespace clang {
+    class FileManager;
+}
+
+namespace caide {
+namespace internal {
+
+class SourceMap;
+
+// Checks that a program compiles (parsing and semantic analysis only, no code generation).
+class Verifier {
+public:
+    // If fileManager is not null, it is used for all file system access. Passing the
+    // file manager of the previous stages avoids reading system headers again.
+    explicit Verifier(const std::vector<std::string>& cmdLineOptions,
+                      llvm::IntrusiveRefCntPtr<clang::FileManager> fileManager = nullptr);
+
+    // Returns compilation errors; an empty list means that the file compiles.
+    //
+    // If sourceMap is not null, errors in cppFile are reported in the original files
+    // it was generated from.
+    std::vector<std::string> check(const std::string& cppFile, const SourceMap* sourceMap = nullptr);
+
+private:
+    std::vector<std::string> cmdLineOptions;
+    llvm::IntrusiveRefCntPtr<clang::FileManager> fileManager;
+};
+
+}
+}
@@ -0,0 +1,15 @@
+struct A {
+    A() {}
+    A(int) {}
+    A(const char*) {}
+};
+
+// A(int) is called implicitly, only in the instantiation make<int>.
+template<typename T>
+A make(T t) {
+    return t;
+}
+
+int main() {
+    make(1);
+}
@@ -0,0 +1,13 @@
+struct A {
+    A(int) {}
+};
+
+// A(int) is called implicitly, only in the instantiation make<int>.
+template<typename T>
+A make(T t) {
+    return t;
+}
+
+int main() {
+    make(1);
+}
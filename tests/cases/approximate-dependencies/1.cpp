@@ -0,0 +1,12 @@
+int unused() {
+    return 0;
+}
+
+template<typename T>
+T twice(T x) {
+    return x + x;
+}
+
+int main() {
+    return twice(1);
+}
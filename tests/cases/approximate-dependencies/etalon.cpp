@@ -0,0 +1,8 @@
+template<typename T>
+T twice(T x) {
+    return x + x;
+}
+
+int main() {
+    return twice(1);
+}
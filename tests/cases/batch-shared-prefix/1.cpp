@@ -0,0 +1,10 @@
+#include <vector>
+
+int unused() {
+    return 0;
+}
+
+int main() {
+    std::vector<int> v(2);
+    return (int)v.size();
+}
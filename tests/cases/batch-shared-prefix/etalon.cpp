@@ -0,0 +1,6 @@
+#include <vector>
+
+int main() {
+    std::vector<int> v(2);
+    return (int)v.size();
+}
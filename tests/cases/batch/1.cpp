@@ -0,0 +1,11 @@
+int unused() {
+    return 1;
+}
+
+int square(int x) {
+    return x * x;
+}
+
+int main() {
+    return square(2);
+}
@@ -0,0 +1,12 @@
+#include <myset.h>
+#include <mymap.h>
+#  include   <myvector.h>
+void f(mystd::vector& v) {}
+
+#include<myset.h>
+int main() {
+    mystd::map map;
+    mystd::set set;
+    mystd::vector v;
+    f(v);
+}
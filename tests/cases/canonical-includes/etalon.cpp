@@ -0,0 +1,11 @@
+#include <myvector.h>
+#include <mymap.h>
+#include <myset.h>
+void f(mystd::vector& v) {}
+
+int main() {
+    mystd::map map;
+    mystd::set set;
+    mystd::vector v;
+    f(v);
+}
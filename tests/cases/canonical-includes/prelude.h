@@ -0,0 +1 @@
+#include <myvector.h>
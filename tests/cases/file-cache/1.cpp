@@ -0,0 +1,7 @@
+#include <vector>
+#include "util.h"
+
+int main() {
+    std::vector<int> v(3);
+    return twice((int)v.size());
+}
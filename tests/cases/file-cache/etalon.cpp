@@ -0,0 +1,7 @@
+#include <vector>
+inline int twice(int x) { return 2 * x; }
+
+int main() {
+    std::vector<int> v(3);
+    return twice((int)v.size());
+}
@@ -0,0 +1,8 @@
+#include <map>
+#include <string>
+#include <vector>
+
+int main() {
+    std::map<std::string, std::vector<int>> m;
+    return (int)m.size();
+}
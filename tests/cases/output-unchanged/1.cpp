@@ -0,0 +1,11 @@
+int unused() {
+    return 0;
+}
+
+int used() {
+    return 1;
+}
+
+int main() {
+    return used();
+}
@@ -0,0 +1,7 @@
+int used() {
+    return 1;
+}
+
+int main() {
+    return used();
+}
@@ -0,0 +1,15 @@
+struct A {};
+struct B {};
+struct C {};
+
+void g(unsigned long long) {}
+
+// char[sizeof(A)] and char[sizeof(B)] are the same type.
+void f() {
+    g(sizeof(char[sizeof(A)]));
+    g(sizeof(char[sizeof(B)]));
+}
+
+int main() {
+    f();
+}
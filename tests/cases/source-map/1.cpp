@@ -0,0 +1,9 @@
+#include "header.h"
+
+int unused() {
+    return 0;
+}
+
+int main() {
+    return twice(21);
+}
@@ -0,0 +1,5 @@
+inline int twice(int x) { return 2 * x; }
+
+int main() {
+    return twice(21);
+}
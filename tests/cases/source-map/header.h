@@ -0,0 +1,3 @@
+#pragma once
+inline int unusedInHeader() { return 1; }
+inline int twice(int x) { return 2 * x; }
@@ -0,0 +1,13 @@
+int unused1() {
+    return 1;
+}
+
+int unused2() {
+    return 2;
+}
+
+// Removing the unused functions above moves this line.
+static_assert(__LINE__ == 10, "line numbers changed");
+
+int main() {
+}